@@ -0,0 +1,480 @@
+/**
+ * @file   BaumWelch.cc
+ *
+ * @brief  batch EM (Baum-Welch) training of an HMM
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <torch/general.h>
+
+#include "../imatlib/IMatVecOps.hh"
+
+#include "BaumWelch.hh"
+
+using namespace Torch;
+
+/**
+ * Per-thread forward-backward workspace and statistics.
+ */
+
+struct BWWork
+{
+   IMat alpha;     // scaled forward variables (T x r)
+   IMat beta;      // scaled backward variables (T x r)
+   IMat e;         // emission likelihoods, scaled per frame (T x r)
+   IMat V;         // e .* beta / c, for the transition counts (T x r)
+   IMat gamma;     // state posteriors (T x r)
+   IVec c;         // per-frame normalization of alpha
+   IVec brk;       // 1 where the forward pass was restarted
+
+   IMat N;         // sum_t alpha(t-1)' * V(t); xi = A .* N
+   IVec pi_s;
+   IVec b_s;
+
+   real log_prob;
+   real frames;
+
+   BWWork(int r, int nb) : N(r, r), pi_s(r), b_s(nb > 0 ? nb : 1),
+                           log_prob(0.0), frames(0.0)
+   {
+      N.fill(0.0);
+      pi_s.fill(0.0);
+      b_s.fill(0.0);
+   }
+};
+
+/**
+ * Scaled forward-backward over one sequence.
+ *
+ * If the likelihood of a frame is zero, the forward pass is restarted
+ * from that frame alone (as in HMM::ClassifyBlock()), and no
+ * transition is counted into it.
+ *
+ * @param A transition matrix
+ * @param logF emission log likelihoods (T x r)
+ * @param pi initial state distribution
+ * @param w workspace; gamma is filled in and N is accumulated
+ *
+ * @return log likelihood of the sequence
+ */
+
+static real forwardBackward(IMat *A, IMat *logF, IVec *pi, BWWork *w)
+{
+   int t, i;
+   int T = logF->m;
+   int r = logF->n;
+   real log_prob = 0.0;
+
+   w->alpha.reshape(T, r);
+   w->beta.reshape(T, r);
+   w->e.reshape(T, r);
+   w->V.reshape(T, r);
+   w->gamma.reshape(T, r);
+   w->c.resize(T);
+   w->brk.resize(T);
+
+   // Forward
+
+   for (t = 0; t < T; t++)
+   {
+      real *lf = logF->ptr[t];
+      real *e = w->e.ptr[t];
+      real *a = w->alpha.ptr[t];
+      real lf_max = -INF;
+      real s = 0.0;
+
+      for (i = 0; i < r; i++)
+         if (lf[i] > lf_max)
+            lf_max = lf[i];
+
+      for (i = 0; i < r; i++)
+         e[i] = exp(lf[i] - lf_max);
+
+      if (t == 0)
+      {
+         for (i = 0; i < r; i++)
+            a[i] = (*pi)(i) * e[i];
+      }
+      else
+      {
+         IVec a_prev(w->alpha.ptr[t-1], r);
+         IVec a_cur(a, r);
+
+         MatVecMult(A, CblasTrans, &a_prev, &a_cur);  // a = A'alpha(t-1)
+
+         for (i = 0; i < r; i++)
+            a[i] *= e[i];
+      }
+
+      for (i = 0; i < r; i++)
+         s += a[i];
+
+      w->brk(t) = 0.0;
+
+      if (s == 0.0)
+      {
+         for (i = 0; i < r; i++)
+         {
+            a[i] = e[i];
+            s += a[i];
+         }
+
+         lf_max += log(REAL_EPSILON);
+         w->brk(t) = 1.0;
+      }
+
+      for (i = 0; i < r; i++)
+         a[i] /= s;
+
+      w->c(t) = s;
+      log_prob += lf_max + log(s);
+   }
+
+   // Backward
+
+   if (T > 0)
+   {
+      real *bt = w->beta.ptr[T-1];
+
+      for (i = 0; i < r; i++)
+         bt[i] = 1.0;
+
+      memset(w->V.ptr[0], 0, r*sizeof(real));
+   }
+
+   for (t = T-1; t > 0; t--)
+   {
+      real *v = w->V.ptr[t];
+      real *e = w->e.ptr[t];
+      real *bt = w->beta.ptr[t];
+      real *bp = w->beta.ptr[t-1];
+
+      if (w->brk(t) != 0.0)
+      {
+         for (i = 0; i < r; i++)
+         {
+            v[i] = 0.0;
+            bp[i] = 1.0;
+         }
+
+         continue;
+      }
+
+      for (i = 0; i < r; i++)
+         v[i] = e[i] * bt[i] / w->c(t);
+
+      IVec v_t(v, r);
+      IVec b_prev(bp, r);
+
+      MatVecMult(A, CblasNoTrans, &v_t, &b_prev);     // beta(t-1) = A*v
+   }
+
+   // Posteriors
+
+   for (t = 0; t < T; t++)
+   {
+      real *g = w->gamma.ptr[t];
+      real *a = w->alpha.ptr[t];
+      real *bt = w->beta.ptr[t];
+      real s = 0.0;
+
+      for (i = 0; i < r; i++)
+      {
+         g[i] = a[i] * bt[i];
+         s += g[i];
+      }
+
+      if (s > 0.0)
+         for (i = 0; i < r; i++)
+            g[i] /= s;
+   }
+
+   // Transitions: N += alpha(0:T-2)' * V(1:T-1)
+
+   if (T > 1)
+   {
+      IMat a_blk(w->alpha.base, T-1, r);
+      IMat v_blk(w->V.base + r, T-1, r);
+
+      GenMatMatMult(1.0, &a_blk, CblasTrans, &v_blk, CblasNoTrans, 1.0, &w->N);
+   }
+
+   return log_prob;
+}
+
+
+BaumWelch::BaumWelch(HMM *hmm_)
+   : hmm(hmm_),
+     update_A(true),
+     update_b(true),
+     update_pi(true),
+     min_count(1.0),
+     max_threads(0),
+     verbose(false),
+     frames(0.0),
+     log_prob(0.0),
+     dropped(0),
+     r(hmm_->r),
+     blk_logF(NULL),
+     n_blk(0)
+{
+   xi = new IMat(r, r);
+   pi_stats = new IVec(r);
+   b_stats = new IVec(1);
+
+   xi->fill(0.0);
+   pi_stats->fill(0.0);
+}
+
+BaumWelch::~BaumWelch()
+{
+   for (int k = 0; k < n_blk; k++)
+      delete blk_logF[k];
+
+   delete[] blk_logF;
+
+   delete xi;
+   delete pi_stats;
+   delete b_stats;
+}
+
+/**
+ * E-step: accumulate expected transition, initial state and emission
+ * statistics over a set of sequences with the current parameters.
+ *
+ * The emission log likelihoods are computed first, one sequence at a
+ * time (the emission models' workspaces are not reentrant); the
+ * forward-backward passes and the statistics then run in parallel.
+ * Sequences the emission model rejects (wrong width, symbols out of
+ * range) are skipped and counted in dropped.
+ *
+ * @param Y observation sequences, one observation per row
+ * @param n number of sequences
+ * @param pi initial state distribution (uniform if NULL)
+ *
+ * @return total log likelihood of the sequences
+ */
+
+real BaumWelch::EStep(IMat **Y, int n, IVec *pi)
+{
+   int k, th;
+   int nb = update_b ? hmm->b->EMStatsSize() : 0;
+
+   // Emission likelihoods
+
+   if (n > n_blk)
+   {
+      IMat **tmp = new IMat*[n];
+
+      for (k = 0; k < n; k++)
+         tmp[k] = (k < n_blk) ? blk_logF[k] : new IMat();
+
+      delete[] blk_logF;
+      blk_logF = tmp;
+      n_blk = n;
+   }
+
+   bool *use = new bool[n];
+
+   dropped = 0;
+
+   for (k = 0; k < n; k++)
+   {
+      use[k] = Y[k]->m > 0;
+
+      if (use[k] && hmm->b->LogLikBlock(Y[k], blk_logF[k]) != 0)
+      {
+         warning("BaumWelch: sequence %d rejected by the emission model, skipped\n", k);
+         use[k] = false;
+         dropped++;
+      }
+   }
+
+   IVec pi_u(r);
+
+   if (pi == NULL)
+   {
+      pi_u.fill(1.0/r);
+      pi = &pi_u;
+   }
+
+   // Forward-backward, in parallel
+
+   int n_threads = 1;
+
+#ifdef _OPENMP
+   n_threads = (max_threads > 0) ? max_threads : omp_get_max_threads();
+#endif
+
+   if (n_threads > n)
+      n_threads = n;
+
+   if (n_threads < 1)
+      n_threads = 1;
+
+   BWWork **work = new BWWork*[n_threads];
+
+   for (th = 0; th < n_threads; th++)
+      work[th] = new BWWork(r, nb);
+
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+   for (k = 0; k < n; k++)
+   {
+      int tid = 0;
+
+#ifdef _OPENMP
+      tid = omp_get_thread_num();
+#endif
+
+      BWWork *w = work[tid];
+
+      if (!use[k])
+         continue;
+
+      w->log_prob += forwardBackward(hmm->A, blk_logF[k], pi, w);
+      w->frames += Y[k]->m;
+
+      for (int i = 0; i < r; i++)
+         w->pi_s(i) += w->gamma(0,i);
+
+      if (nb > 0)
+         hmm->b->EMAccumulate(Y[k], &w->gamma, w->b_s.ptr);
+   }
+
+   // Reduction (in thread order, so the result does not depend on timing)
+
+   xi->fill(0.0);
+   pi_stats->fill(0.0);
+   b_stats->resize(nb > 0 ? nb : 1);
+   b_stats->fill(0.0);
+
+   log_prob = 0.0;
+   frames = 0.0;
+
+   for (th = 0; th < n_threads; th++)
+   {
+      BWWork *w = work[th];
+
+      MatAddScaled(1.0, &w->N, xi);
+      VecAddScaled(1.0, &w->pi_s, pi_stats);
+
+      if (nb > 0)
+         VecAddScaled(1.0, &w->b_s, b_stats);
+
+      log_prob += w->log_prob;
+      frames += w->frames;
+
+      delete w;
+   }
+
+   delete[] work;
+   delete[] use;
+
+   // Expected transition counts: xi = A .* N
+
+   for (int i = 0; i < r; i++)
+      for (int j = 0; j < r; j++)
+         (*xi)(i,j) *= (*hmm->A)(i,j);
+
+   return log_prob;
+}
+
+/**
+ * M-step: set the parameters from the statistics of the last EStep().
+ * Resets the HMM's filter and RMLE state afterwards.
+ *
+ * @param pi initial state distribution to update (if update_pi is set)
+ *
+ * @return 0 on success, -1 if the emission model could not be updated
+ */
+
+int BaumWelch::MStep(IVec *pi)
+{
+   int i, j;
+   int ret = 0;
+
+   if (update_A)
+   {
+      for (i = 0; i < r; i++)
+      {
+         real n = 0.0;
+
+         for (j = 0; j < r; j++)
+            n += (*xi)(i,j);
+
+         if (n < min_count || n <= 0.0)
+            continue;
+
+         for (j = 0; j < r; j++)
+            (*hmm->A)(i,j) = (*xi)(i,j)/n;
+      }
+
+      hmm->ProbProject(hmm->A, hmm->prior, 2);
+   }
+
+   if (update_b && hmm->b->EMStatsSize() > 0)
+      ret = hmm->b->EMUpdate(b_stats->ptr, min_count);
+
+   if (update_pi && pi != NULL)
+   {
+      real n = 0.0;
+
+      for (i = 0; i < r; i++)
+         n += (*pi_stats)(i);
+
+      if (n > 0.0)
+         for (i = 0; i < r; i++)
+            (*pi)(i) = (*pi_stats)(i)/n;
+   }
+
+   hmm->reset();
+
+   return ret;
+}
+
+/**
+ * Run EM until the log likelihood stops improving.
+ *
+ * @param Y observation sequences, one observation per row
+ * @param n number of sequences
+ * @param max_iter maximum number of iterations
+ * @param tol stop when the log likelihood per frame improves by less
+ * @param pi initial state distribution (uniform and not trained if NULL)
+ *
+ * @return log likelihood from the last E-step
+ */
+
+real BaumWelch::Train(IMat **Y, int n, int max_iter, real tol, IVec *pi)
+{
+   real last = -INF;
+
+   for (int it = 0; it < max_iter; it++)
+   {
+      real ll = EStep(Y, n, pi);
+      real per_frame = (frames > 0.0) ? ll/frames : 0.0;
+
+      if (verbose)
+         printf("EM iteration %d: log likelihood %g (%g per frame)\n", it, ll, per_frame);
+
+      if (it > 0 && per_frame - last < tol)
+         break;
+
+      last = per_frame;
+
+      if (MStep(pi) != 0)
+      {
+         warning("BaumWelch: M-step of the emission model failed\n");
+         break;
+      }
+   }
+
+   return log_prob;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file   BaumWelch.hh
+ *
+ * @brief  batch EM (Baum-Welch) training of an HMM
+ *
+ * Trains an HMM over a set of observation sequences at once, as an
+ * alternative to the online RMLE updates.  The emission model must
+ * support the EM interface of StochasticClassifier (EMStatsSize(),
+ * EMAccumulate(), EMUpdate()); Gaussian and IndepPMF do.
+ *
+ * The E-step runs forward-backward on each sequence in parallel
+ * (OpenMP, if available) with per-thread statistics, which are then
+ * summed for a single M-step.
+ *
+ */
+
+#ifndef BAUMWELCH_HH
+#define BAUMWELCH_HH
+
+#include <torch/general.h>
+#include "../imatlib/IMat.hh"
+#include "../imatlib/IVec.hh"
+
+#include "HMM.hh"
+
+using namespace Torch;
+
+class BaumWelch
+{
+public:
+
+   HMM                 *hmm;
+
+   bool            update_A;   ///< re-estimate the transition matrix
+   bool            update_b;   ///< re-estimate the emission model
+   bool           update_pi;   ///< re-estimate pi (if one is given)
+
+   real           min_count;   ///< states with less occupancy are not updated
+   int          max_threads;   ///< 0: OpenMP default
+   bool             verbose;
+
+   real              frames;   ///< frames in the last E-step
+   real            log_prob;   ///< log likelihood from the last E-step
+   int              dropped;   ///< sequences the last E-step had to skip
+
+private:
+
+   int                    r;
+
+   IMat                 *xi;   ///< expected transition counts (r x r)
+   IVec           *pi_stats;   ///< expected initial state counts
+   IVec            *b_stats;   ///< emission statistics
+
+   IMat          **blk_logF;   ///< emission log likelihoods, per sequence
+   int              n_blk;
+
+public:
+
+   BaumWelch(HMM *hmm_);
+
+   ~BaumWelch();
+
+   real EStep(IMat **Y, int n, IVec *pi = NULL);
+
+   int MStep(IVec *pi = NULL);
+
+   real Train(IMat **Y,
+              int n,
+              int max_iter = 20,
+              real tol = 1e-4,
+              IVec *pi = NULL);
+
+};
+
+#endif // BAUMWELCH_HH
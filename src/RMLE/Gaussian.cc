@@ -91,6 +91,7 @@ static char *Gaussian_CC_Id = "$Id: Gaussian.cc,v 1.1 2005/05/09 20:52:57 mrmccl
 #include "../imatlib/IMat.hh"
 #include "../imatlib/IVec.hh"
 #include "../imatlib/IVecInt.hh"
+#include "../imatlib/IExpr.hh"
 
 #include "Gaussian.hh"
 #include "N.hh"
@@ -108,6 +109,7 @@ Gaussian::Gaussian() :
     		  S_R(NULL),
     		  S_R_new(NULL),
     		  u(NULL),
+    		  n_tri(0),
     		  w_MU(NULL),
     		  w_MU_next(NULL),
     		  w_R(NULL),
@@ -119,10 +121,19 @@ Gaussian::Gaussian() :
     		  df_R(NULL),
     		  scale(0.0),
     		  silence_state(-1),
-    		  MU_temp(NULL),
-    		  R_temp(NULL),
-    		  df_MU_temp(NULL),
-    		  df_R_temp(NULL)
+    		  log_f(NULL),
+    		  S_R_tri(NULL),
+    		  r2_valid(false),
+    		  SigmaInv(NULL),
+    		  Rinv(NULL),
+    		  log_norm(NULL),
+    		  cache_valid(false),
+    		  nws(NULL),
+    		  Rinv_f(NULL),
+    		  mu_f(NULL),
+    		  blk_Yc_f(NULL),
+    		  blk_Z_f(NULL),
+    		  blk_f_len(0)
     		  {
 	G_allocator = new Allocator;
 	addOptions();
@@ -254,6 +265,9 @@ void Gaussian::addOptions()
 
 	addROption("u min", &u_min, 0.01, "minimum value for diag. variances.");
 	addIOption("silence_state", &silence_state, -1, "state to use for silence (not updated)");
+	addBOption("single", &single, false, "float32 block evaluation (LogLikBlock)");
+	addBOption("kmeans++", &kmeans_pp, true, "k-means++ seeding for KMeansInit");
+	addIOption("kmeans batch", &kmeans_batch, 0, "mini-batch size for KMeansInit (0: full batch)");
 
 }
 
@@ -335,35 +349,66 @@ int Gaussian::init(IMat *MU_,
 		S_R_new = new(G_allocator) IMat(r,d*d);
 		S_R_new->zero();
 
-		w_R = new(G_allocator) IMat(r,r*d*d);
+		// only the upper triangle of each R is a parameter
+
+		n_tri = d*(d+1)/2;
+
+		w_R = new(G_allocator) IMat(r,r*n_tri);
 		w_R->zero();
-		w_R_next = new(G_allocator) IMat(r,r*d*d);
+		w_R_next = new(G_allocator) IMat(r,r*n_tri);
 		w_R_next->zero();
 
+		S_R_tri = new(G_allocator) IVec(r*n_tri);
+
 		log_prob = 0;
 		best_class = -1;
 
 		Rs = new(G_allocator) IMat(r,r);
+		Rs->zero();
 		R1 = new(G_allocator) IMat(r,r);
-		R2_MU = new(G_allocator) IMat(r,r*d);
+		R1->zero();
+		R2_MU = new(G_allocator) IMat(r,d);
 		R2_MU->zero();
-		R2_R = new(G_allocator) IMat(r,r*d*d);
+		R2_R = new(G_allocator) IMat(r,n_tri);
 		R2_R->zero();
+		r2_valid = false;
 
-		df_MU = new(G_allocator) IMat(r,r*d);
+		df_MU = new(G_allocator) IMat(r,d);
 		df_MU->zero();
-		df_R = new(G_allocator) IMat(r,r*d*d);
+		df_R = new(G_allocator) IMat(r,d*d);
 		df_R->zero();
 
-		df_MU_temp = new(G_allocator) IMat(r,r*d);
-		df_MU_temp->zero();
-		df_R_temp = new(G_allocator) IMat(r,r*d*d);
-		df_R_temp->zero();
-
 		u = NULL;  // Later set to point to the u in the corresponding HMM
 
-		MU_temp = new(G_allocator) IMat(r,d);
-		R_temp = new(G_allocator) IMat(r,d*d);
+		// density cache and workspace
+
+		log_f = new(G_allocator) IVec(r);
+		log_f->zero();
+
+		SigmaInv = new(G_allocator) IMat(r,d*d);
+		Rinv = new(G_allocator) IMat(r,d*d);
+		log_norm = new(G_allocator) IVec(r);
+		cache_valid = false;
+
+		nws = new(G_allocator) NWorkspace(d);
+
+		y_vec = new(G_allocator) IVec;
+		mu_vec = new(G_allocator) IVec;
+		R_mat = new(G_allocator) IMat;
+		Sinv_mat = new(G_allocator) IMat;
+		df_vec1 = new(G_allocator) IVec;
+		df_vec2 = new(G_allocator) IVec;
+		df_R_mat = new(G_allocator) IMat;
+		S_R_mat = new(G_allocator) IMat;
+
+		blk_Yc = new(G_allocator) IMat;
+		blk_Z = new(G_allocator) IMat;
+
+		Rinv_f = (float *)G_allocator->alloc(sizeof(float)*r*d*d);
+		mu_f = (float *)G_allocator->alloc(sizeof(float)*d);
+		blk_Yc_f = NULL;
+		blk_Z_f = NULL;
+		blk_f_len = 0;
 
 		return 0;
 }
@@ -469,52 +514,115 @@ void Gaussian::reset()
 	R1->zero();
 	R2_MU->zero();
 
+	r2_valid = false;
+
 	df_MU->zero();
 	df_R->zero();
-	df_MU_temp->zero();
-	df_R_temp->zero();
 
 	StochasticClassifier::reset();
 }
 
+void Gaussian::invalidateDensityCache()
+{
+	cache_valid = false;
+}
+
+void Gaussian::updateDensityCache()
+{
+	for (int i = 0; i < r; i++)
+	{
+		R->getRow(i, 0, d, d, R_mat);
+		SigmaInv->getRow(i, 0, d, d, Sinv_mat);
+
+		NCholInv(R_mat, Sinv_mat);           // inv(Sigma) = inv(R'R)
+		(*log_norm)(i) = NLogNorm(R_mat);
+
+		Rinv->getRow(i, 0, d, d, Sinv_mat);
+		MatCopy(R_mat, Sinv_mat);
+		MatUpTriInv(Sinv_mat);               // inv(R)
+
+		// R may hold junk below the diagonal (e.g., after KMeansInit)
+
+		for (int j = 1; j < d; j++)
+			for (int k = 0; k < j; k++)
+				Sinv_mat->ptr[j][k] = 0.0;
+
+		float *rf = Rinv_f + i*d*d;
+
+		for (int j = 0; j < d*d; j++)
+			rf[j] = (float)Sinv_mat->base[j];
+	}
+
+	cache_valid = true;
+}
+
+/** 
+ * Upper bound on the log density of any observation under any state,
+ * i.e., the largest log normalizer (the density at the mean).
+ * 
+ * @return max_i log f_i(mu_i)
+ */
+
+real Gaussian::LogLikBound()
+{
+	if (!cache_valid)
+		updateDensityCache();
+
+	return log_norm->vmax();
+}
+
 int Gaussian::Classify(real *y)
 {
 	int i;
 
-	//   static IVec *data = new IVec;
-	static IVec data;
-	static IVec d2;
+	if (!cache_valid)
+		updateDensityCache();
+
+	y_vec->set(y, d);
+
+	real max_loglik = -INF;
+
+	// In the log domain, prob and the derivatives are scaled by the
+	// largest density, so they can't all underflow to zero.  The
+	// products the HMM uses (scale*f, scale*df) don't change.  Each
+	// state is evaluated once, with the derivatives of its log density,
+	// and those are scaled by prob once the largest density is known.
+
+	for (i = 0; i < r; i++)
+	{
+		MU->getRow(i, mu_vec);
+		df_MU->getRow(i, df_vec1);
 
-	data.set(y, d);
+		R->getRow(i, 0, d, d, R_mat);
+		SigmaInv->getRow(i, 0, d, d, Sinv_mat);
+		df_R->getRow(i, 0, d, d, df_R_mat);
 
-	real max_lik = 0;
+		if (log_domain)
+			(*log_f)(i) = dlogN(y_vec, mu_vec, R_mat, Sinv_mat, (*log_norm)(i),
+					nws, df_vec1, df_R_mat);
+		else
+			(*log_f)(i) = logN(y_vec, mu_vec, R_mat, Sinv_mat, (*log_norm)(i),
+					nws, df_vec1, df_R_mat);
+	}
 
-	static IVec *df_mu = new IVec;
-	static IMat *df_rr = new IMat;
-	static IVec *mu = new IVec;
-	static IMat *rr = new IMat;
+	log_offset = log_domain ? log_f->vmax() : 0.0;
 
 	if (debug)
 		printf("\n");
 
 	for (i = 0; i < r; i++)
 	{
-		MU->getRow(i, mu);
-		df_MU->getRow(i, i*d, d, df_mu);
+		(*prob)(i) = exp((*log_f)(i) - log_offset);
 
-		R->getRow(i, 0, d, d, rr);
-		df_R->getRow(i, i*d*d, d, d, df_rr);
-
-		(*prob)(i) = N(&data, mu, rr, df_mu, df_rr);
+		if (log_domain)
+			scaleDerivs(i, (*prob)(i));
 
 		if (debug)
 			printf("%8.6g ", (*prob)(i));
 
-		N(&data, mu, rr, df_mu, df_rr);
-
-		if ((*prob)(i) > max_lik)
+		if ((*log_f)(i) > max_loglik)
 		{
-			max_lik = (*prob)(i);
+			max_loglik = (*log_f)(i);
 			best_class = i;
 		}
 	}
@@ -525,25 +633,432 @@ int Gaussian::Classify(real *y)
 	return best_class;
 }
 
+/** 
+ * Scale the derivatives of state i (df_MU and df_R rows) by s.
+ * 
+ * @param i state
+ * @param s scale factor
+ */
+
+void Gaussian::scaleDerivs(int i, real s)
+{
+	real *dm = df_MU->ptr[i];
+	real *dr = df_R->ptr[i];
+
+	for (int k = 0; k < d; k++)
+		dm[k] *= s;
+
+	for (int k = 0; k < d*d; k++)
+		dr[k] *= s;
+}
+
+/** 
+ * Classify() for the listed states only.  The other states get zero
+ * prob and zero derivatives, so they are left out of an RMLE update.
+ * In the log domain, prob is scaled by the largest density among the
+ * listed states.
+ * 
+ * @param y observation
+ * @param states states to evaluate
+ * @param n_states number of states in the list
+ * 
+ * @return best class among the listed states
+ */
+
+int Gaussian::ClassifyStates(real *y, int *states, int n_states)
+{
+	int i, k;
+
+	if (!cache_valid)
+		updateDensityCache();
+
+	y_vec->set(y, d);
+
+	prob->zero();
+	log_f->fill(-INF);
+	df_MU->zero();
+	df_R->zero();
+
+	real max_loglik = -INF;
+
+	for (k = 0; k < n_states; k++)
+	{
+		i = states[k];
+
+		MU->getRow(i, mu_vec);
+		df_MU->getRow(i, df_vec1);
+
+		R->getRow(i, 0, d, d, R_mat);
+		SigmaInv->getRow(i, 0, d, d, Sinv_mat);
+		df_R->getRow(i, 0, d, d, df_R_mat);
+
+		if (log_domain)
+			(*log_f)(i) = dlogN(y_vec, mu_vec, R_mat, Sinv_mat, (*log_norm)(i),
+					nws, df_vec1, df_R_mat);
+		else
+			(*log_f)(i) = logN(y_vec, mu_vec, R_mat, Sinv_mat, (*log_norm)(i),
+					nws, df_vec1, df_R_mat);
+
+		if ((*log_f)(i) > max_loglik)
+		{
+			max_loglik = (*log_f)(i);
+			best_class = i;
+		}
+	}
+
+	log_offset = (log_domain && n_states > 0) ? max_loglik : 0.0;
+
+	for (k = 0; k < n_states; k++)
+	{
+		i = states[k];
+
+		(*prob)(i) = exp((*log_f)(i) - log_offset);
+
+		if (log_domain)
+			scaleDerivs(i, (*prob)(i));
+	}
+
+	return best_class;
+}
+
+/** 
+ * Log densities of a block of observations for all states at once.
+ * 
+ * Since inv(Sigma) = inv(R)*inv(R)', the quadratic form for every
+ * frame is the squared norm of the rows of (Y - mu)*inv(R), which is
+ * a single matrix-matrix multiply per state.  Derivatives are not
+ * calculated, so this is for evaluation only (not RMLE updates).
+ * With the "single" option the products are done in float32.
+ * 
+ * @param Y observations, one per row (T by d)
+ * @param logF output, T by r: logF(t,i) = log(N(Y(t); mu(i), U(i)))
+ * 
+ * @return 0 on success, -1 if Y has the wrong dimension
+ */
+
+int Gaussian::LogLikBlock(IMat *Y, IMat *logF)
+{
+	int i, t, j;
+	int T = Y->m;
+
+	if (Y->n != d)
+		return -1;
+
+	if (!cache_valid)
+		updateDensityCache();
+
+	if (single)
+		return LogLikBlockSingle(Y, logF);
+
+	logF->reshape(T, r);
+	blk_Yc->reshape(T, d);
+	blk_Z->reshape(T, d);
+
+	for (i = 0; i < r; i++)
+	{
+		real *mu = MU->ptr[i];
+
+		for (t = 0; t < T; t++)
+		{
+			real *y = Y->ptr[t];
+			real *yc = blk_Yc->ptr[t];
+
+			for (j = 0; j < d; j++)
+				yc[j] = y[j] - mu[j];
+		}
+
+		Rinv->getRow(i, 0, d, d, Sinv_mat);
+
+		MatMatMult(blk_Yc, CblasNoTrans,
+				Sinv_mat, CblasNoTrans,
+				blk_Z);                     // Z = (Y - mu)*inv(R)
+
+		for (t = 0; t < T; t++)
+		{
+			real *z = blk_Z->ptr[t];
+			real q = 0.0;
+
+			for (j = 0; j < d; j++)
+				q += z[j]*z[j];
+
+			(*logF)(t,i) = (*log_norm)(i) - 0.5*q;
+		}
+	}
+
+	return 0;
+}
+
+/** 
+ * LogLikBlock() with float32 storage and arithmetic for the quadratic
+ * forms (single precision BLAS, twice the SIMD width of double).  The
+ * normalizers and the results stay in real precision, as do Classify()
+ * and the RMLE gradients.
+ * 
+ * @param Y observations, one per row (T by d)
+ * @param logF output, T by r
+ * 
+ * @return 0
+ */
+
+int Gaussian::LogLikBlockSingle(IMat *Y, IMat *logF)
+{
+	int i, t, j;
+	int T = Y->m;
+
+	logF->reshape(T, r);
+
+	if (T*d > blk_f_len)
+	{
+		blk_Yc_f = (float *)G_allocator->realloc(blk_Yc_f, sizeof(float)*T*d);
+		blk_Z_f = (float *)G_allocator->realloc(blk_Z_f, sizeof(float)*T*d);
+		blk_f_len = T*d;
+	}
+
+	for (i = 0; i < r; i++)
+	{
+		real *mu = MU->ptr[i];
+
+		for (j = 0; j < d; j++)
+			mu_f[j] = (float)mu[j];
+
+		for (t = 0; t < T; t++)
+		{
+			real *y = Y->ptr[t];
+			float *yc = blk_Yc_f + t*d;
+
+			for (j = 0; j < d; j++)
+				yc[j] = (float)y[j] - mu_f[j];
+		}
+
+		// Z = (Y - mu)*inv(R)
+
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, T, d, d,
+				1.0f, blk_Yc_f, d, Rinv_f + i*d*d, d, 0.0f, blk_Z_f, d);
+
+		for (t = 0; t < T; t++)
+		{
+			float *z = blk_Z_f + t*d;
+			float q = 0.0f;
+
+			for (j = 0; j < d; j++)
+				q += z[j]*z[j];
+
+			(*logF)(t,i) = (*log_norm)(i) - 0.5*q;
+		}
+	}
+
+	return 0;
+}
+
+/** 
+ * Sufficient statistics for batch EM: for each state, the occupancy,
+ * the weighted sum of the observations and the weighted sum of their
+ * outer products (only the upper triangle is used).
+ * 
+ * @return r*(1 + d + d*d)
+ */
+
+int Gaussian::EMStatsSize()
+{
+	return r*(1 + d + d*d);
+}
+
+/** 
+ * Accumulate EM statistics for one sequence.  Only reads the model,
+ * so it can run for several sequences at once.
+ * 
+ * @param Y observations, one per row (T by d)
+ * @param gamma state posteriors (T by r)
+ * @param stats accumulated statistics (EMStatsSize() long)
+ * 
+ * @return 0 on success, -1 on a size mismatch
+ */
+
+int Gaussian::EMAccumulate(IMat *Y, IMat *gamma, real *stats)
+{
+	int t, i, j, k;
+	int T = Y->m;
+	int stride = 1 + d + d*d;
+
+	if (Y->n != d || gamma->m != T || gamma->n != r)
+		return -1;
+
+	for (t = 0; t < T; t++)
+	{
+		real *y = Y->ptr[t];
+		real *g = gamma->ptr[t];
+
+		for (i = 0; i < r; i++)
+		{
+			real w = g[i];
+
+			if (w == 0.0)
+				continue;
+
+			real *n = stats + i*stride;
+			real *s1 = n + 1;
+			real *s2 = s1 + d;
+
+			n[0] += w;
+
+			for (j = 0; j < d; j++)
+			{
+				real wy = w*y[j];
+
+				s1[j] += wy;
+
+				for (k = j; k < d; k++)
+					s2[j*d+k] += wy*y[k];
+			}
+		}
+	}
+
+	return 0;
+}
+
+/** 
+ * EM update of MU and R from accumulated statistics.  If a covariance
+ * is not positive definite, a small ridge is added; if that fails too,
+ * the state keeps its old covariance.
+ * 
+ * @param stats statistics from EMAccumulate(), summed over all sequences
+ * @param min_count states with less occupancy (and the silence state)
+ *                  are not changed
+ * 
+ * @return 0
+ */
+
+int Gaussian::EMUpdate(real *stats, real min_count)
+{
+	int i, j, k;
+	int stride = 1 + d + d*d;
+
+	IMat U;
+	IMat cov(d, d);
+	IMat R_old(d, d);
+
+	for (i = 0; i < r; i++)
+	{
+		real n = stats[i*stride];
+		real *s1 = stats + i*stride + 1;
+		real *s2 = s1 + d;
+
+		if (i == silence_state || n < min_count || n <= 0.0)
+			continue;
+
+		real *mu = MU->ptr[i];
+
+		for (j = 0; j < d; j++)
+			mu[j] = s1[j]/n;
+
+		// cov = E[yy'] - mu*mu' (upper triangle)
+
+		real tr = 0.0;
+
+		for (j = 0; j < d; j++)
+		{
+			for (k = 0; k < j; k++)
+				cov.base[j*d+k] = 0.0;
+
+			for (k = j; k < d; k++)
+				cov.base[j*d+k] = s2[j*d+k]/n - mu[j]*mu[k];
+
+			tr += cov.base[j*d+j];
+		}
+
+		R->getRow(i, 0, d, d, &U);
+		MatCopy(&U, &R_old);
+
+		MatCopy(&cov, &U);
+
+		if (SymMatCholFact(&U) != 0)
+		{
+			real ridge = 1e-4*((tr > 0.0) ? tr/d : 1.0);
+
+			MatCopy(&cov, &U);
+
+			for (j = 0; j < d; j++)
+				U.base[j*d+j] += ridge;
+
+			if (SymMatCholFact(&U) != 0)
+			{
+				warning("EM: covariance of state %d is singular, not updated\n", i);
+				MatCopy(&R_old, &U);
+				continue;
+			}
+		}
+
+		// Set lower triangle to zero
+
+		for (j = 1; j < d; j++)
+			for (k = 0; k < j; k++)
+				U.base[j*d+k] = 0.0;
+	}
+
+	cache_valid = false;
+
+	return 0;
+}
+
+/** 
+ * C(:,block m) += Rs(:,m)*G(m,:) for every state m, i.e., C += R2 with
+ * R2 = Rs*blockdiag(G), without forming R2.
+ * 
+ * @param Rs r by r
+ * @param G r by n, one block per state
+ * @param C r by r*n
+ */
+
+static void addBlockOuter(IMat *Rs, IMat *G, IMat *C)
+{
+	int r = G->m;
+	int n = G->n;
+
+	for (int i = 0; i < r; i++)
+	{
+		real *c = C->ptr[i];
+
+		for (int m = 0; m < r; m++, c += n)
+		{
+			real a = (*Rs)(i,m);
+			real *g = G->ptr[m];
+
+			if (a == 0.0)
+				continue;
+
+			for (int k = 0; k < n; k++)
+				c[k] += a*g[k];
+		}
+	}
+}
+
 int Gaussian::Updatew()
 {
 	// Update w = du/d(phi(l))
 
 	// w(t+1) = R1*w(t) + R2;
 
+	// R2 (from the last UpdateR()) is applied block by block, and w_R
+	// only covers the upper triangle of each R, since the rest of R is
+	// fixed at zero.
+
 	IMat *tmp;
 
 	MatMatMult(R1, CblasNoTrans,
 			w_MU, CblasNoTrans,
 			w_MU_next);            // w(t+1) = R1*w(t)
-	MatAdd(R2_MU, w_MU_next);         // w(t+1) += R2
-	swap(w_MU, w_MU_next, tmp);       // w(t) <=> w(t+1)
-
 	MatMatMult(R1, CblasNoTrans,
 			w_R, CblasNoTrans,
-			w_R_next);           // w(t+1) = R1*w(t)
-	MatAdd(R2_R, w_R_next);         // w(t+1) += R2
-	swap(w_R, w_R_next, tmp);       // w(t) <=> w(t+1)
+			w_R_next);
+
+	if (r2_valid)
+	{
+		addBlockOuter(Rs, R2_MU, w_MU_next);   // w(t+1) += R2
+		addBlockOuter(Rs, R2_R, w_R_next);
+	}
+
+	swap(w_MU, w_MU_next, tmp);       // w(t) <=> w(t+1)
+	swap(w_R, w_R_next, tmp);
 
 	return 0;
 }
@@ -565,47 +1080,38 @@ int Gaussian::UpdateR(IMat *Rs_,
 	//   %       R2(:,m) = A' * (eye(r,r) - F*u*ones(1,r)*scale) ...
 	//   %                 * (dF(m)*u)*scale;
 	//   %
-	//   % We'd like to calculate this range of R2 as single
-	//   % matrix multiplication.  Here, the main obstacle here is the
-	//   % (dF(m)*u) = (df(m).*u), which becomes
+	//   % dF(m)*u = df(m).*u is zero except in the block of the state
+	//   % that parameter m belongs to, so
 	//   %
-	//   %               (df .* (repmat(u,1,sizeof(df))))
+	//   %       R2(:,block i) = Rs(:,i) * (scale*u(i)*df(i))'
 	//   %
-	//   % where repmat() replicates a matrix, and df is the derivative
-	//   % of column vector f with respect to each density parameter.
+	//   % Only g(i) = scale*u(i)*df(i) is stored here (upper triangle
+	//   % only for R); Updatew() applies Rs.  Rs is not changed by the
+	//   % HMM until after the next Updatew().
 	//   %
 	//   %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-	static IVec *df_sub = new IVec;
-	static IVec *df2_sub = new IVec;
-
-	int i;
+	int i, j, k, p;
 
 	for (i = 0; i < r; i++)
 	{
-		df_MU->getRow(i, i*d, d, df_sub);
-		df_MU_temp->getRow(i, i*d, d, df2_sub);
+		real su = scale * (*u)(i);
 
-		VecCopy(df_sub, df2_sub);
-		VecScale(scale * (*u)(i), df2_sub);
-	}
+		real *df = df_MU->ptr[i];
+		real *g = R2_MU->ptr[i];
 
-	MatMatMult(Rs, CblasNoTrans,
-			df_MU_temp, CblasNoTrans,
-			R2_MU);
+		for (j = 0; j < d; j++)
+			g[j] = su*df[j];
 
-	for (i = 0; i < r; i++)
-	{
-		df_R->getRow(i, i*d*d, d*d, df_sub);
-		df_R_temp->getRow(i, i*d*d, d*d, df2_sub);
+		df = df_R->ptr[i];
+		g = R2_R->ptr[i];
 
-		VecCopy(df_sub, df2_sub);
-		VecScale(scale * (*u)(i), df2_sub);
+		for (j = 0, p = 0; j < d; j++)
+			for (k = j; k < d; k++, p++)
+				g[p] = su*df[j*d+k];
 	}
 
-	MatMatMult(Rs, CblasNoTrans,
-			df_R_temp, CblasNoTrans,
-			R2_R);
+	r2_valid = true;
 
 	return 0;
 }
@@ -617,15 +1123,16 @@ int Gaussian::UpdateGradient()
 
 	// Update the score vector
 
-	// Get a vector view of the S matrices
+	// S_new = scale * (w'f + df'u)
+	//
+	// df is block diagonal, so df'u is just u(i)*df(i) for state i.
+	// The R part is calculated on the packed upper triangle and then
+	// expanded into S_R_new, leaving the lower triangle zero.
 
-	static IVec *S_MU_vec = new(allocator) IVec;  // TODO: change to static!
-	static IVec *S_R_vec = new(allocator) IVec;
+	IVec *S_MU_vec = df_vec1;
+	IVec *S_R_vec = df_vec2;
 
 	S_MU_new->getAll(S_MU_vec);
-	S_R_new->getAll(S_R_vec);
-
-	// S_new = scale * (w'f + df'u)
 
 	GenMatVecMult(scale,
 			w_MU, CblasTrans,
@@ -634,29 +1141,31 @@ int Gaussian::UpdateGradient()
 	GenMatVecMult(scale,
 			w_R, CblasTrans,
 			prob,
-			0.0, S_R_vec);
+			0.0, S_R_tri);
 
-	GenMatVecMult(scale,
-			df_MU, CblasTrans,
-			u,
-			1.0, S_MU_vec);
-	GenMatVecMult(scale,
-			df_R, CblasTrans,
-			u,
-			1.0, S_R_vec);
+	int i, j, k, p;
 
-	// Set lower triangle of S_R to zero
+	for (i = 0; i < r; i++)
+	{
+		real su = scale * (*u)(i);
 
-	static IMat *S_R_mat = new(allocator) IMat;
+		real *s = S_MU_new->ptr[i];
+		real *df = df_MU->ptr[i];
 
-	for (int i = 0; i < r; i++)
-	{
-		S_R_new->getRow(i, 0, d, d, S_R_mat);
+		for (j = 0; j < d; j++)
+			s[j] += su*df[j];
+
+		s = S_R_new->ptr[i];
+		df = df_R->ptr[i];
+		real *st = S_R_tri->ptr + i*n_tri;
 
-		for (int j = -1; j >= -d; j--)
+		for (j = 0, p = 0; j < d; j++)
 		{
-			S_R_mat->getDiag(j, S_R_vec);
-			S_R_vec->zero();
+			for (k = 0; k < j; k++)
+				s[j*d+k] = 0.0;
+
+			for (k = j; k < d; k++, p++)
+				s[j*d+k] = st[p] + su*df[j*d+k];
 		}
 	}
 
@@ -679,11 +1188,10 @@ int Gaussian::UpdateGradient()
 		//
 		//   = ((n-1)/n)*S + (1/n)*S_new
 
-		MatScale((n-1.0)/n, S_MU);
-		MatAddScaled(1.0/n, S_MU_new, S_MU);
+		IView s_mu(S_MU), s_R(S_R);
 
-		MatScale((n-1.0)/n, S_R);
-		MatAddScaled(1.0/n, S_R_new, S_R);
+		s_mu = ((n-1.0)/n)*s_mu + (1.0/n)*IView(S_MU_new);
+		s_R = ((n-1.0)/n)*s_R + (1.0/n)*IView(S_R_new);
 
 	}
 	else
@@ -714,23 +1222,14 @@ int Gaussian::UpdateParms()
 	if (avg_iters && n > 1)
 	{
 		// mu_temp = mu + epsilon*n*S_MU
-		// R_temp = R + epsilon*n*S_R
-
-		MatCopy(MU, MU_temp);
-		MatCopy(R, R_temp);
-
-		MatAddScaled(epsilon*n, S_MU, MU_temp);
-		MatAddScaled(epsilon*n, S_R, R_temp);
-
 		// mu = mu + (1/n)*(mu_temp - mu)
+		//
+		// (and the same for R), in one pass
 
-		MatScale((n-1.0)/n, MU);
-		MatAddScaled(1.0/n, MU_temp, MU);
-
-		// R = R + (1/n)*(R_temp - R)
+		IView mu(MU), Rv(R);
 
-		MatScale((n-1.0)/n, R);
-		MatAddScaled(1.0/n, R_temp, R);
+		mu = ((n-1.0)/n)*mu + (1.0/n)*(mu + (epsilon*n)*IView(S_MU));
+		Rv = ((n-1.0)/n)*Rv + (1.0/n)*(Rv + (epsilon*n)*IView(S_R));
 	}
 	else
 	{
@@ -738,6 +1237,9 @@ int Gaussian::UpdateParms()
 		MatAddScaled(epsilon, S_R, R);
 	}
 
+	if (epsilon != 0.0)
+		cache_valid = false;
+
 	return 0;
 }
 
@@ -747,53 +1249,236 @@ int Gaussian::RMLEUpdate()
 	return (UpdateParms());
 }
 
-int Gaussian::KMeansInit(IMat *x,
-		bool rand_init,
-		int max_iter)
+////////////////////
+// k-means helpers
+//////////////////////
+
+// Below this many points*dimensions, k-means steps are not worth threading
+
+#define KMEANS_PAR_MIN 8192
+
+/**
+ * Squared distance between two d-vectors.  Four partial sums, so the
+ * loop can be vectorized.
+ */
+
+static inline real sqDist(const real *a, const real *b, int d)
 {
-	int i,j;
+	real s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+	int j = 0;
 
-	int n;     // number of data points
+	for (; j+3 < d; j += 4)
+	{
+		real t0 = a[j]   - b[j];
+		real t1 = a[j+1] - b[j+1];
+		real t2 = a[j+2] - b[j+2];
+		real t3 = a[j+3] - b[j+3];
+
+		s0 += t0*t0;
+		s1 += t1*t1;
+		s2 += t2*t2;
+		s3 += t3*t3;
+	}
 
-	IMat y;
+	for (; j < d; j++)
+	{
+		real t = a[j] - b[j];
+		s0 += t*t;
+	}
 
-	IMat MU_old;         // previous mean vecs
-	IMat dist;           // sum((x-mu)^2)
+	return (s0 + s1) + (s2 + s3);
+}
 
-	IVec    minvals;     // min values
-	IVecInt minlocs;     // corresponding min value locations
+/**
+ * Nearest and second nearest center to x (squared distances).
+ */
 
-	IVecInt counts;      // number of points in each class
-	IVecInt order;       // sorted order of counts
-	IVecInt I;           // indices of rows of x
+static inline int nearest2(const real *x, IMat *C, real *d1, real *d2)
+{
+	int best = 0;
 
-	bool finished = false;
+	*d1 = INF;
+	*d2 = INF;
 
-	y = *x;
+	for (int j = 0; j < C->m; j++)
+	{
+		real dj = sqDist(x, C->ptr[j], C->n);
 
+		if (dj < *d1)
+		{
+			*d2 = *d1;
+			*d1 = dj;
+			best = j;
+		}
+		else if (dj < *d2)
+			*d2 = dj;
+	}
 
-	////////////////////
-	// Idiot checking
-	//////////////////////
+	return best;
+}
 
-	if (d != y.n)
-		error ("KMeansInit: data has wrong dimension (dim(y) == %d, should be %d)\n",
-				y.n, d);
+/**
+ * k-means++ seeding: the first center is a random point, each next
+ * one is a point picked with probability proportional to its squared
+ * distance from the nearest center so far.
+ *
+ * @param x data, one point per row
+ * @param C centers (output)
+ */
 
-	////////////////////
-	// Initialization
-	//////////////////////
+static void kmeansPPSeed(IMat *x, IMat *C)
+{
+	int n = x->m;
+	int d = x->n;
+	IVec dmin(n);
+	real *dm = dmin.ptr;
+
+	int i = Random::random() % n;
+	memcpy(C->ptr[0], x->ptr[i], d*sizeof(real));
+
+#pragma omp parallel for schedule(static) if (n*d >= KMEANS_PAR_MIN)
+	for (int k = 0; k < n; k++)
+		dm[k] = sqDist(x->ptr[k], C->ptr[0], d);
+
+	for (int j = 1; j < C->m; j++)
+	{
+		real total = 0.0;
+
+		for (i = 0; i < n; i++)
+			total += dm[i];
+
+		if (total > 0.0)
+		{
+			real target = Random::uniform() * total;
+			int last = 0;   // last point that isn't a center yet
+
+			for (i = 0; i < n; i++)
+			{
+				if (dm[i] > 0.0)
+				{
+					last = i;
+					target -= dm[i];
+					if (target < 0.0)
+						break;
+				}
+			}
+
+			// rounding can leave target >= 0 at the end
+			if (i == n)
+				i = last;
+		}
+		else   // all points are centers already
+			i = Random::random() % n;
+
+		memcpy(C->ptr[j], x->ptr[i], d*sizeof(real));
+
+#pragma omp parallel for schedule(static) if (n*d >= KMEANS_PAR_MIN)
+		for (int k = 0; k < n; k++)
+		{
+			real dk = sqDist(x->ptr[k], C->ptr[j], d);
+
+			if (dk < dm[k])
+				dm[k] = dk;
+		}
+	}
+}
+
+/**
+ * Mini-batch k-means (Sculley, 2010): each iteration assigns a random
+ * batch of points, then moves each center towards its points with a
+ * per-center learning rate of 1/(points seen so far).
+ *
+ * @param x data, one point per row
+ * @param C centers (input and output)
+ * @param batch batch size
+ * @param iters number of batches
+ */
+
+static void kmeansMiniBatch(IMat *x, IMat *C, int batch, int iters)
+{
+	int n = x->m;
+	int d = x->n;
+	IVec seen(C->m);
+	IVecInt idx(batch);
+	IVecInt closest(batch);
+
+	seen.zero();
+
+	for (int it = 0; it < iters; it++)
+	{
+		int k;
+
+		for (k = 0; k < batch; k++)
+			idx.ptr[k] = Random::random() % n;
+
+#pragma omp parallel for schedule(static) if (batch*d >= KMEANS_PAR_MIN)
+		for (k = 0; k < batch; k++)
+		{
+			real d1, d2;
+			closest.ptr[k] = nearest2(x->ptr[idx.ptr[k]], C, &d1, &d2);
+		}
+
+		for (k = 0; k < batch; k++)
+		{
+			int c = closest.ptr[k];
+			real *cp = C->ptr[c];
+			real *xp = x->ptr[idx.ptr[k]];
+
+			seen.ptr[c] += 1.0;
 
-	n = y.m;
+			real eta = 1.0/seen.ptr[c];
 
-	MU_old.reshape(r,d);
+			for (int j = 0; j < d; j++)
+				cp[j] += eta*(xp[j] - cp[j]);
+		}
+	}
+}
 
-	counts.resize(r);
+/**
+ * Initialize the means and covariances with k-means.
+ *
+ * If rand_init is set, the means are seeded from the data with
+ * k-means++ (or with uniformly random points if the "kmeans++" option
+ * is off); otherwise the current MU is used as the starting point.
+ *
+ * The Lloyd iterations use Hamerly's bounds (triangle inequality) to
+ * skip most distance computations once the centers settle, and the
+ * assignment step runs in parallel.  The result is the same as plain
+ * Lloyd iterations.  If the "kmeans batch" option is set and the data
+ * has more points than that, mini-batch updates are used instead,
+ * followed by a single full assignment.
+ *
+ * An empty cluster is moved to the point farthest from its center.
+ * Iterations stop when no point changes cluster, or after max_iter.
+ *
+ * @param x data, one observation per row
+ * @param rand_init if true, seed the means from the data
+ * @param max_iter maximum number of iterations (or mini-batches)
+ *
+ * @return 0 on success, -1 if there is no data
+ */
+
+int Gaussian::KMeansInit(IMat *x,
+		bool rand_init,
+		int max_iter)
+{
+	int i, j;
+	int n = x->m;     // number of data points
 
 	////////////////////
-	// Pick means
+	// Idiot checking
 	//////////////////////
 
+	if (d != x->n)
+		error ("KMeansInit: data has wrong dimension (dim(y) == %d, should be %d)\n",
+				x->n, d);
+
+	if (n == 0)
+	{
+		warning("KMeansInit: no data!\n");
+		return -1;
+	}
+
 	if (r == 1)
 	{
 		IVec mean;
@@ -802,163 +1487,213 @@ int Gaussian::KMeansInit(IMat *x,
 		MU->getRow(0,&mean);               // mean = alias for mu
 		R->getRow(0, 0, d, d, &cov);   // cov  = alias for U
 
-		y.mean(&mean);       //  mean
-		y.cov(&mean, &cov);  //  cov
+		x->mean(&mean);       //  mean
+		x->cov(&mean, &cov);  //  cov
 
 		SymMatCholFact(&cov);
 
+		cache_valid = false;
+
 		return 0;
 	}
 
+	////////////////////
+	// Pick means
+	//////////////////////
+
 	if (rand_init)
 	{
-		IVec row;
-
-		for (i = 0; i < r; i++)
+		if (kmeans_pp)
+			kmeansPPSeed(x, MU);
+		else
 		{
-			j = Random::random() % n;
+			IVec row;
 
-			y.getRow(j,&row);      // alias row j of x
-			MU->setRow(i, &row);   // copy to row i of mu
+			for (i = 0; i < r; i++)
+			{
+				j = Random::random() % n;
+
+				x->getRow(j,&row);     // alias row j of x
+				MU->setRow(i, &row);   // copy to row i of mu
+			}
 		}
 	}
 
 	// else use MU as is
 
+	if (kmeans_batch > 0 && kmeans_batch < n)
+	{
+		kmeansMiniBatch(x, MU, kmeans_batch, max_iter);
+		max_iter = 0;
+	}
+
 	////////////////////
-	// Calculate x.^2
+	// Lloyd iterations, with Hamerly's bounds
 	//////////////////////
 
-	IMat xdotx;
-	IMat x2;             // sum(x.^2) * ones (1,r)
+	IVecInt assign(n);   // cluster of each point
+	IVec upper(n);       // upper bound on the distance to its center
+	IVec lower(n);       // lower bound on the distance to any other center
 
-	IMat mdotm;
-	IMat m2;             // ones(n,1) * sum(mu.^2)
+	IVecInt counts(r);   // number of points in each cluster
+	IMat sums(r, d);
+	IVec moved(r);       // how far each center moved
+	IVec half(r);        // half the distance to the closest other center
 
-	xdotx = y;
-	MatDotTimes(1.0, &xdotx, &xdotx);
+	int *a = assign.ptr;
+	real *u = upper.ptr;
+	real *l = lower.ptr;
 
-	IVec x_sum;
-	xdotx.sum(&x_sum, 2);         // x_sum = sum(x.^2) along each row
+#pragma omp parallel for schedule(static) if (n*d >= KMEANS_PAR_MIN)
+	for (i = 0; i < n; i++)
+	{
+		real d1, d2;
 
-	x2.reshape(n, r);             // x2 is an n by r array
-	x2.vecFillCols(&x_sum);
+		a[i] = nearest2(x->ptr[i], MU, &d1, &d2);
+		u[i] = sqrt(d1);
+		l[i] = sqrt(d2);
+	}
 
-	m2.reshape(n, r);
+	int changed = 1;
 
-	////////////////////
-	// Main loop
-	//////////////////////
-
-	for (i = 0; i < max_iter; i++)
+	for (int it = 0; ; it++)
 	{
 		////////////////////
-		// Save old means
+		// Update the means (in point order, so the result does
+		// not depend on the number of threads)
 		//////////////////////
 
-		MatCopy(MU, &MU_old);              // MU_old = MU_
-
-		////////////////////
-		// Calculate distances
-		//////////////////////
-
-		mdotm = *MU;
-		MatDotTimes(1.0, &mdotm, &mdotm);  // mdotm = mu.^2
-
-		IVec MU_sum;
-		mdotm.sum(&MU_sum, 2);             // MU_sum = sum(mu2,2)
-		m2.vecFillRows(&MU_sum);
+		counts.zero();
+		sums.zero();
 
-		dist = x2;
-		//      MatCopy(&x2, &dist);
-		MatAdd(&m2, &dist);
+		for (i = 0; i < n; i++)
+			counts.ptr[a[i]]++;
 
-		GenMatMatMult(-2.0,
-				&y, CblasNoTrans,
-				MU, CblasTrans,
-				1.0,
-				&dist);              // dist = x^2 + m2 - 2x*m
+		for (j = 0; j < r; j++)
+		{
+			if (counts.ptr[j] > 0)
+				continue;
 
+			// this class has no members! use the point farthest
+			// from its center (from a class with others left)
 
-				////////////////////
-				// Assign each point to a center
-		//////////////////////
+			int worst = -1;
 
-		dist.mmin(&minvals, &minlocs, 1);  // find the min of each row
+			for (i = 0; i < n; i++)
+				if (counts.ptr[a[i]] > 1 && (worst < 0 || u[i] > u[worst]))
+					worst = i;
 
-		////////////////////
-		// Count numbers in each bin
-		//////////////////////
+			if (worst < 0)
+				break;   // fewer points than classes
 
-		counts.zero();
+			counts.ptr[a[worst]]--;
+			counts.ptr[j]++;
+			a[worst] = j;
+			u[worst] = 0.0;
+			l[worst] = 0.0;
+		}
 
-		for (j = 0; j < n; j++)
-			counts[minlocs[j]]++;
+		for (i = 0; i < n; i++)
+		{
+			real *s = sums.ptr[a[i]];
+			real *xi = x->ptr[i];
 
-		// *****
+			for (j = 0; j < d; j++)
+				s[j] += xi[j];
+		}
 
-		//printf("Counts/class:\n");
-		//counts.print();
+		int jmax = 0;        // center that moved the most
+		real move1 = 0.0;    // how far it moved
+		real move2 = 0.0;    // second most
 
-		int cls;
-		counts.sort(&order);           // order is the sorted order of
-		// the class counts (indices only)
 		for (j = 0; j < r; j++)
 		{
-			cls = order[j];
-			minlocs.find(cls, &I);
-
-			if (I.n == 0)
+			if (counts.ptr[j] == 0)
 			{
-				int index;               // this class has no members!
-				IVec row;
+				moved.ptr[j] = 0.0;
+				continue;
+			}
 
-				minvals.vmax(&index);    // use an outlier to start a new
-				y.getRow(index, &row);  // class....
-				MU->setRow(cls, &row);
+			real *s = sums.ptr[j];
+			real c = 1.0/counts.ptr[j];
 
-				minlocs[index] = cls;
-				minvals[index] = 0.0;
-			}
-			else
-			{
-				IVec mean;
+			for (int k = 0; k < d; k++)
+				s[k] *= c;
 
-				MU->getRow(cls, &mean);    // mean is an alias into MU_
-				y.mean(&mean, 1, &I);     // mu(cls) = avg of x's in
-				// that class
-			}
+			moved.ptr[j] = sqrt(sqDist(s, MU->ptr[j], d));
+			memcpy(MU->ptr[j], s, d*sizeof(real));
 
+			if (moved.ptr[j] > move1)
+			{
+				move2 = move1;
+				move1 = moved.ptr[j];
+				jmax = j;
+			}
+			else if (moved.ptr[j] > move2)
+				move2 = moved.ptr[j];
 		}
 
+		if (!changed || it >= max_iter)
+			break;
+
 		////////////////////
-		// Are we done yet?
+		// Reassign
 		//////////////////////
 
-		//hackish (fix)
-		//finished = true;
-		/*
-		for (int idx = 0; idx < counts.n; idx++) {
-			if (counts[idx] == 1) {
-				finished = false;
-			}
+		for (j = 0; j < r; j++)
+		{
+			real dmin = INF;
+
+			for (int k = 0; k < r; k++)
+				if (k != j)
+					dmin = min(dmin, sqDist(MU->ptr[j], MU->ptr[k], d));
+
+			half.ptr[j] = 0.5*sqrt(dmin);
 		}
-		if (finished)
-			break;
-			*/
 
-		MatSub(MU, &MU_old);
-		MU_old.abs();
-		if (MU_old.mmin() < REAL_EPSILON)
-			break;
+		changed = 0;
+
+#pragma omp parallel for schedule(static) reduction(+:changed) if (n*d >= KMEANS_PAR_MIN)
+		for (i = 0; i < n; i++)
+		{
+			u[i] += moved.ptr[a[i]];
+			l[i] -= (a[i] == jmax) ? move2 : move1;
+
+			real bound = max(half.ptr[a[i]], l[i]);
+
+			if (u[i] <= bound)
+				continue;
+
+			u[i] = sqrt(sqDist(x->ptr[i], MU->ptr[a[i]], d));
+
+			if (u[i] <= bound)
+				continue;
+
+			real d1, d2;
+			int best = nearest2(x->ptr[i], MU, &d1, &d2);
+
+			if (best != a[i])
+			{
+				a[i] = best;
+				changed++;
+			}
+
+			u[i] = sqrt(d1);
+			l[i] = sqrt(d2);
+		}
 	}
 
+	////////////////////
+	// Covariances
+	//////////////////////
+
 	IVec mean;
 	IMat U;
+	IVecInt I;           // indices of rows of x
 
 	for (i = 0; i < r; i++)
 	{
-		minlocs.find(i, &I);
+		assign.find(i, &I);
 		MU->getRow(i,&mean);               // mean = alias for mu
 		R->getRow(i, 0, d, d, &U);       // U  = alias for R
 
@@ -970,11 +1705,13 @@ int Gaussian::KMeansInit(IMat *x,
 		}
 		else
 		{
-			y.cov(&mean, &U, 1, &I);       // calc covariance of class i
+			x->cov(&mean, &U, 1, &I);       // calc covariance of class i
 			SymMatCholFact(&U);
 		}
 	}
 
+	cache_valid = false;
+
 	return 0;
 }
 
@@ -1028,9 +1765,11 @@ void Gaussian::print_R(int scrn_width,
 		int col_width,
 		char *num_format)
 {
-	printf("R2_MU:\n");
+	// R2 = Rs*blockdiag(R2_MU), Rs*blockdiag(R2_R)
+
+	printf("R2_MU (blocks):\n");
 	R2_MU->print(scrn_width, col_width, num_format);
-	printf("R2_R:\n");
+	printf("R2_R (blocks):\n");
 	R2_R->print(scrn_width, col_width, num_format);
 }
 
@@ -1190,6 +1929,8 @@ int Gaussian::covReg(IVec lambda_, IVec xi_) {
 	gsl_vector_free(eigs);
 	gsl_eigen_symmv_free(uwk);
 
+	cache_valid = false;
+
 	return 0;
 
 }
@@ -76,6 +76,7 @@ static char *Gaussian_HH_Id = "$Id: Gaussian.hh,v 1.1 2005/05/09 20:52:57 mrmccl
 #include <torch/general.h>
 
 #include "StochasticClassifier.hh"
+#include "N.hh"
 #include <gsl/gsl_eigen.h>
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_vector.h>
@@ -128,6 +129,20 @@ public:
 
    IVec                  *u;
 
+   // RMLE sensitivities.  The derivatives of f are block diagonal (f(i)
+   // only depends on the parameters of state i), and only the upper
+   // triangle of each R is a free parameter, so only those parts are
+   // stored:
+   //
+   //   w_MU    r x r*d       du/dMU
+   //   w_R     r x r*n_tri   du/dR, upper triangle of each R (row major)
+   //   df_MU   r x d         row i: df(i)/dMU(i)
+   //   df_R    r x d*d       row i: df(i)/dR(i)
+   //   R2_MU   r x d         R2 = Rs*blockdiag(R2_MU), see UpdateR()
+   //   R2_R    r x n_tri
+
+   int                n_tri;   // d*(d+1)/2
+
    IMat               *w_MU;
    IMat          *w_MU_next;
    IMat                *w_R;
@@ -145,13 +160,54 @@ public:
 
    int        silence_state;
 
+   IVec              *log_f;   // log densities from the last Classify()
+
+   bool              single;   // float32 LogLikBlock()
+
+   bool           kmeans_pp;   // k-means++ seeding in KMeansInit()
+   int         kmeans_batch;   // mini-batch size for KMeansInit() (0: full)
+
 private:
    Allocator   *G_allocator;
    
-   IMat            *MU_temp;
-   IMat             *R_temp;
-   IMat         *df_MU_temp;
-   IMat          *df_R_temp;
+   IVec           *S_R_tri;   // scale*w_R'*f, packed like w_R
+   bool           r2_valid;   // R2_MU/R2_R set by UpdateR() since reset
+
+   // density cache: inv(R'R) and log normalizer for each state,
+   // refreshed lazily after R changes
+
+   IMat           *SigmaInv;
+   IMat               *Rinv;   // inv(R), for block evaluation
+   IVec           *log_norm;
+   bool         cache_valid;
+
+   NWorkspace          *nws;
+
+   // per-instance aliases (no statics, so instances are reentrant)
+
+   IVec              *y_vec;
+   IVec             *mu_vec;
+   IMat              *R_mat;
+   IMat           *Sinv_mat;
+   IVec            *df_vec1;
+   IVec            *df_vec2;
+   IMat           *df_R_mat;
+   IMat            *S_R_mat;
+
+   IMat             *blk_Yc;   // block workspace: Y - mu
+   IMat              *blk_Z;   // block workspace: (Y - mu)*inv(R)
+
+   // float32 copies for LogLikBlockSingle()
+
+   float            *Rinv_f;   // inv(R), refreshed with the density cache
+   float              *mu_f;
+   float          *blk_Yc_f;
+   float           *blk_Z_f;
+   int            blk_f_len;
+
+   int LogLikBlockSingle(IMat *Y, IMat *logF);
+
+   void scaleDerivs(int i, real s);
 
 public:
 
@@ -200,8 +256,23 @@ public:
 
    virtual void reset();
 
+   void invalidateDensityCache();  ///< call after changing R directly
+   void updateDensityCache();
+
    virtual int Classify(real *y);
 
+   virtual int ClassifyStates(real *y, int *states, int n_states);
+
+   virtual int LogLikBlock(IMat *Y, IMat *logF);
+
+   real LogLikBound();             ///< max over y, i of log f_i(y)
+
+   virtual int EMStatsSize();
+
+   virtual int EMAccumulate(IMat *Y, IMat *gamma, real *stats);
+
+   virtual int EMUpdate(real *stats, real min_count = 1.0);
+
    virtual int Updatew();
 
    virtual int UpdateR(IMat *Rs_,
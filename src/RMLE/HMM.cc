@@ -82,6 +82,7 @@
 #include "../imatlib/IMat.hh"
 #include "../imatlib/IVec.hh"
 #include "../imatlib/IMatVecOps.hh"
+#include "../imatlib/IExpr.hh"
 
 #include "HMM.hh"
 #include "StochasticClassifier.hh"
@@ -99,17 +100,40 @@ HMM::HMM():
       w(NULL),
       w_next(NULL),
       scale(1.0),
+      log_scale(0.0),
       delta(NULL),
       psi(NULL),
+      vit_path(NULL),
       viterbi_hist(0),
       vit_count(0),
       vit_pos(0),
       state(-1),
+      smooth_lag(0),
+      smooth_prob(NULL),
+      smooth_state(-1),
+      beam(0.0),
+      beam_floor(0.0),
+      beam_n_active(0),
       prob_mat(NULL),
       eye(NULL),
       tmp_rr(NULL),
       A_temp(NULL),
-      tmp_r(NULL)
+      tmp_r(NULL),
+      row_vec(NULL),
+      R2_diag(NULL),
+      S_A_vec(NULL),
+      smooth_alpha(NULL),
+      smooth_f(NULL),
+      smooth_beta(NULL),
+      smooth_tmp(NULL),
+      smooth_pos(0),
+      smooth_count(0),
+      beam_start(NULL),
+      beam_col(NULL),
+      beam_next(NULL),
+      beam_mark(NULL),
+      beam_n_next(0),
+      beam_valid(false)
 {
    HMM_allocator = new Allocator;
 }
@@ -129,17 +153,40 @@ HMM::HMM(StochasticClassifier *b_,
       w(NULL),
       w_next(NULL),
       scale(1.0),
+      log_scale(0.0),
       delta(NULL),
       psi(NULL),
+      vit_path(NULL),
       viterbi_hist(0),
       vit_count(0),
       vit_pos(0),
       state(-1),
+      smooth_lag(0),
+      smooth_prob(NULL),
+      smooth_state(-1),
+      beam(0.0),
+      beam_floor(0.0),
+      beam_n_active(0),
       prob_mat(NULL),
       eye(NULL),
       tmp_rr(NULL),
       A_temp(NULL),
-      tmp_r(NULL)
+      tmp_r(NULL),
+      row_vec(NULL),
+      R2_diag(NULL),
+      S_A_vec(NULL),
+      smooth_alpha(NULL),
+      smooth_f(NULL),
+      smooth_beta(NULL),
+      smooth_tmp(NULL),
+      smooth_pos(0),
+      smooth_count(0),
+      beam_start(NULL),
+      beam_col(NULL),
+      beam_next(NULL),
+      beam_mark(NULL),
+      beam_n_next(0),
+      beam_valid(false)
 {
    HMM_allocator = new Allocator;
 
@@ -163,17 +210,40 @@ HMM::HMM(StochasticClassifier *b_,
       w(NULL),
       w_next(NULL),
       scale(1.0),
+      log_scale(0.0),
       delta(NULL),
       psi(NULL),
+      vit_path(NULL),
       viterbi_hist(0),
       vit_count(0),
       vit_pos(0),
       state(-1),
+      smooth_lag(0),
+      smooth_prob(NULL),
+      smooth_state(-1),
+      beam(0.0),
+      beam_floor(0.0),
+      beam_n_active(0),
       prob_mat(NULL),
       eye(NULL),
       tmp_rr(NULL),
       A_temp(NULL),
-      tmp_r(NULL)
+      tmp_r(NULL),
+      row_vec(NULL),
+      R2_diag(NULL),
+      S_A_vec(NULL),
+      smooth_alpha(NULL),
+      smooth_f(NULL),
+      smooth_beta(NULL),
+      smooth_tmp(NULL),
+      smooth_pos(0),
+      smooth_count(0),
+      beam_start(NULL),
+      beam_col(NULL),
+      beam_next(NULL),
+      beam_mark(NULL),
+      beam_n_next(0),
+      beam_valid(false)
 {
    HMM_allocator = new Allocator;
 
@@ -196,17 +266,40 @@ HMM::HMM(StochasticClassifier *b_,
       w(NULL),
       w_next(NULL),
       scale(1.0),
+      log_scale(0.0),
       delta(NULL),
       psi(NULL),
+      vit_path(NULL),
       viterbi_hist(0),
       vit_count(0),
       vit_pos(0),
       state(-1),
+      smooth_lag(0),
+      smooth_prob(NULL),
+      smooth_state(-1),
+      beam(0.0),
+      beam_floor(0.0),
+      beam_n_active(0),
       prob_mat(NULL),
       eye(NULL),
       tmp_rr(NULL),
       A_temp(NULL),
-      tmp_r(NULL)
+      tmp_r(NULL),
+      row_vec(NULL),
+      R2_diag(NULL),
+      S_A_vec(NULL),
+      smooth_alpha(NULL),
+      smooth_f(NULL),
+      smooth_beta(NULL),
+      smooth_tmp(NULL),
+      smooth_pos(0),
+      smooth_count(0),
+      beam_start(NULL),
+      beam_col(NULL),
+      beam_next(NULL),
+      beam_mark(NULL),
+      beam_n_next(0),
+      beam_valid(false)
 {
    HMM_allocator = new Allocator;
 
@@ -264,6 +357,9 @@ int HMM::setViterbiHist(int viterbi_hist_)
       }
    }
 
+   vit_path->resize(viterbi_hist_ > 0 ? viterbi_hist_ : 1);
+   vit_path->fill(-1);
+
    viterbi_hist = viterbi_hist_;
    vit_count = 0;
    vit_pos = 0;
@@ -273,6 +369,268 @@ int HMM::setViterbiHist(int viterbi_hist_)
    return 0;
 }
 
+/** 
+ * Set the lag of the fixed-lag smoother.  With a lag L > 0, each
+ * Classify() also updates smooth_prob = P(X(t-L)|Y(1)...Y(t)) and
+ * smooth_state (see SmoothStep()).  Restarts the smoother.
+ * 
+ * @param smooth_lag_ lag in frames, 0 to turn the smoother off
+ * 
+ * @return 0 on success, -1 if the lag is negative
+ */
+
+int HMM::setSmoothLag(int smooth_lag_)
+{
+   if (smooth_lag_ < 0)
+      return -1;
+
+   smooth_lag = smooth_lag_;
+   smooth_pos = 0;
+   smooth_count = 0;
+   smooth_state = -1;
+
+   if (smooth_lag == 0 || r == 0)
+      return 0;
+
+   if (!smooth_alpha)
+   {
+      smooth_alpha = new(HMM_allocator) IMat;
+      smooth_f = new(HMM_allocator) IMat;
+      smooth_beta = new(HMM_allocator) IVec;
+      smooth_tmp = new(HMM_allocator) IVec;
+      smooth_prob = new(HMM_allocator) IVec;
+   }
+
+   smooth_alpha->reshape(smooth_lag+1, r);
+   smooth_f->reshape(smooth_lag+1, r);
+   smooth_beta->resize(r);
+   smooth_tmp->resize(r);
+   smooth_prob->resize(r);
+   smooth_prob->fill(1.0/r);
+
+   return 0;
+}
+
+/** 
+ * Turn beam search on or off.
+ *
+ * In beam mode, Classify() keeps only the states whose filtered prob
+ * is within a factor beam of the largest one (the rest are set to
+ * zero, and prob renormalized).  The next step then only propagates
+ * the active states, through a sparse copy of A, and only evaluates
+ * the emission densities of their successors (see
+ * StochasticClassifier::ClassifyStates()).  With a left-to-right or
+ * otherwise sparse A and a tight beam, a step costs about
+ * active states * successors instead of r^2.
+ *
+ * Transitions with probability <= beam_floor are treated as zero.
+ * Since ProbProject() keeps every transition at or above the prior,
+ * setting beam_floor to the prior recovers the structure of a
+ * left-to-right model.  RMLE updates change A, so the sparse copy is
+ * rebuilt after each one; the beam pays off mostly when classifying
+ * with fixed parameters.
+ * 
+ * @param beam_ relative threshold, in (0,1); 0 turns the beam off
+ * @param beam_floor_ transitions at or below this are skipped
+ * 
+ * @return 0 on success, -1 if beam_ is out of range
+ */
+
+int HMM::setBeam(real beam_, real beam_floor_)
+{
+   if (beam_ < 0.0 || beam_ >= 1.0)
+      return -1;
+
+   beam = beam_;
+   beam_floor = beam_floor_;
+   beam_valid = false;
+
+   return 0;
+}
+
+void HMM::invalidateBeam()
+{
+   beam_valid = false;
+}
+
+/** 
+ * Build the sparse copy of A used in beam mode: the column indices of
+ * the entries of each row above beam_floor.  The values are read from
+ * A itself.
+ */
+
+void HMM::BeamBuild()
+{
+   int i, j, nnz = 0;
+
+   for (i = 0; i < r; i++)
+      for (j = 0; j < r; j++)
+         if ((*A)(i,j) > beam_floor)
+            nnz++;
+
+   beam_col->resize(nnz > 0 ? nnz : 1);
+
+   int *start = beam_start->ptr;
+   int *col = beam_col->ptr;
+
+   nnz = 0;
+
+   for (i = 0; i < r; i++)
+   {
+      real *a = A->ptr[i];
+
+      start[i] = nnz;
+
+      for (j = 0; j < r; j++)
+         if (a[j] > beam_floor)
+            col[nnz++] = j;
+   }
+
+   start[r] = nnz;
+
+   beam_mark->fill(0);
+   beam_valid = true;
+}
+
+/** 
+ * Beam mode prediction: u = A'prob over the active states (those with
+ * nonzero prob) only, and the list of their successors in beam_next.
+ */
+
+void HMM::BeamPredict()
+{
+   int i, j, k;
+
+   if (!beam_valid)
+      BeamBuild();
+
+   real *p = prob->ptr;
+   real *uu = u->ptr;
+   int *start = beam_start->ptr;
+   int *col = beam_col->ptr;
+   int *next = beam_next->ptr;
+   int *mark = beam_mark->ptr;
+
+   u->zero();
+   beam_n_next = 0;
+
+   for (i = 0; i < r; i++)
+   {
+      if (p[i] == 0.0)
+         continue;
+
+      real pi = p[i];
+      real *a = A->ptr[i];
+
+      for (k = start[i]; k < start[i+1]; k++)
+      {
+         j = col[k];
+
+         if (!mark[j])
+         {
+            mark[j] = 1;
+            next[beam_n_next++] = j;
+         }
+
+         uu[j] += pi*a[j];
+      }
+   }
+
+   for (k = 0; k < beam_n_next; k++)
+      mark[next[k]] = 0;
+}
+
+/** 
+ * Beam mode update, after BeamPredict() and the emission densities:
+ * prob = scale * u .* f over the successors, then pruned to the beam
+ * and renormalized.  log_scale is taken before pruning.
+ * 
+ * @param reset_on_zero reset and return -1 if the observation has
+ * zero likelihood (as Classify(int *) does)
+ * 
+ * @return state, as from ViterbiStep()
+ */
+
+int HMM::BeamUpdate(bool reset_on_zero)
+{
+   int j, k;
+
+   real *p = prob->ptr;
+   real *uu = u->ptr;
+   int *next = beam_next->ptr;
+
+   real s = 0.0;
+
+   for (k = 0; k < beam_n_next; k++)
+   {
+      j = next[k];
+      s += (*f)(j)*uu[j];
+   }
+
+   if (s == 0.0)
+   {
+      if (debug)
+         printf("Cannot classify input! Likelihood is zero!\n");
+
+      if (reset_on_zero)
+      {
+         reset();
+         return -1;
+      }
+
+      scale = 1/REAL_EPSILON;
+   }
+   else
+      scale = 1/s;
+
+   log_scale = b->log_offset - log(scale);
+
+   // prob = scale * u .* f, on the successors only
+
+   real p_max = 0.0;
+
+   prob->zero();
+
+   for (k = 0; k < beam_n_next; k++)
+   {
+      j = next[k];
+      p[j] = scale*uu[j]*(*f)(j);
+
+      if (p[j] > p_max)
+         p_max = p[j];
+   }
+
+   // prune
+
+   real thresh = beam*p_max;
+
+   s = 0.0;
+   beam_n_active = 0;
+
+   for (k = 0; k < beam_n_next; k++)
+   {
+      j = next[k];
+
+      if (p[j] < thresh)
+         p[j] = 0.0;
+      else
+      {
+         s += p[j];
+         beam_n_active++;
+      }
+   }
+
+   if (s > 0.0)
+      for (k = 0; k < beam_n_next; k++)
+         p[next[k]] /= s;
+   else
+      prob->fill(1.0/r);   // nothing left; start over
+
+   SmoothStep();
+
+   return ViterbiStep();
+}
+
 void HMM::addOptions()
 {
    // These are set in StochasticClassifier
@@ -359,6 +717,12 @@ void HMM::init(StochasticClassifier *b_,
 
    tmp_r = new(HMM_allocator) IVec(r);
 
+   row_vec = new(HMM_allocator) IVec;
+   R2_diag = new(HMM_allocator) IVec;
+   S_A_vec = new(HMM_allocator) IVec;
+
+   blk_logF = new(HMM_allocator) IMat;
+
    // Viterbi stuff
 
    viterbi_hist = viterbi_hist_;
@@ -379,10 +743,21 @@ void HMM::init(StochasticClassifier *b_,
    for (i = 0; i < viterbi_hist; i++)
       psi[i] = new(HMM_allocator) IVecInt(r);
 
+   vit_path = new(HMM_allocator) IVecInt(viterbi_hist > 0 ? viterbi_hist : 1);
+   vit_path->fill(-1);
+
    *delta[0] = *prob;
 
    vit_count = 0;
    vit_pos = 0;
+
+   setSmoothLag(smooth_lag);           // r may have changed
+
+   beam_start = new(HMM_allocator) IVecInt(r+1);
+   beam_col = new(HMM_allocator) IVecInt;
+   beam_next = new(HMM_allocator) IVecInt(r);
+   beam_mark = new(HMM_allocator) IVecInt(r);
+   beam_valid = false;
 }
 
 void HMM::reset()
@@ -408,14 +783,223 @@ void HMM::reset()
    }
 
    *delta[0] = *prob;
+   vit_path->fill(-1);
    vit_count = 0;
    vit_pos = 0;
-   
+
+   smooth_pos = 0;
+   smooth_count = 0;
+   smooth_state = -1;
+
+   // A may have been set directly (batch EM, snapshots) before the reset
+
+   beam_valid = false;
+
    b->reset();
 
 }
 
 
+/** 
+ * One step of the Viterbi algorithm with fixed history backtracking.
+ *
+ * delta and psi are circular buffers of viterbi_hist slots, and
+ * vit_path holds the best state sequence ending at the most recent
+ * frame, in the same slots.  Each step does the max-product recursion
+ * in place (A is read row by row, never copied), then backtracks only
+ * until the new path joins the stored one; past that point the paths
+ * are identical.  Once the buffers are full, the returned state is the
+ * one viterbi_hist-1 frames back.
+ * 
+ * @return state, or -1 while the history is still filling up
+ */
+
+int HMM::ViterbiStep()
+{
+   int i, j, k;
+
+   if (viterbi_hist <= 1)
+   {
+      prob->vmax(&state);  // the current state will be the maximum
+                           // probability 
+      return state;
+   }
+
+   int *path = vit_path->ptr;
+
+   if (vit_count == 0)
+   {
+      *delta[vit_pos] = *prob;
+      prob->vmax(&path[vit_pos]);
+
+      vit_pos = (vit_pos+1)%viterbi_hist;
+      vit_count++;
+
+      state = -1;
+      return state;
+   }
+
+   int vit_prev = (vit_pos == 0) ? viterbi_hist-1 : vit_pos-1;
+
+   real *dp = delta[vit_prev]->ptr;
+   real *dn = delta[vit_pos]->ptr;
+   int *pn = psi[vit_pos]->ptr;
+   real *a = A->ptr[0];
+
+   // delta(j) = max_i delta_prev(i) * a(i,j), psi(j) = argmax
+
+   for (j = 0; j < r; j++)
+   {
+      dn[j] = dp[0] * a[j];
+      pn[j] = 0;
+   }
+
+   for (i = 1; i < r; i++)
+   {
+      real di = dp[i];
+      a = A->ptr[i];
+
+      for (j = 0; j < r; j++)
+      {
+         real v = di * a[j];
+         if (v > dn[j])
+         {
+            dn[j] = v;
+            pn[j] = i;
+         }
+      }
+   }
+
+   VecDotTimes(1.0,f,delta[vit_pos]);
+
+   delta[vit_pos]->normalize();
+
+   // backtrack until we hit the path found on the previous step
+
+   int n_back = (vit_count < viterbi_hist-1) ? vit_count : viterbi_hist-1;
+   int st;
+
+   k = vit_pos;
+   delta[vit_pos]->vmax(&st);
+   path[k] = st;
+
+   for (i = 0; i < n_back; i++)
+   {
+      st = (*psi[k])[st];
+
+      k = (k == 0) ? viterbi_hist-1 : k-1;
+
+      if (path[k] == st)
+         break;
+
+      path[k] = st;
+   }
+
+   vit_pos = (vit_pos + 1)%viterbi_hist;
+
+   if (vit_count+1 < viterbi_hist)
+   {
+      state = -1;
+      vit_count++;
+   }
+   else
+      state = path[vit_pos];     // oldest slot in the window
+
+   return state;
+}
+
+/** 
+ * One step of the fixed-lag smoother.
+ *
+ * The filtered probs and emission likelihoods of the last smooth_lag+1
+ * frames are kept in circular buffers.  Each step runs the backward
+ * recursion over the window, from beta(t) = 1 down to
+ *
+ *    beta(k-1) = A * (f(k) .* beta(k)),
+ *
+ * normalizing beta as it goes (only its direction matters, and f may
+ * be relative), then sets smooth_prob = prob(t-L) .* beta(t-L),
+ * normalized.  That is L matrix-vector products per frame, and no
+ * allocation.
+ * 
+ * @return smooth_state, the most likely state at t-smooth_lag, or -1
+ * while the window is still filling up
+ */
+
+int HMM::SmoothStep()
+{
+   int i, k;
+
+   if (smooth_lag <= 0)
+      return -1;
+
+   IVec a_new(smooth_alpha->ptr[smooth_pos], r);
+   IVec f_new(smooth_f->ptr[smooth_pos], r);
+
+   VecCopy(prob, &a_new);
+   VecCopy(f, &f_new);
+
+   k = smooth_pos;
+   smooth_pos = (smooth_pos + 1)%(smooth_lag + 1);
+
+   if (smooth_count < smooth_lag)
+   {
+      smooth_count++;
+      smooth_state = -1;
+      return smooth_state;
+   }
+
+   real *beta = smooth_beta->ptr;
+   real *tmp = smooth_tmp->ptr;
+
+   smooth_beta->fill(1.0);
+
+   for (int l = 0; l < smooth_lag; l++)
+   {
+      real *fk = smooth_f->ptr[k];
+      real s = 0.0;
+
+      for (i = 0; i < r; i++)
+         tmp[i] = fk[i]*beta[i];
+
+      MatVecMult(A, CblasNoTrans, smooth_tmp, smooth_beta);   // beta = A*tmp
+
+      for (i = 0; i < r; i++)
+         s += beta[i];
+
+      if (s > 0.0)
+         for (i = 0; i < r; i++)
+            beta[i] /= s;
+      else
+         smooth_beta->fill(1.0);   // f was zero; fall back to filtering
+
+      k = (k == 0) ? smooth_lag : k-1;
+   }
+
+   // k is now the oldest frame in the window
+
+   real *a = smooth_alpha->ptr[k];
+   real *sp = smooth_prob->ptr;
+   real s = 0.0;
+
+   for (i = 0; i < r; i++)
+   {
+      sp[i] = a[i]*beta[i];
+      s += sp[i];
+   }
+
+   if (s > 0.0)
+      for (i = 0; i < r; i++)
+         sp[i] /= s;
+   else
+      for (i = 0; i < r; i++)
+         sp[i] = a[i];
+
+   smooth_prob->vmax(&smooth_state);
+
+   return smooth_state;
+}
+
 int HMM::Classify(real *y)
 {
    int i;
@@ -429,6 +1013,15 @@ int HMM::Classify(real *y)
    }
    */
    
+   if (beam > 0.0)
+   {
+      BeamPredict();
+      b->ClassifyStates(y, beam_next->ptr, beam_n_next);
+      f = b->prob;
+
+      return BeamUpdate(false);
+   }
+
    // Update u = P(X(t)|Y(1)...Y(t-1))
 
    MatVecMult(A, CblasTrans, prob, u);  // u = A'prob
@@ -459,75 +1052,16 @@ int HMM::Classify(real *y)
    else
       scale = 1/scale;
 
-   VecCopy(f, prob);
-   VecDotTimes(scale, u, prob);         // prob = scale * u .* f
+   // f may be scaled by exp(-log_offset) (log domain emissions)
 
-   if (viterbi_hist <= 1)
-   {
-      prob->vmax(&state);  // the current state will be the maximum
-                           // probability 
-   }
-   else
-   {
-      if (vit_count == 0)
-      {
-         *delta[vit_pos] = *prob;
-         vit_pos = (vit_pos+1)%viterbi_hist;
-         vit_count++;
-      }
-      else
-      {
-         static IMat A_tmp;
-         static IVec row;
-
-         int vit_prev = vit_pos - 1;
+   log_scale = b->log_offset - log(scale);
 
-         if (vit_prev < 0)
-            vit_prev = viterbi_hist-1;
-      
-         A_tmp = *A;
-   
-         for (i = 0; i < r; i++)
-         {
-            A_tmp.getRow(i, &row);
-            VecScale((*delta[vit_prev])[i], &row);
-         }
-      
-         A_tmp.mmax(delta[vit_pos],psi[vit_pos],1);
-      
-         VecDotTimes(1.0,f,delta[vit_pos]);
-
-         delta[vit_pos]->normalize();
+   VecCopy(f, prob);
+   VecDotTimes(scale, u, prob);         // prob = scale * u .* f
 
-         //backtrack
+   SmoothStep();
 
-         if (vit_count+1 < viterbi_hist)
-         {
-            state = -1;
-            vit_count++;
-         }
-         else
-         {
-            int vit_backtrack = vit_pos;
-            
-            delta[vit_pos]->vmax(&state);
-            
-            for (i = 0; i < viterbi_hist-1; i++)
-            {
-               state = (*psi[vit_backtrack])[state];
-
-               vit_backtrack = vit_backtrack -1;
-               if (vit_backtrack < 0)
-                  vit_backtrack = viterbi_hist - 1;
-            }
-         }
-         
-         vit_pos = (vit_pos + 1)%viterbi_hist;
-      }
-      // TODO: if desired, we could also calculate backward probs here
-   }
-   
-   return state;
+   return ViterbiStep();
 }
 
 int HMM::Classify(int *y)
@@ -543,6 +1077,15 @@ int HMM::Classify(int *y)
    }
    */
    
+   if (beam > 0.0)
+   {
+      BeamPredict();
+      ((IndepPMF *)b)->Classify(y);   // a table lookup per state anyway
+      f = b->prob;
+
+      return BeamUpdate(true);
+   }
+
    // Update u = P(X(t)|Y(1)...Y(t-1))
 
    MatVecMult(A, CblasTrans, prob, u);  // u = A'prob
@@ -570,73 +1113,28 @@ int HMM::Classify(int *y)
    else
       scale = 1/scale;
 
-   VecCopy(f, prob);
-   VecDotTimes(scale, u, prob);         // prob = scale * u .* f
+   // f may be scaled by exp(-log_offset) (log domain emissions)
 
-   if (viterbi_hist <= 1)
-   {
-      prob->vmax(&state);  // the current state will be the maximum
-                           // probability 
-   }
-   else
-   {
-      // TODO: change to a circular buffer 
-
-      // run the viterbi algorith back (viterbi_hist) steps      
-   
-      // shift everything down...
-
-      IVec *delta_temp = delta[viterbi_hist-1];
-      IVecInt *psi_temp = psi[viterbi_hist-1];
-      
-      for (i = viterbi_hist-1; i >= 1; i--)
-      {
-//         probs[i] = probs[i-1];
-         delta[i] = delta[i-1];    // not the most efficient. :-(
-         psi[i] = psi[i-1];
-      }
+   log_scale = b->log_offset - log(scale);
 
-      delta[0] = delta_temp;
-      psi[0] = psi_temp;
-
-//      probs[0] = prob;
-
-      static IMat A_tmp;
-      static IVec row;
-   
-      A_tmp = *A;
-   
-      for (i = 0; i < r; i++)
-      {
-         A_tmp.getRow(i, &row);
-         VecScale((*delta[1])[i], &row);
-      }
-   
-      A_tmp.mmax(delta[0],psi[0],1);
-   
-      VecDotTimes(1.0,f,delta[0]);
-
-      // need to normalize deltas
-
-      real s = delta[0]->sum();
-      VecScale(1.0/s, delta[0]);
-
-      // backtrack
-   
-      delta[0]->vmax(&state);
-
-      for (i = 1; i < viterbi_hist; i++)
-         state = (*psi[i-1])[state];
+   VecCopy(f, prob);
+   VecDotTimes(scale, u, prob);         // prob = scale * u .* f
 
-      // TODO: if desired, we could also calculate backward probs here
-   }
+   SmoothStep();
 
-   return state;
+   return ViterbiStep();
 }
 
 int HMM::Classify(int y, int pos)
 {
-   int i;
+   if (beam > 0.0)
+   {
+      BeamPredict();
+      ((IndepPMF *)b)->Classify(y,pos);
+      f = b->prob;
+
+      return BeamUpdate(true);
+   }
 
    // Update u = P(X(t)|Y(1)...Y(t-1))
 
@@ -665,86 +1163,160 @@ int HMM::Classify(int y, int pos)
    else
       scale = 1/scale;
 
+   // f may be scaled by exp(-log_offset) (log domain emissions)
+
+   log_scale = b->log_offset - log(scale);
+
    VecCopy(f, prob);
    VecDotTimes(scale, u, prob);         // prob = scale * u .* f
 
-   if (viterbi_hist == 1)
+   SmoothStep();
+
+   return ViterbiStep();
+}
+
+/** 
+ * Run the (scaled) forward recursion over a block of observations.
+ * 
+ * Emission likelihoods for the whole block are calculated up front by
+ * b->LogLikBlock(), and the recursion is done with per-frame
+ * max-subtraction of the log likelihoods, so it cannot underflow.
+ * The filter continues from the current prob, and prob, u, f, scale
+ * and state are left as they would be after the last frame (f and
+ * scale relative to the largest emission likelihood if b->log_domain
+ * is set, as in Classify()).  The viterbi and smoother buffers are not
+ * updated.
+ *
+ * @param Y observations, one per row (T by d)
+ * @param post if not NULL, P(X(t)|Y(1)...Y(t)) for each frame (T by r)
+ * @param log_scale if not NULL, log(P(Y(t)|Y(1)...Y(t-1))) for each frame
+ * 
+ * @return state (max posterior) after the last frame, -1 if the
+ *         emission model rejects Y (the filter is left as it was)
+ */
+
+int HMM::ClassifyBlock(IMat *Y, IMat *post, IVec *log_scale)
+{
+   int t, i;
+   int T = Y->m;
+
+   if (b->LogLikBlock(Y, blk_logF) != 0)
    {
-      prob->vmax(&state);  // the current state will be the maximum
-                           // probability 
+      if (debug)
+         printf("Cannot classify input! Rejected by the emission model!\n");
+
+      return -1;
    }
-   else
+
+   if (post)
+      post->reshape(T, r);
+
+   if (log_scale)
+      log_scale->resize(T);
+
+   real *p = prob->ptr;
+   real *uu = u->ptr;
+
+   for (t = 0; t < T; t++)
    {
-      // TODO: change to a circular buffer 
+      real *lf = blk_logF->ptr[t];
+      real lf_max = -INF;
 
-      // run the viterbi algorith back (viterbi_hist) steps      
-   
-      // shift everything down...
+      // Update u = P(X(t)|Y(1)...Y(t-1))
 
-      IVec *delta_temp = delta[viterbi_hist-1];
-      IVecInt *psi_temp = psi[viterbi_hist-1];
-      
-      for (i = viterbi_hist-1; i >= 1; i--)
-      {
-//         probs[i] = probs[i-1];
-         delta[i] = delta[i-1];    // not the most efficient. :-(
-         psi[i] = psi[i-1];
-      }
+      MatVecMult(A, CblasTrans, prob, u);  // u = A'prob
+
+      for (i = 0; i < r; i++)
+         if (lf[i] > lf_max)
+            lf_max = lf[i];
 
-      delta[0] = delta_temp;
-      psi[0] = psi_temp;
+      // prob = u .* f (up to the factor exp(lf_max))
 
-//      probs[0] = prob;
+      real s = 0.0;
 
-      static IMat A_tmp;
-      static IVec row;
-   
-      A_tmp = *A;
-   
       for (i = 0; i < r; i++)
       {
-         A_tmp.getRow(i, &row);
-         VecScale((*delta[1])[i], &row);
+         p[i] = uu[i] * exp(lf[i] - lf_max);
+         s += p[i];
       }
-   
-      A_tmp.mmax(delta[0],psi[0],1);
-   
-      VecDotTimes(1.0,f,delta[0]);
 
-      // need to normalize deltas
+      if (s == 0.0)
+      {
+         if (debug)
+            printf("Cannot classify input! Likelihood is zero!\n");
 
-      real s = delta[0]->sum();
-      VecScale(1.0/s, delta[0]);
+         // restart the filter from this observation alone
 
-      // backtrack
-   
-      delta[0]->vmax(&state);
+         for (i = 0; i < r; i++)
+         {
+            p[i] = exp(lf[i] - lf_max);
+            s += p[i];
+         }
+
+         lf_max += log(REAL_EPSILON);
+      }
 
-      for (i = 1; i < viterbi_hist; i++)
-         state = (*psi[i-1])[state];
+      VecScale(1.0/s, prob);
 
-      // TODO: if desired, we could also calculate backward probs here
+      if (post)
+         memcpy(post->ptr[t], p, r*sizeof(real));
+
+      if (log_scale)
+         (*log_scale)(t) = lf_max + log(s);
+
+      if (t == T-1)
+      {
+         this->log_scale = lf_max + log(s);
+         scale = b->log_domain ? 1.0/s : 1.0/(s*exp(lf_max));
+      }
    }
-   
+
+   if (T > 0)
+   {
+      real *lf = blk_logF->ptr[T-1];
+      real off = b->log_domain ? lf[0] : 0.0;
+
+      if (b->log_domain)
+         for (i = 1; i < r; i++)
+            if (lf[i] > off)
+               off = lf[i];
+
+      for (i = 0; i < r; i++)
+         (*f)(i) = exp(lf[i] - off);
+   }
+
+   prob->vmax(&state);
+
    return state;
 }
 
+/** 
+ * Get the current best state sequence over the viterbi history.
+ * 
+ * @param seq filled with viterbi_hist states, oldest first.  Only the
+ *        last vit_count entries are meaningful until the history has
+ *        filled up.
+ * 
+ * @return 0
+ */
+
 int HMM::getViterbiSeq(IVecInt *seq)
 {
    int i;
-   int state;
 
    seq->resize(viterbi_hist);
 
-   delta[0]->vmax(&state);
-   (*seq)[viterbi_hist-1] = state;
-
-   for (i = 1; i < viterbi_hist; i++)
+   if (viterbi_hist <= 1)
    {
-      state = (*psi[i-1])[state];
-      (*seq)[viterbi_hist-1-i] = state;
+      (*seq)[0] = state;
+      return 0;
    }
 
+   // vit_pos is the slot that will be written next, i.e., the oldest
+
+   for (i = 0; i < viterbi_hist; i++)
+      (*seq)[i] = (*vit_path)[(vit_pos + i)%viterbi_hist];
+
    return 0;
 }
 
@@ -788,14 +1360,12 @@ int HMM::UpdateR(IMat *Rs_,
 //  R1 = Rs * F * scale 
 //     = Rs .* repmat(f',r,1) * scale;
    
-   static IVec *rowIndex = new(allocator) IVec;
-
    MatCopy(Rs,R1);   // R1 = Rs
    
    for (i = 0; i < r; i++)
    {
-      R1->getRow(i, rowIndex);
-      VecDotTimes(scale, f, rowIndex);
+      R1->getRow(i, row_vec);
+      VecDotTimes(scale, f, row_vec);
    }
 
 //   %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -833,14 +1403,12 @@ int HMM::UpdateR(IMat *Rs_,
    // R2 should already have zeros on off diagonals, so no need to
    // clear it
 
-   static IVec *R2diag = new IVec;
-
    // C/C++ uses row-major storage
 
    for (i = 0, j = 0; i < r; i++, j+=r)
    {
-      R2->getDiag(j, R2diag);
-      R2diag->fill((*prob)(i));
+      R2->getDiag(j, R2_diag);
+      R2_diag->fill((*prob)(i));
    }
    
    b->UpdateR(Rs, R1, u, scale);
@@ -860,8 +1428,6 @@ int HMM::UpdateGradient()
 
    // S_A_new = scale * w'*f
 
-   static IVec *S_A_vec = new IVec;
-   
    S_A_new->getAll(S_A_vec);
    GenMatVecMult(scale, w, CblasTrans, f, 0.0, S_A_vec);
    
@@ -874,8 +1440,9 @@ int HMM::UpdateGradient()
       // S_A = S_A + (1/n)*(S_A_new - S_A)
       //   = ((n-1)/n)*S_A + (1/n)*S_A_new
 
-      MatScale((n-1.0)/n, S_A);
-      MatAddScaled(1.0/n, S_A_new, S_A);
+      IView s_A(S_A);
+
+      s_A = ((n-1.0)/n)*s_A + (1.0/n)*IView(S_A_new);
       
    }
    else
@@ -905,14 +1472,13 @@ int HMM::UpdateParms(bool obs_update)
    
 // Update A
 
-   static IVec *A_vec = new(allocator) IVec;
-
    if (avg_iters && n > 1)
    {
       // A_temp =  A + epsilon*n*S_A;
 
-      MatCopy(A, A_temp);
-      MatAddScaled(epsilon*n, S_A, A_temp);
+      IView a(A), a_temp(A_temp);
+
+      a_temp = a + (epsilon*n)*IView(S_A);
 
       // Projection
 
@@ -920,8 +1486,7 @@ int HMM::UpdateParms(bool obs_update)
 
       // A = A + (1/n)*(A_temp - A)
 
-      MatScale((n-1.0)/n, A);
-      MatAddScaled(1.0/n, A_temp, A);
+      a = ((n-1.0)/n)*a + (1.0/n)*a_temp;
    }
    else
    {
@@ -931,6 +1496,8 @@ int HMM::UpdateParms(bool obs_update)
       ProbProject(A, prior, 2);
    }
 
+   beam_valid = false;
+
    if (obs_update) {
 	   b->UpdateParms();
    }
@@ -130,10 +130,13 @@ public:
    IMat             *w_next;
 
    real               scale;
+   real           log_scale;   // log(P(Y(t)|Y(1)...Y(t-1))), exact even
+                               // when f and scale are relative
 
    // viterbi variables
    IVec             **delta;
    IVecInt            **psi;
+   IVecInt        *vit_path;   // decoded states, same slots as delta/psi
    int         viterbi_hist;
    int              vit_pos;
    int            vit_count;
@@ -142,6 +145,16 @@ public:
 
    int                state;
 
+   // fixed-lag smoother
+   int           smooth_lag;
+   IVec        *smooth_prob;   // P(X(t-smooth_lag)|Y(1)...Y(t))
+   int         smooth_state;   // max of smooth_prob, -1 while filling up
+
+   // beam search
+   real                beam;   // drop states with prob < beam*max (0: off)
+   real          beam_floor;   // transitions <= this are skipped in beam mode
+   int        beam_n_active;   // states kept after the last Classify()
+
 private:
    Allocator *HMM_allocator;
 
@@ -152,6 +165,36 @@ private:
 
    IVec              *tmp_r;
 
+   IVec            *row_vec;   // views used by the RMLE updates
+   IVec            *R2_diag;
+   IVec            *S_A_vec;
+
+   IMat           *blk_logF;   // emission log likelihoods for ClassifyBlock
+
+   IMat       *smooth_alpha;   // filtered probs of the last smooth_lag+1
+   IMat           *smooth_f;   // frames and their emission likelihoods
+   IVec        *smooth_beta;   // (circular, row smooth_pos is the oldest)
+   IVec         *smooth_tmp;
+   int           smooth_pos;
+   int         smooth_count;
+
+   IVecInt      *beam_start;   // sparse A: successors of state i are
+   IVecInt        *beam_col;   // beam_col[beam_start[i]..beam_start[i+1])
+   IVecInt       *beam_next;   // successors of the active states
+   IVecInt       *beam_mark;
+   int          beam_n_next;
+   bool          beam_valid;   // sparse A is up to date
+
+   int ViterbiStep();
+
+   int SmoothStep();
+
+   void BeamBuild();
+
+   void BeamPredict();
+
+   int BeamUpdate(bool reset_on_zero);
+
 public:
 
    HMM();
@@ -200,12 +243,22 @@ public:
 
    int setViterbiHist(int viterbi_hist_);
 
+   int setSmoothLag(int smooth_lag_);
+
+   int setBeam(real beam_, real beam_floor_ = 0.0);
+
+   void invalidateBeam();   ///< call after changing A directly
+
    virtual int Classify(real *y);
 
    virtual int Classify(int *y);
 
    virtual int Classify(int y, int pos);
 
+   int ClassifyBlock(IMat *Y, 
+                     IMat *post = NULL, 
+                     IVec *log_scale = NULL);
+
    int getViterbiSeq(IVecInt *seq);
    
    virtual int Updatew();
@@ -64,6 +64,7 @@ static char *IndepPMF_CC_Id = "$Id: IndepPMF.cc,v 1.1 2005/05/09 20:52:57 mrmccl
 
 #include "IndepPMF.hh"
 #include "N.hh"
+#include "../imatlib/IExpr.hh"
 #include "gen_defines.h"
 
 using namespace Torch;
@@ -290,14 +291,12 @@ int IndepPMF::Classify(real *y_)
 {
 	int i;
 
-	static IVec row;
-
 	y->set(y_,d);
 
 	for (i = 0; i < d; i++)
 	{
-		b[i]->getRow(y_[i], &row);   // row points to row "y_[i]" of b[i]
-		fy->setRow(i, &row);
+		b[i]->getRow(y_[i], &row_vec);   // row_vec points to row "y_[i]" of b[i]
+		fy->setRow(i, &row_vec);
 	}
 
 	fy->prod(prob,1);   // prob = product along dimension 1 of fy
@@ -312,8 +311,6 @@ int IndepPMF::Classify(int y_, int pos)
 {
 	int i;
 
-	static IVec row;
-
 	b[pos]->getRow(y_, prob, true);  // FRED: check me
 
 	prob->vmax(&best_class);
@@ -325,8 +322,6 @@ int IndepPMF::Classify(int *y_)
 {
 	int i;
 
-	static IVec row;
-
 	y->set(y_,d,1,true);
 
 
@@ -344,8 +339,8 @@ int IndepPMF::Classify(int *y_)
 		 * 				integrated out of the probability calculation.
 		 */
 		if (y_[i] >= 0) {
-			b[i]->getRow(y_[i], &row);   // row points to row "y_[i]" of b[i]
-			fy->setRow(i, &row);
+			b[i]->getRow(y_[i], &row_vec);   // row_vec points to row "y_[i]" of b[i]
+			fy->setRow(i, &row_vec);
 		} else {
 			fy->setRow(i, &drow);
 		}
@@ -407,9 +402,6 @@ int IndepPMF::UpdateR(IMat *Rs_,
 	//   %
 	//   %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-	static IVec df_diag;
-	static IVec df2_diag;
-
 	//    % we only need to calculated the derivative for
 	//    % obs. probabilities corresponding to actual observations
 
@@ -450,8 +442,6 @@ int IndepPMF::UpdateGradient()
 
 	// Get a vector view of the S matrices
 
-	static IVec S_b_vec;
-
 	int i;
 
 	for (i = 0; i < d; i++)
@@ -483,8 +473,9 @@ int IndepPMF::UpdateGradient()
 
 		for (i = 0; i < d; i++)
 		{
-			MatScale((n-1.0)/n, S_b[i]);
-			MatAddScaled(1.0/n, S_b_new[i], S_b[i]);
+			IView s_b(S_b[i]);
+
+			s_b = ((n-1.0)/n)*s_b + (1.0/n)*IView(S_b_new[i]);
 		}
 	}
 	else
@@ -518,8 +509,9 @@ int IndepPMF::UpdateParms()
 		{
 			// b_temp =  b + epsilon*n*S_b;
 
-			MatCopy(b[i], b_temp[i]);
-			MatAddScaled(epsilon*n, S_b[i], b_temp[i]);
+			IView bv(b[i]), bv_temp(b_temp[i]);
+
+			bv_temp = bv + (epsilon*n)*IView(S_b[i]);
 
 			// Projection
 
@@ -527,8 +519,7 @@ int IndepPMF::UpdateParms()
 
 			// b = b + (1/n)*(b_temp - b)
 
-			MatScale((n-1.0)/n, b[i]);
-			MatAddScaled(1.0/n, b_temp[i], b[i]);
+			bv = ((n-1.0)/n)*bv + (1.0/n)*bv_temp;
 		}
 	}
 	else
@@ -552,6 +543,152 @@ int IndepPMF::RMLEUpdate()
 	return (UpdateParms());
 }
 
+/** 
+ * Log likelihoods of a block of observations.  Symbols are stored as
+ * reals; negative symbols are missing and integrated out, as in
+ * Classify(int *).
+ * 
+ * @param Y observations, one per row (T by d)
+ * @param logF output, T by r: logF(t,i) = log(P(Y(t)|X=i))
+ * 
+ * @return 0 on success, -1 on a size mismatch or a symbol out of range
+ */
+
+int IndepPMF::LogLikBlock(IMat *Y, IMat *logF)
+{
+	int t, i, j;
+
+	if (Y->n != d)
+		return -1;
+
+	logF->reshape(Y->m, r);
+	logF->fill(0.0);
+
+	for (t = 0; t < Y->m; t++)
+	{
+		real *lf = logF->ptr[t];
+
+		for (i = 0; i < d; i++)
+		{
+			int sym = (int)Y->ptr[t][i];
+
+			if (sym < 0)
+				continue;
+
+			if (sym >= (*s)[i])
+				return -1;
+
+			real *bp = b[i]->ptr[sym];
+
+			for (j = 0; j < r; j++)
+				lf[j] += log(bp[j]);
+		}
+	}
+
+	return 0;
+}
+
+/** 
+ * Sufficient statistics for batch EM: the expected symbol counts for
+ * each state, laid out like the b matrices.
+ * 
+ * @return r * sum(s)
+ */
+
+int IndepPMF::EMStatsSize()
+{
+	int i, n = 0;
+
+	for (i = 0; i < d; i++)
+		n += (*s)[i]*r;
+
+	return n;
+}
+
+/** 
+ * Accumulate EM statistics for one sequence (missing symbols are
+ * skipped).  Only reads the model.
+ * 
+ * @param Y observations, one per row (T by d)
+ * @param gamma state posteriors (T by r)
+ * @param stats accumulated statistics (EMStatsSize() long)
+ * 
+ * @return 0 on success, -1 on a size mismatch
+ */
+
+int IndepPMF::EMAccumulate(IMat *Y, IMat *gamma, real *stats)
+{
+	int t, i, j;
+	int T = Y->m;
+
+	if (Y->n != d || gamma->m != T || gamma->n != r)
+		return -1;
+
+	for (t = 0; t < T; t++)
+	{
+		real *g = gamma->ptr[t];
+		real *st = stats;
+
+		for (i = 0; i < d; i++)
+		{
+			int sym = (int)Y->ptr[t][i];
+
+			if (sym >= 0 && sym < (*s)[i])
+			{
+				real *c = st + sym*r;
+
+				for (j = 0; j < r; j++)
+					c[j] += g[j];
+			}
+
+			st += (*s)[i]*r;
+		}
+	}
+
+	return 0;
+}
+
+/** 
+ * EM update of b from accumulated statistics.  Each column is set to
+ * the normalized counts and projected as in UpdateParms().
+ * 
+ * @param stats statistics from EMAccumulate(), summed over all sequences
+ * @param min_count columns with less total count are not changed
+ * 
+ * @return 0
+ */
+
+int IndepPMF::EMUpdate(real *stats, real min_count)
+{
+	int i, j, k;
+	real *st = stats;
+
+	for (i = 0; i < d; i++)
+	{
+		int ns = (*s)[i];
+
+		for (j = 0; j < r; j++)
+		{
+			real n = 0.0;
+
+			for (k = 0; k < ns; k++)
+				n += st[k*r+j];
+
+			if (n < min_count || n <= 0.0)
+				continue;
+
+			for (k = 0; k < ns; k++)
+				b[i]->ptr[k][j] = st[k*r+j]/n;
+		}
+
+		ProbProject(b[i], prior, 1);
+
+		st += ns*r;
+	}
+
+	return 0;
+}
+
 int IndepPMF::Generate(int rr, int ddim, real rn)
 {
 	int i, s_d;
@@ -133,6 +133,11 @@ private:
    IMat            **b_temp;
    IMat         **df_b_temp;
 
+   IVec             row_vec;  // views used by Classify() and the
+   IVec             df_diag;  // RMLE updates
+   IVec            df2_diag;
+   IVec             S_b_vec;
+
 public:
 
 // TODO: add support for IVecInt's
@@ -182,6 +187,14 @@ public:
 
    virtual int RMLEUpdate();
 
+   virtual int LogLikBlock(IMat *Y, IMat *logF);
+
+   virtual int EMStatsSize();
+
+   virtual int EMAccumulate(IMat *Y, IMat *gamma, real *stats);
+
+   virtual int EMUpdate(real *stats, real min_count = 1.0);
+
 //   virtual int KMeansInit(Sequence *s);
 
    virtual int Generate(int rr, int ddim, real rn);
@@ -30,38 +30,107 @@
 #include "N.hh"
 
 
+NWorkspace::NWorkspace(int d_) :
+   d(0)
+{
+   resize(d_);
+}
+
+void NWorkspace::resize(int d_)
+{
+   if (d_ == d)
+      return;
+
+   d = d_;
+
+   yy.resize(d);
+   SigmaInv_yy.resize(d);
+   SigmaInv.reshape(d,d);
+   dSigma.reshape(d,d);
+}
+
 real N(IVec *y, IVec *mu, IMat *R, IVec *df_mu, IMat *df_R)
 {
-   static IVec *yy = new IVec;
-   static IMat *SigmaInv = new IMat;
-   static IVec *SigmaInv_yy = new IVec;
+   NWorkspace ws(y->n);
 
-   real nn;
+   return N(y, mu, R, df_mu, df_R, &ws);
+}
 
-   int d = y->n;
+real N(IVec *y, IVec *mu, IMat *R, IVec *df_mu, IMat *df_R, 
+       NWorkspace *ws)
+{
+   ws->resize(y->n);
 
-   // resize local vectors/matrices if necessary
+   NCholInv(R, &ws->SigmaInv);            // SigmaInv = inv(Sigma) = inv(R'R)
 
-   if (yy->n != d)
-   {
-      yy->resize(d);
-      SigmaInv->reshape(d,d);
-      SigmaInv_yy->resize(d);
-   }
-   
-   VecCopy(y,yy);
-   VecSub(mu,yy);                         // yy = y-mu;
+   return exp(logN(y, mu, R, &ws->SigmaInv, NLogNorm(R), ws, df_mu, df_R));
+}
+
+/** 
+ * Log of the normalizing constant of N(mu, R'R)
+ * 
+ * @param R cholesky factor of the covariance matrix (Sigma = R'R)
+ * 
+ * @return -0.5 * (d*log(2*pi) + log(det(Sigma)))
+ */
+
+real NLogNorm(IMat *R)
+{
+   int d = R->m;
+   real log_det = 0.0;
+
+   for (int i = 0; i < d; i++)
+      log_det += log(fabs(R->ptr[i][i]));
 
-   real det_Sigma = CholDet(R);
+   // log(det(Sigma)) = 2*sum(log(diag(R)))
+
+   return -0.5 * (d * log(2.0*M_PI)) - log_det;
+}
 
+/** 
+ * Inverse covariance matrix from its cholesky factor
+ * 
+ * @param R cholesky factor of the covariance matrix (Sigma = R'R)
+ * @param SigmaInv output, d by d (only the upper triangle is valid)
+ * 
+ * @return return value of potri (0 on success)
+ */
+
+int NCholInv(IMat *R, IMat *SigmaInv)
+{
    MatCopy(R,SigmaInv);
-   MatCholInv(SigmaInv);                  // SigmaInv = inv(Sigma) = inv(R'R)
 
-//   SigmaInv_yy->zero();
+   return MatCholInv(SigmaInv);
+}
+
+// Shared body of logN() and dlogN(): derivatives are scaled by
+// exp(log_nn - log_offset), or not at all if rel is set
+
+static real logNDeriv(IVec *y, 
+                      IVec *mu, 
+                      IMat *R, 
+                      IMat *SigmaInv, 
+                      real log_norm,
+                      NWorkspace *ws,
+                      IVec *df_mu, 
+                      IMat *df_R,
+                      real log_offset,
+                      bool rel)
+{
+   IVec *yy = &ws->yy;
+   IVec *SigmaInv_yy = &ws->SigmaInv_yy;
+
+   VecCopy(y,yy);
+   VecSub(mu,yy);                         // yy = y-mu;
+
    SymMatVecMult(1.0, SigmaInv, yy, 0.0, SigmaInv_yy); // SigmaInv_yy = SigmaInv * yy
-   
-   nn = (1/(pow(2.0*M_PI,(d/2.0)) * sqrt(det_Sigma))) *
-      exp(-0.5 * VecDot(yy, SigmaInv_yy));
+
+   real log_nn = log_norm - 0.5 * VecDot(yy, SigmaInv_yy);
+
+   if (!df_mu && !df_R)
+      return log_nn;
+
+   real nn = rel ? 1.0 : exp(log_nn - log_offset);
 
    // Calc derivatives
 
@@ -73,16 +142,79 @@ real N(IVec *y, IVec *mu, IMat *R, IVec *df_mu, IMat *df_R)
    
    if (df_R)
    {
-      // SigmaInv = SigmaInv - SigmaInv_yy*SigmaInv_yy'
+      // dSigma = SigmaInv - SigmaInv_yy*SigmaInv_yy'
 
-      SymMatRankUpdate(-1, SigmaInv_yy, SigmaInv);
+      MatCopy(SigmaInv, &ws->dSigma);
+      SymMatRankUpdate(-1, SigmaInv_yy, &ws->dSigma);
    
       // df_R = -nn * R * (SigmaInv - SigmaInv_yy*SigmaInv_yy')
    
-      MatSymMatMult(-nn, R, SigmaInv, 0.0, df_R);
-
+      MatSymMatMult(-nn, R, &ws->dSigma, 0.0, df_R);
    }
 
-   return nn;
+   return log_nn;
 }
 
+/** 
+ * Log of the Gaussian density at y, using a precomputed inverse and
+ * normalizer.  Derivatives (if requested) are those of the density
+ * itself, not of its log, to match N().
+ * 
+ * @param y observation
+ * @param mu mean
+ * @param R cholesky factor of the covariance matrix (Sigma = R'R)
+ * @param SigmaInv inv(Sigma), from NCholInv()
+ * @param log_norm normalizer, from NLogNorm()
+ * @param ws workspace, sized to the dimension of y
+ * @param df_mu if not NULL, derivative of N wrt mu
+ * @param df_R if not NULL, derivative of N wrt R
+ * @param log_offset derivatives are those of N*exp(-log_offset), so
+ *        they don't underflow when N does
+ * 
+ * @return log(N(y; mu, Sigma))
+ */
+
+real logN(IVec *y, 
+          IVec *mu, 
+          IMat *R, 
+          IMat *SigmaInv, 
+          real log_norm,
+          NWorkspace *ws,
+          IVec *df_mu, 
+          IMat *df_R,
+          real log_offset)
+{
+   return logNDeriv(y, mu, R, SigmaInv, log_norm, ws, df_mu, df_R,
+                    log_offset, false);
+}
+
+/** 
+ * As logN(), but the derivatives are those of log(N), i.e., those of
+ * N divided by N.  They never underflow, and the caller can scale them
+ * to the derivatives of N*exp(-offset) for any offset once the log
+ * density is known.
+ * 
+ * @param y observation
+ * @param mu mean
+ * @param R cholesky factor of the covariance matrix (Sigma = R'R)
+ * @param SigmaInv inv(Sigma), from NCholInv()
+ * @param log_norm normalizer, from NLogNorm()
+ * @param ws workspace, sized to the dimension of y
+ * @param df_mu if not NULL, derivative of log(N) wrt mu
+ * @param df_R if not NULL, derivative of log(N) wrt R
+ * 
+ * @return log(N(y; mu, Sigma))
+ */
+
+real dlogN(IVec *y, 
+           IVec *mu, 
+           IMat *R, 
+           IMat *SigmaInv, 
+           real log_norm,
+           NWorkspace *ws,
+           IVec *df_mu, 
+           IMat *df_R)
+{
+   return logNDeriv(y, mu, R, SigmaInv, log_norm, ws, df_mu, df_R,
+                    0.0, true);
+}
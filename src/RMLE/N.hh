@@ -48,7 +48,58 @@ static char *N_H_Id = "$Id: N.hh,v 1.1 2005/05/09 20:52:58 mrmcclai Exp $";
 #define exp(x)   expf(x)
 #endif
 
+/**
+ * @class NWorkspace
+ * @brief scratch space for evaluating N()/logN() without static or
+ *        per-call allocation
+ *
+ * Each caller (e.g., each Gaussian) owns its own workspace, so that
+ * densities can be evaluated from several threads at once.  Storage
+ * is only reallocated when the dimension changes.
+ */
+
+class NWorkspace : public Object
+{
+public:
+   int d;
+
+   IVec yy;                   ///< y - mu
+   IVec SigmaInv_yy;          ///< inv(Sigma) * (y - mu)
+   IMat SigmaInv;             ///< inv(Sigma) (upper triangle)
+   IMat dSigma;               ///< inv(Sigma) - SigmaInv_yy*SigmaInv_yy'
+
+   NWorkspace(int d_ = 0);
+
+   void resize(int d_);
+};
+
 real N(IVec *y, IVec *mu, IMat *U, IVec *df_mu = NULL, IMat *df_U = NULL);
 
+real N(IVec *y, IVec *mu, IMat *R, IVec *df_mu, IMat *df_R, 
+       NWorkspace *ws);
+
+real NLogNorm(IMat *R);
+
+int NCholInv(IMat *R, IMat *SigmaInv);
+
+real logN(IVec *y, 
+          IVec *mu, 
+          IMat *R, 
+          IMat *SigmaInv, 
+          real log_norm,
+          NWorkspace *ws,
+          IVec *df_mu = NULL, 
+          IMat *df_R = NULL,
+          real log_offset = 0.0);
+
+real dlogN(IVec *y, 
+           IVec *mu, 
+           IMat *R, 
+           IMat *SigmaInv, 
+           real log_norm,
+           NWorkspace *ws,
+           IVec *df_mu, 
+           IMat *df_R);
+
 
 #endif /* N_H */
@@ -98,6 +98,8 @@ StochasticClassifier::StochasticClassifier():
       eps_exp(0.0),
       prior(0.0),
       log_prob(0.0),
+      log_domain(false),
+      log_offset(0.0),
       Rs(NULL),
       R1(NULL),
       R2(NULL),
@@ -123,6 +125,8 @@ StochasticClassifier::StochasticClassifier(int r_, int d_, real prior_):
       eps0(0.001),
       eps_exp(0.0),
       log_prob(0.0),
+      log_domain(false),
+      log_offset(0.0),
       Rs(NULL),
       R1(NULL),
       R2(NULL),
@@ -154,6 +158,8 @@ void StochasticClassifier::addOptions()
    addROption("eps_exp",       &eps_exp,   0.000, "learning rate decay");
    addROption("prior",         &prior,     0.0,   "prior on weights");
 
+   addBOption("log domain",    &log_domain, false, "scale likelihoods by their max (no underflow)");
+
    addBOption("debug",         &debug,     false, "print debug info");
    
 }
@@ -197,6 +203,95 @@ int StochasticClassifier::Classify(real *y)
    return -1;
 }
 
+/** 
+ * Classify when only some of the states' likelihoods are needed (the
+ * successors of the active states in a beam search, see HMM).  The
+ * default just calls Classify(); subclasses can evaluate the listed
+ * states only, and leave prob at zero for the rest.
+ * 
+ * @param y observation
+ * @param states states to evaluate
+ * @param n_states number of states in the list
+ * 
+ * @return best class among the evaluated states
+ */
+
+int StochasticClassifier::ClassifyStates(real *y, int *states, int n_states)
+{
+   return Classify(y);
+}
+
+/** 
+ * Log likelihoods of a block of observations.  The default just calls
+ * Classify() on each row and adds back the log_offset it scaled prob
+ * by; subclasses should override this with something faster when they
+ * can.
+ * 
+ * @param Y observations, one per row (T by d)
+ * @param logF output, T by r: logF(t,i) = log(P(Y(t)|X=i))
+ * 
+ * @return 0 on success, -1 if Y is not d wide
+ */
+
+int StochasticClassifier::LogLikBlock(IMat *Y, IMat *logF)
+{
+   if (Y->n != d)
+      return -1;
+
+   logF->reshape(Y->m, r);
+
+   for (int t = 0; t < Y->m; t++)
+   {
+      Classify(Y->ptr[t]);
+
+      for (int i = 0; i < r; i++)
+         (*logF)(t,i) = log((*prob)(i)) + log_offset;
+   }
+
+   return 0;
+}
+
+/** 
+ * Size of the sufficient statistics for a batch EM update (number of
+ * reals).  0 if EM is not supported.
+ */
+
+int StochasticClassifier::EMStatsSize()
+{
+   return 0;
+}
+
+/** 
+ * Add the sufficient statistics of one observation sequence, given
+ * the state posteriors, to stats.  Must not change the classifier,
+ * since it is called for several sequences in parallel.
+ * 
+ * @param Y observations, one per row (T by d)
+ * @param gamma state posteriors (T by r)
+ * @param stats accumulated statistics, EMStatsSize() long
+ * 
+ * @return 0 on success, -1 if not supported
+ */
+
+int StochasticClassifier::EMAccumulate(IMat *Y, IMat *gamma, real *stats)
+{
+   return -1;
+}
+
+/** 
+ * M-step: set the parameters from accumulated statistics.
+ * 
+ * @param stats statistics from EMAccumulate(), summed over all sequences
+ * @param min_count states with less total occupancy are left alone
+ * 
+ * @return 0 on success, -1 if not supported
+ */
+
+int StochasticClassifier::EMUpdate(real *stats, real min_count)
+{
+   return -1;
+}
+
 int StochasticClassifier::Updatew()
 {
    return -1;
@@ -110,6 +110,9 @@ public:
 
    real        log_prob;
 
+   bool      log_domain;   // scale prob by the largest likelihood
+   real      log_offset;   // log of that scale from the last Classify()
+
    IMat             *Rs;
    IMat             *R1;
    IMat             *R2;
@@ -134,6 +137,18 @@ public:
 
    virtual int Classify(real *y);
 
+   virtual int ClassifyStates(real *y, int *states, int n_states);
+
+   virtual int LogLikBlock(IMat *Y, IMat *logF);
+
+   // batch EM (see BaumWelch)
+
+   virtual int EMStatsSize();
+
+   virtual int EMAccumulate(IMat *Y, IMat *gamma, real *stats);
+
+   virtual int EMUpdate(real *stats, real min_count = 1.0);
+
    virtual int Updatew();
 
    virtual int UpdateR(IMat *Rs_=NULL,
@@ -38,6 +38,7 @@
  *  	decay	-- learning rate decay; 1 = no decay (D 1.0)
  *  	initsamples	-- number of initialization samples to gather at beginning to use for kmeans initialization (O 0.0)
  *  	nkmiter -- number of iterations to run for k-means initialization (D 20)
+ *  	kmbatch -- mini-batch size for the initsamples k-means initialization; 0 = full batch (D 0)
  *  	initrng	-- range of values that entries in A or B matrices should rando inited to [disc only] (ex: initrng 0.1 0.3)
  *  	dsto	-- mark one of the obs matrices as double stochastic [0-n, disc only] (ex: dsto 2)
  *  	nomark	-- flag to turn markov behavior off; all elements of trans. matrix are set equal (O)
@@ -49,13 +50,19 @@
  *  	train	-- set to either 0 or 1, to give initial value for training flag (D 1)
  *  	log		-- flag to stream vector of all parameter values to port after each classification (O 0)
  *  	verbose	-- for now just enables echoing of the current state to stdout
+ *  	logdomain	-- flag to evaluate gaussians in the log domain, so long/high dimensional inputs can't underflow (O, gauss only)
+ *  	single	-- flag to use float32 for block evaluation of the gaussians (O, gauss only)
+ *  	smoothlag	-- lag (in samples) of the fixed-lag smoother feeding smooth:o; 0 = off (D 0)
+ *  	beam	-- beam search: drop states with prob below beam * the max; 0 = off (D 0)
+ *  	beamfloor	-- transitions at or below this are skipped in beam mode, e.g. the prior for lr models (D 0)
  *  	name	-- module basename (D /hmmRMLE)
  *
  *  outputs:
  *  	/hmmRMLE/state:o	-- estimated (ML) internal state value; vector with one element
- *  	/hmmRMLE/prob:o		-- internal state PMF; 0th element of the vector is the log likelihood of normalizing coeff
+ *  	/hmmRMLE/prob:o		-- internal state PMF; 0th element of the vector is the normalizing coeff (its log likelihood with logdomain)
  *  	/hmmRMLE/gen:o		-- randomly generated observations; produced only when requested on /hmmRMLE/gen:i
  *  	/hmmRMLE/log:o		-- stream of all parameters values as a vector in form of [A B1 B2...] for disc and [A MU R] for gaussian
+ *  	/hmmRMLE/smooth:o	-- smoothed state estimate for smoothlag samples back: [state P(X(t-L)|Y(1..t))]; only with smoothlag
  *  	/hmmRMLE/rpc		-- rpc port for run-time access to model parameters/data
  *
  *  rpc commands:
@@ -163,6 +170,7 @@ protected:
 	BufferedPort<yarp::sig::Vector> * portProbOut;
 	BufferedPort<yarp::sig::Vector> * portGenOut;
 	BufferedPort<yarp::sig::Vector> * portLogOut;
+	BufferedPort<yarp::sig::Vector> * portSmoothOut;
 
 	//data objects
 	DataBuffer obsBuffer;
@@ -193,7 +201,11 @@ protected:
 	bool logparams;
 	int initsamples;
 	int nkmiter;
+	int kmbatch;
 	bool verbose;
+	bool logdomain, single;
+	int smoothlag;
+	double beam, beamfloor;
 
 	//gsl rng vars
 	const gsl_rng_type * T;
@@ -326,11 +338,17 @@ public:
 		decay = rf.check("decay",Value(0.0),"learning rate decay value (0.0-1.0)").asDouble();
 		initsamples = rf.check("initsamples",Value(0),"number of kmeans init samples to gather before starting").asInt();
 		nkmiter = rf.check("nkmiter",Value(20),"number of kmeans iters").asInt();
+		kmbatch = rf.check("kmbatch",Value(0),"kmeans mini-batch size (0 = full batch)").asInt();
 		nomark = rf.check("nomark");
 		ltr = rf.check("lr");
 		training = (bool)rf.check("train",Value(1)).asInt();
 		logparams = (bool)rf.check("log");
 		verbose = (bool)rf.check("verbose");
+		logdomain = (bool)rf.check("logdomain");
+		smoothlag = rf.check("smoothlag",Value(0),"fixed-lag smoother lag").asInt();
+		beam = rf.check("beam",Value(0.0),"relative beam threshold").asDouble();
+		beamfloor = rf.check("beamfloor",Value(0.0),"min. transition prob in beam mode").asDouble();
+		single = (bool)rf.check("single");
 
 		//require number of states
 		if (rf.check("nstates")) {
@@ -444,6 +462,10 @@ public:
 		string portLogOName="/"+name+"/log:o";
 		portLogOut->open(portLogOName.c_str());
 
+		portSmoothOut=new BufferedPort<yarp::sig::Vector>;
+		string portSmoothOName="/"+name+"/smooth:o";
+		portSmoothOut->open(portSmoothOName.c_str());
+
 
 		//check for previously loaded data
 		Am = MUm = Rm = inData = NULL;
@@ -483,10 +505,13 @@ public:
 				if (MUm) delete MUm;
 				if (Rm) {
 					g_dist->R->set(Rm->base, Rm->m, Rm->n, Rm->ld, true, true);
+					g_dist->invalidateDensityCache();
 					delete Rm;
 				}
 
 			}
+			g_dist->log_domain = logdomain;
+			g_dist->single = single;
 			obs_dist = g_dist;
 			d_dist = NULL;
 		}
@@ -519,6 +544,13 @@ public:
 		obs_dist->eps0 = eps;
 		obs_dist->eps_exp = decay;
 
+		if (smoothlag > 0) {
+			p->setSmoothLag(smoothlag);
+		}
+		if (beam > 0.0 && p->setBeam(beam, beamfloor) != 0) {
+			printf("beam must be between 0 and 1, ignoring\n");
+		}
+
 		//setup rng
 		gsl_rng_env_setup();
 		T = gsl_rng_default;
@@ -535,18 +567,21 @@ public:
 		portStateOut->interrupt();
 		portGenOut->interrupt();
 		portProbOut->interrupt();
+		portSmoothOut->interrupt();
 
 		portObsIn->close();
 		portGenIn->close();
 		portStateOut->close();
 		portGenOut->close();
 		portProbOut->close();
+		portSmoothOut->close();
 
 		delete portObsIn;
 		delete portGenIn;
 		delete portStateOut;
 		delete portProbOut;
 		delete portGenOut;
+		delete portSmoothOut;
 
 		//delete obs_dist;
 		//delete p;
@@ -579,6 +614,7 @@ public:
 							}
 							obsBuffer.pop_front();
 						}
+						g_dist->kmeans_batch = kmbatch;
 						g_dist->KMeansInit(inData, true, nkmiter);
 						initsamples = 0;
 						printf("k-means initialization has been completed...\n");
@@ -663,13 +699,24 @@ public:
 					yarp::sig::Vector &ps = portProbOut->prepare();
 					cs.clear(); ps.clear();
 					cs.push_back(cstate);
-					ps.push_back(p->scale);
+					ps.push_back(logdomain ? p->log_scale : p->scale);
 					for (int i = 0; i < r; i++) {
 						ps.push_back(p->prob->ptr[i]);
 					}
 					portStateOut->write();
 					portProbOut->write();
 
+					//smoothed estimate, once the smoother's window is full
+					if (p->smooth_state >= 0) {
+						yarp::sig::Vector &ss = portSmoothOut->prepare();
+						ss.clear();
+						ss.push_back(p->smooth_state);
+						for (int i = 0; i < r; i++) {
+							ss.push_back(p->smooth_prob->ptr[i]);
+						}
+						portSmoothOut->write();
+					}
+
 					//train if it currently enabled, enforcing model constraints
 					if (training) {
 
@@ -0,0 +1,128 @@
+/*
+ *  logLikCheck.cpp
+ *
+ *  checks StochasticClassifier::LogLikBlock, the default used by
+ *  classifiers that don't override it. a classifier with known log
+ *  likelihoods (far enough below 0 that exp() underflows without
+ *  scaling) is run through it with and without log domain scaling, and
+ *  the result must match the exact values. a block of the wrong width
+ *  must be rejected.
+ *
+ *  built when BUILD_RMLE_CHECKS is on. exits nonzero on any failure
+ *
+ *  usage: logLikCheck
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "StochasticClassifier.hh"
+
+#define CHECK_R 3
+#define CHECK_D 2
+#define CHECK_T 50
+#define CHECK_TOL 1e-9
+
+/**
+ * Classifier with log(P(y|X=i)) = c - sum_j (y_j - i)^2, which scales
+ * prob like the log domain emissions do, and has no LogLikBlock().
+ */
+
+class QuadClassifier : public StochasticClassifier
+{
+public:
+
+   real c;
+
+   QuadClassifier(real c_) : StochasticClassifier(CHECK_R, CHECK_D), c(c_) { }
+
+   real logLik(real *y, int i)
+   {
+      real s = 0.0;
+      for (int j = 0; j < d; j++)
+         s += (y[j] - i)*(y[j] - i);
+      return c - s;
+   }
+
+   virtual int Classify(real *y)
+   {
+      int i;
+      real mx = logLik(y, 0);
+
+      best_class = 0;
+      for (i = 1; i < r; i++)
+      {
+         if (logLik(y, i) > mx)
+         {
+            mx = logLik(y, i);
+            best_class = i;
+         }
+      }
+
+      log_offset = log_domain ? mx : 0.0;
+      for (i = 0; i < r; i++)
+         (*prob)(i) = exp(logLik(y, i) - log_offset);
+
+      return best_class;
+   }
+};
+
+/**
+ * Runs Y through the default LogLikBlock() and counts the entries that
+ * differ from the exact log likelihoods.
+ */
+
+static int countBad(QuadClassifier *q, IMat *Y)
+{
+   IMat logF;
+   int bad = 0;
+
+   if (q->LogLikBlock(Y, &logF) != 0)
+      return Y->m*q->r;
+
+   for (int t = 0; t < Y->m; t++)
+   {
+      for (int i = 0; i < q->r; i++)
+      {
+         real ll = q->logLik(Y->ptr[t], i);
+         if (!(fabs(logF(t,i) - ll) <= CHECK_TOL*(1.0 + fabs(ll))))
+            bad++;
+      }
+   }
+
+   return bad;
+}
+
+int main(int argc, char *argv[])
+{
+   IMat Y(CHECK_T, CHECK_D), W(CHECK_T, CHECK_D+1), logF;
+   int t, j;
+
+   for (t = 0; t < CHECK_T; t++)
+   {
+      for (j = 0; j < CHECK_D; j++)
+         Y(t,j) = (CHECK_R - 1.0)*((t*7 + j*3) % CHECK_T)/(CHECK_T - 1.0);
+      for (j = 0; j <= CHECK_D; j++)
+         W(t,j) = 0.0;
+   }
+
+   // log domain, likelihoods far below exp() range
+   QuadClassifier big(-2000.0);
+   big.log_domain = true;
+   int badLog = countBad(&big, &Y);
+
+   // plain, likelihoods in range
+   QuadClassifier small(-5.0);
+   small.log_domain = false;
+   int badPlain = countBad(&small, &Y);
+
+   // wrong width
+   int width = big.LogLikBlock(&W, &logF);
+
+   printf("log domain mismatches: %d\n", badLog);
+   printf("plain mismatches: %d\n", badPlain);
+   printf("wrong width block: %s\n", width == -1 ? "rejected" : "accepted");
+
+   return (badLog || badPlain || width != -1) ? 1 : 0;
+}
@@ -66,6 +66,7 @@
 #include <string>
 #include <math.h>
 #include <deque>
+#include <vector>
 
 //defines
 #define PI 3.14159
@@ -111,7 +112,7 @@ public:
 
 };
 
-class DataBuffer : public deque<double> {
+class DataBuffer : public vector<double> {
 
 private:
 
@@ -190,12 +191,14 @@ protected:
 
 	//data
 	DataBuffer buf;				//main data buffer
+	vector<double> signal;		//samples taken from buf on each update
 	deque<Bottle> activeSig;	//current active signal
 	deque<Bottle> fecSig;		//keeps a small amount of old data for front-end clipping protection
 	int status;
 
 	//processing
 	MFCCProcessor * M;			//mfcc processor
+	double * mTemp; 			//mfcc holder for the current frame
 	double alpha;				//exp filter coeff
 	double energy;				//energy value
 	double baseline;			//noise/silence baseline value
@@ -260,6 +263,7 @@ public:
 
 		//set up mfcc processor
 		M = new MFCCProcessor(d+1, w, frameSize, overlap, sampleRate, 0.0, (double)(sampleRate/2.0), true);
+		mTemp = new double[d+1];
 
 		//vad stuff
 		energy = 0.0;
@@ -285,6 +289,8 @@ public:
 		inPort->close();
 		outPort->close();
 
+		delete [] mTemp;
+
 		return true;
 
 	}
@@ -297,30 +303,23 @@ public:
 
 	virtual bool   updateModule() {
 
-		//every time we update, load in all new samples
-		if (buf.size() > 0) {
-			buf.lock();
-			double * signal = new double[buf.size()];
-			int inc = 0;
-			while (buf.size() > 0) {
-				signal[inc] = buf.front();
-				buf.pop_front();
-				inc++;
-			}
-			buf.unlock();
-			M->pushData(signal,inc);
+		//every time we update, load in all new samples (swap out the
+		//whole buffer, so the port can keep filling it)
+		buf.lock();
+		buf.swap(signal);
+		buf.unlock();
+		if (signal.size() > 0) {
+			M->pushData(&signal[0],signal.size());
+			signal.clear();
 		}
 
 		//process as many samples as are available
-		double * mTemp; 	//temp mfcc holder
-
 		while(M->getMFCCs(mTemp)) {
 
 			//grab 0th mfcc, pad/get baseline if first sample
 			if (bCounter > 0) {
 				baseline += mTemp[0]/PFRAMES;
 				bCounter--;
-				delete mTemp;
 				break;
 			}
 
@@ -397,8 +396,6 @@ public:
 				}
 			}
 
-			delete mTemp;
-
 		}
 
 		return true;
@@ -49,10 +49,15 @@
 	updateobs	--  0 to turn of observation dist updating after init (D 1)
 	dt		--  sampling rate, used for scaling derivs in generation (D 0.01)
 	scale	--  scaling coeff to apply to each dimension. can be single or vector valued
+	single	--  flag to score sequences with float32 emission evaluation (O)
 
 	[parameters for discrete dists]
 	lefttoright	--  left-to-right model flag (O)
 
+	[offline training]
+	featfile	--  feature store (from mfccExtract) to train on before going online (O, continuous only)
+	emIters	--  batch EM iterations per element after the pass over featfile (O, D 0 (none))
+
 	[module parameters]
 	input	-- input port name (O, D /lex:i)
 	output	-- output port name (O, D /lex:o)
@@ -60,6 +65,10 @@
 	gen		-- generated element output port (O, D /lex:g)
 	rpc		-- rpc port name (O, D /lex/rpc)
 
+	[snapshots]
+	snapshot	--  binary snapshot file of the whole lexicon. restored at startup if it exists, written at shutdown (O)
+	snapperiod	--  seconds between automatic snapshots to that file, 0 for none (O, D 0)
+
  *
  * PORTS:
  *	Inputs: /pc/words   	(Bottle of bottles/ints. Corresponding to continuous or discrete sequences)
@@ -67,6 +76,7 @@
  *	Outputs: /lex/class		(Bottle of with one int, corresponding to classification of the sequence)
  *	Outputs: /lex/gen		(Bottle of either ints or more bottles. generated sample from HMM encoding)
  *	RPC: /lex/rpc			(RPC communication port to interact with the running module)
+ *							 "snapshot <file>" / "restore <file>" write/load a binary snapshot
  */
 
 //yarp network
@@ -88,6 +98,7 @@
 #include "../lexicon/SequenceLearner.h"
 #include "../lexicon/SequenceLearnerCont.h"
 #include "../lexicon/SequenceLearnerDisc.h"
+#include "../speech/featstore.h"
 
 //misc
 #include <string>
@@ -114,6 +125,7 @@ protected:
 	SequenceLearner * S;
 	SequenceLearnerCont * C;
 	SequenceLearnerDisc * D;
+	Semaphore * mutex;
 	BufferedPort<Bottle> * inPort;
 	Port *outPort;
 	Port * generated;
@@ -126,8 +138,8 @@ public:
 
 
 	LexiconThread(SequenceLearner *& S_, SequenceLearnerCont *& C_, SequenceLearnerDisc *& D_,
-			string recvPort_, string sendPort_, string genPort_)
-	: S(S_), C(C_), D(D_), recvPort(recvPort_), sendPort(sendPort_), genPort(genPort_) {
+			Semaphore * mutex_, string recvPort_, string sendPort_, string genPort_)
+	: S(S_), C(C_), D(D_), mutex(mutex_), recvPort(recvPort_), sendPort(sendPort_), genPort(genPort_) {
 
 		//and the ports
 		inPort = new BufferedPort<Bottle>;
@@ -168,9 +180,11 @@ public:
 
 		if (S->getType()) {
 
-			//continuous
+			//continuous (the models can't change underneath the generator)
 			IMat data;
+			mutex->wait();
 			gresult = S->generateSequence(data, n, scale);
+			mutex->post();
 			for (int i = 0; i < data.m; i++) {
 				Bottle & samp = gendSequence.addList();
 				for (int j = 0; j < data.n; j++) {
@@ -210,6 +224,9 @@ public:
 
 				printf("sequence received,... ");
 
+				//models can't be snapshotted/restored while training
+				mutex->wait();
+
 				int nprev = S->nInitialized;
 
 				//continuous
@@ -252,6 +269,8 @@ public:
 
 				}
 
+				mutex->post();
+
 				//report result to console (but don't gum it up)
 				if (nprev < S->nInitialized) {
 					printf("new element %d initialized, trained log likelihood: ",lex);
@@ -345,14 +364,23 @@ protected:
 	int scm;		//scaling mode (-1 single coeff, 0 off, 1 vector)
 	double scs;		//single scaling coeff
 	IVec scv;		//scaling vector
+	bool single;	//float32 scoring
 
 	//parameters to use a LR model (different behavior for disc. and cont.)
 	bool lr;		//left-to-right model flag (O)
 
+	//offline training
+	int emIters;	//batch EM iterations after training on a feature store (O, D 0)
+
 	//logging
 	bool save;
 	string logname;
 
+	//snapshots
+	string snapName;
+	double snapPeriod;
+	double lastSnap;
+
 	/* actual data: ports, objects, etc... */
 	SequenceLearner * S;
 	SequenceLearnerCont * C;
@@ -365,6 +393,7 @@ protected:
 	LexiconThread * L;
 	GenReqPort * greqPort;
 	Port rpcPort;
+	Semaphore * mutex;
 
 
 public:
@@ -422,6 +451,7 @@ public:
 				alpha = rf.check("alpha",Value(0.0),"cov. lower bound").asDouble();
 				xi = rf.check("xi",Value(1.0e+300),"cov. upper bound").asDouble();
 			}
+			single = rf.check("single");
 			if ((bool)rf.check("updateobs",Value(1)).asInt()) {
 				upobs = true;
 			} else {
@@ -463,6 +493,9 @@ public:
 		prior = rf.check("prior",Value(0.0001),"min values for parameters").asDouble();
 		eps = rf.check("eps",Value(0.001),"learning rate").asDouble();
 		decay = rf.check("decay",Value(1.0),"learning rate decay value (0.0-1.0)").asDouble();
+		emIters = rf.check("emIters",Value(0),"batch EM iterations after featfile training").asInt();
+		snapName = rf.check("snapshot",Value(""),"snapshot file").asString().c_str();
+		snapPeriod = rf.check("snapperiod",Value(0.0),"seconds between snapshots").asDouble();
 
 		return true;
 
@@ -533,6 +566,19 @@ public:
 				}
 			}
 		}
+		//binary snapshots of the whole lexicon
+		else if (msg == "snapshot" || msg == "restore") {
+			if (command.size() < 2) {
+				reply.add(-1);
+			}
+			else {
+				string fname(command.get(1).asString().c_str());
+				mutex->wait();
+				bool ok = (msg == "snapshot") ? S->snapshot(fname.c_str()) : S->restore(fname.c_str());
+				mutex->post();
+				reply.add(ok ? 1 : -1);
+			}
+		}
 		//allow certain running parameters to be set here
 		else if (msg == "set") {
 
@@ -616,6 +662,89 @@ public:
 
 	}
 
+	//train (and classify) every sequence in a feature store, in order. with
+	//emIters set, each element is then refined by batch EM
+	bool trainFromStore(const char * fileName) {
+
+		FeatureStore fs;
+		if (!fs.open(fileName)) {
+			printf("could not open feature store %s\n", fileName);
+			return false;
+		}
+		if (fs.getDim() < d) {
+			printf("feature store has dimension %d, model needs %d\n", fs.getDim(), d);
+			return false;
+		}
+
+		//scaled copies are kept around for the batch EM pass
+		vector<IMat *> seqs;
+
+		for (int k = 0; k < fs.size(); k++) {
+
+			int z = fs.length(k);
+			if (z == 0) {
+				continue;
+			}
+
+			//copy out (scaling is done in place, and the store is read only)
+			IMat * data = new IMat(z, d);
+			real ** samplesC = new real * [z];
+			for (int i = 0; i < z; i++) {
+				const double * f = fs.frames(k) + i*fs.getDim();
+				for (int j = 0; j < d; j++) {
+					(*data)(i,j) = f[j];
+				}
+				samplesC[i] = data->ptr[i];
+			}
+
+			int nprev = S->nInitialized;
+			C->scale(samplesC, z);
+			int lex = S->train(samplesC, z);
+			double val = S->evaluate(samplesC, z, lex);
+
+			printf("%s: %s %d, log likelihood %f\n", fs.name(k),
+					(nprev < S->nInitialized) ? "new element" : "classified as", lex, val);
+
+			delete [] samplesC;
+
+			if (emIters > 0) {
+				seqs.push_back(data);
+			} else {
+				delete data;
+			}
+
+		}
+
+		//refine each element with batch EM on the sequences it now wins
+		if (emIters > 0 && S->nInitialized > 0) {
+
+			vector< vector<IMat *> > groups(S->nInitialized);
+			for (unsigned int k = 0; k < seqs.size(); k++) {
+				int lex = S->classify(seqs[k]->ptr, seqs[k]->m);
+				if (lex >= 0) {
+					groups[lex].push_back(seqs[k]);
+				}
+			}
+
+			for (int n = 0; n < S->nInitialized; n++) {
+				if (groups[n].empty()) {
+					continue;
+				}
+				double val = C->trainBatch(groups[n], n, emIters);
+				printf("element %d: batch EM on %d sequences, log likelihood %f per frame\n",
+						n, (int)groups[n].size(), val);
+			}
+
+		}
+
+		for (unsigned int k = 0; k < seqs.size(); k++) {
+			delete seqs[k];
+		}
+
+		return true;
+
+	}
+
 	virtual bool configure(ResourceFinder &rf) {
 
 		//load the model parameters in
@@ -637,6 +766,7 @@ public:
 			}
 			S->upobs = upobs;
 			C->setScaling(scm, scs, &scv);
+			C->setSinglePrecision(single);
 			D = NULL;
 
 		} else {
@@ -649,12 +779,37 @@ public:
 
 		}
 
+		//pick up where the last run left off
+		if (snapName != "") {
+			FILE * fp = fopen(snapName.c_str(), "rb");
+			if (fp != NULL) {
+				fclose(fp);
+				if (!S->restore(snapName.c_str())) {
+					return false;
+				}
+				printf("restored %d elements from %s\n", S->nInitialized, snapName.c_str());
+			}
+		}
+		lastSnap = Time::now();
+
+		//train on a stored corpus first, if given
+		if (rf.check("featfile")) {
+			if (!mode) {
+				printf("featfile only works with continuous models, ignoring\n");
+			} else if (!trainFromStore(rf.find("featfile").asString().c_str())) {
+				return false;
+			}
+		}
+
+		//the rpc handlers take the mutex, so it has to exist before they can run
+		mutex = new Semaphore;
+
 		//set up the rpc/observer port
 		rpcPort.open(rpcName.c_str());
 		attach(rpcPort);
 
 		//pass everything off to the execution thread
-		L = new LexiconThread(S, C, D, recvPort, sendPort, genPort);
+		L = new LexiconThread(S, C, D, mutex, recvPort, sendPort, genPort);
 
 
 		//set up the request port
@@ -668,19 +823,46 @@ public:
 
 	virtual bool close() {
 
+		//stop the rpc and request handlers first, they use L, S and the mutex
+		rpcPort.interrupt();
+		rpcPort.close();
+		greqPort->interrupt();
+		greqPort->close();
+
+		L->stop();
+		mutex->wait();
 		if (save) {
 			S->printToFile(logname);
 		}
-		L->stop();
+		if (snapName != "" && !S->snapshot(snapName.c_str())) {
+			printf("could not write snapshot %s\n", snapName.c_str());
+		}
+		mutex->post();
+		delete greqPort;
 		delete L;
 		delete S;
+		delete mutex;
 
 		return true;
 
 	}
 
 	virtual double getPeriod() { return 1.0; }
-	virtual bool updateModule() { return true; }
+	virtual bool updateModule() {
+
+		//periodic snapshot, so a crash loses at most snapperiod seconds of learning
+		if (snapName != "" && snapPeriod > 0.0 && Time::now() - lastSnap >= snapPeriod) {
+			mutex->wait();
+			if (!S->snapshot(snapName.c_str())) {
+				printf("could not write snapshot %s\n", snapName.c_str());
+			}
+			mutex->post();
+			lastSnap = Time::now();
+		}
+
+		return true;
+
+	}
 
 };
 
@@ -33,6 +33,10 @@
  *	ufile		-- U matrices ''	''
  *	nphones		-- number of classes
  *	ncoeffs		-- obs. dimensionality
+ *	datafile	-- csv of feature samples to initialize/train from (if no parameter files)
+ *	featfile	-- feature store (from mfccExtract) to initialize/train from, instead of datafile
+ *	evalfeat	-- feature store to classify after setup; state sequences are printed
+ *				   (feature stores must have at least the model's dimension)
  *
  * PORTS:
  *	Inputs: /vad/words   	(Bottle of bottles. Each individual bottle a feature sample)
@@ -56,6 +60,7 @@
 #include "../RMLE/StochasticClassifier.hh"
 #include "../RMLE/Gaussian.hh"
 #include "../imatlib/IMatVecOps.hh"
+#include "../speech/featstore.h"
 
 //misc
 #undef min
@@ -76,6 +81,7 @@ using namespace yarp::math;
 
 void dumbCSVReader(const char *, IMat &, int, int);
 void dumbCSVWriter(const char *, IMat &);
+bool featStoreReader(const char *, IMat &, int);
 
 class PhonePort : public BufferedPort<Bottle> {
 
@@ -90,6 +96,10 @@ protected:
 	Port * oPort;
 	Port * mPort; //input mirror port
 
+	//sequence buffers (reused between reads)
+	IMat seqData;
+	IMat seqPost;
+
 	//verbosity
 	bool debug;
 
@@ -120,20 +130,33 @@ public:
 			printf("Received sequence, length %d for classification\n", b.size());
 		}
 
+		//unpack the sequence (seqData is reused, so short items must not
+		//pick up the last sequence's values)
+		seqData.reshape(b.size(), obs_dist->d);
+		seqData.zero();
 		for (int i = 0; i < b.size(); i++) {
-
-			//unpack the sequence
 			Bottle *item = b.get(i).asList();
-			real *sample = new real[item->size()];
-			for (int j = 0; j < item->size(); j++) {
-				sample[j] = item->get(j).asDouble();
+			for (int j = 0; j < item->size() && j < obs_dist->d; j++) {
+				seqData(i,j) = item->get(j).asDouble();
 				if (debug) {
-					printf("%f,",sample[j]);
+					printf("%f,",seqData(i,j));
 				}
 			}
+		}
+
+		//classify the whole sequence in one block
+		if (p->ClassifyBlock(&seqData, &seqPost) < 0) {
+			printf("Phoneme stream could not be produced. Sequence rejected by the classifier\n");
+			return;
+		}
+
+		for (int i = 0; i < b.size(); i++) {
 
 			//make the classification
-			int state = p->Classify(sample);
+			int state;
+			IVec post;
+			seqPost.getRow(i, &post);
+			post.vmax(&state);
 
 			//fill a new bottle with the sequence
 			seqClass.add(state);
@@ -149,8 +172,6 @@ public:
 				printf("%d\n",state);
 			}
 
-			delete sample;
-
 		}
 
 		//pass along the timestamp
@@ -213,6 +234,7 @@ protected:
 	Value mufile;
 	Value ufile;
 	Value datafile;
+	Value featfile;
 
 	//classifier things
 	int r;	//number of classifier states
@@ -289,15 +311,23 @@ public:
 		mufile = rf.find("mufile");
 		ufile = rf.find("ufile");
 		datafile = rf.find("datafile");
+		featfile = rf.find("featfile");
 		if (afile.isNull() || mufile.isNull() || ufile.isNull()) {
-			if (datafile.isNull()) {
+			if (datafile.isNull() && featfile.isNull()) {
 				printf("You must specify parameter files for A, MU, and U, or a data file for initialization\n");
 				return false;
 			} else {
 
-				printf("initializing from data file...\n");
-				//initialize from data file
-				dumbCSVReader(datafile.asString().c_str(), initData, 0, d);
+				//initialize from feature store or data file
+				if (!featfile.isNull()) {
+					printf("initializing from feature store...\n");
+					if (!featStoreReader(featfile.asString().c_str(), initData, d)) {
+						return false;
+					}
+				} else {
+					printf("initializing from data file...\n");
+					dumbCSVReader(datafile.asString().c_str(), initData, 0, d);
+				}
 				//printf("with %d samples...\n",initData.m);
 
 				//init obs
@@ -359,6 +389,11 @@ public:
 
 		}
 
+		//classify a stored corpus, if asked
+		if (rf.check("evalfeat") && !evalFeatStore(rf.find("evalfeat").asString().c_str())) {
+			return false;
+		}
+
 		//create and open ports
 		oPort = new Port;
 		oPort->open(sendPort.c_str());
@@ -382,6 +417,53 @@ public:
 		return true;
 	}
 
+	//classify every sequence in a feature store, print the state sequences
+	bool evalFeatStore(const char * fileName) {
+
+		FeatureStore fs;
+		if (!fs.open(fileName)) {
+			printf("could not open feature store %s\n", fileName);
+			return false;
+		}
+		if (fs.getDim() < d) {
+			printf("feature store has dimension %d, model needs %d\n", fs.getDim(), d);
+			return false;
+		}
+
+		IMat seq, post;
+		for (int k = 0; k < fs.size(); k++) {
+
+			//copy in, at the classifier's dimension
+			const double * f = fs.frames(k);
+			seq.reshape(fs.length(k), d);
+			for (int i = 0; i < fs.length(k); i++) {
+				for (int j = 0; j < d; j++) {
+					seq.ptr[i][j] = f[i*fs.getDim()+j];
+				}
+			}
+
+			p->prob->fill(1.0/(real)p->r);
+			if (p->ClassifyBlock(&seq, &post) < 0) {
+				printf("%s: rejected by the classifier\n", fs.name(k));
+				continue;
+			}
+
+			printf("%s:", fs.name(k));
+			for (int i = 0; i < post.m; i++) {
+				int state;
+				IVec pr;
+				post.getRow(i, &pr);
+				pr.vmax(&state);
+				printf(" %d", state);
+			}
+			printf("\n");
+
+		}
+
+		return true;
+
+	}
+
 	virtual bool close() {
 
 		iPort->close();
@@ -469,3 +551,41 @@ void dumbCSVWriter(const char * fileName, IMat &tM) {
 	fclose(fp);
 
 }
+
+/* featStoreReader - load every frame of a feature store into one matrix
+ * (one frame per row, the first width dimensions of each frame)
+ */
+bool featStoreReader(const char * fileName, IMat &tM, int width) {
+
+	FeatureStore fs;
+	if (!fs.open(fileName)) {
+		printf("could not open feature store %s\n", fileName);
+		return false;
+	}
+	if (fs.getDim() < width) {
+		printf("feature store has dimension %d, model needs %d\n", fs.getDim(), width);
+		return false;
+	}
+
+	int z = 0;
+	for (int k = 0; k < fs.size(); k++) {
+		z += fs.length(k);
+	}
+
+	tM.resize(z,width);
+
+	int row = 0;
+	for (int k = 0; k < fs.size(); k++) {
+		const double * f = fs.frames(k);
+		for (int i = 0; i < fs.length(k); i++, row++) {
+			for (int j = 0; j < width; j++) {
+				tM.ptr[row][j] = f[i*fs.getDim()+j];
+			}
+		}
+	}
+
+	printf("read %d sequences, %d samples from %s\n", fs.size(), z, fileName);
+
+	return true;
+
+}
@@ -0,0 +1,92 @@
+/**
+ * @file   IAlloc.cc
+ *
+ * @brief  Aligned, geometrically growing storage for IMat and IVec
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "IAlloc.hh"
+
+/** 
+ * Allocate an aligned block of memory.  The block is retained by
+ * allocator, so it can be released with allocator->free() and is
+ * freed along with the object that owns allocator.
+ *
+ * Do not use allocator->realloc() on the block; that does not keep
+ * the alignment.  Use IAlignedGrow() instead.
+ * 
+ * @param allocator allocator that will own the block
+ * @param size size in bytes
+ * 
+ * @return the block, or NULL if size is 0 or allocation failed
+ */
+
+void *IAlignedAlloc(Allocator *allocator, size_t size)
+{
+   void *ptr = NULL;
+
+   if (size == 0)
+      return NULL;
+
+   if (posix_memalign(&ptr, IMAT_ALIGN, size) != 0)
+      return NULL;
+
+   allocator->retain(ptr);
+
+   return ptr;
+}
+
+/** 
+ * Grow a block allocated with IAlignedAlloc().  A new block is
+ * allocated, the first keep bytes are copied to it, and the old
+ * block is freed.  On failure, the old block is left alone.
+ * 
+ * @param allocator allocator that owns ptr
+ * @param ptr block to grow (may be NULL)
+ * @param keep number of bytes to preserve
+ * @param size new size in bytes
+ * 
+ * @return the new block, or NULL on failure
+ */
+
+void *IAlignedGrow(Allocator *allocator, void *ptr, size_t keep, size_t size)
+{
+   void *new_ptr = IAlignedAlloc(allocator, size);
+
+   if (new_ptr == NULL)
+      return NULL;
+
+   if (ptr != NULL)
+   {
+      if (keep > size)
+         keep = size;
+
+      if (keep > 0)
+         memcpy(new_ptr, ptr, keep);
+
+      allocator->free(ptr);
+   }
+
+   return new_ptr;
+}
+
+/** 
+ * Capacity to allocate when storage of capacity cur has to hold at
+ * least need elements: need, or twice cur if that is bigger.
+ * 
+ * @param cur current capacity
+ * @param need required capacity
+ * 
+ * @return new capacity
+ */
+
+int IGrowSize(int cur, int need)
+{
+   if (need < 2*cur)
+      return 2*cur;
+
+   return need;
+}
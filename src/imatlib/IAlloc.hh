@@ -0,0 +1,47 @@
+/**
+ * @file   IAlloc.hh
+ *
+ * @brief  Aligned, geometrically growing storage for IMat and IVec
+ *
+ * Storage for matrices and vectors is allocated aligned to
+ * IMAT_ALIGN bytes, so that the start of the data is suitable for
+ * SIMD loads and for the BLAS.  The blocks are handed to the owning
+ * object's Torch Allocator with retain(), so they are freed with the
+ * object as before.
+ *
+ * When a matrix or vector grows (addRow(), addCol(), ins(),
+ * resize(), ...), the capacity is at least doubled, so that growing
+ * one row or element at a time costs amortized constant time per
+ * element instead of a reallocation and copy per call.
+ *
+ */
+
+#ifndef IALLOC_HH
+#define IALLOC_HH
+
+#include <stddef.h>
+
+#include <torch/general.h>
+#include <torch/Allocator.h>
+
+using namespace Torch;
+
+#define IMAT_ALIGN 64   ///< alignment (bytes) of matrix/vector storage
+
+void *IAlignedAlloc(Allocator *allocator,
+                    size_t size);            ///< allocate an aligned
+                                             ///< block owned by
+                                             ///< allocator
+
+void *IAlignedGrow(Allocator *allocator,
+                   void *ptr,
+                   size_t keep,
+                   size_t size);             ///< move the first keep
+                                             ///< bytes of ptr to a new
+                                             ///< aligned block
+
+int IGrowSize(int cur, int need);            ///< new capacity when
+                                             ///< growing from cur to
+                                             ///< at least need
+
+#endif // IALLOC_HH
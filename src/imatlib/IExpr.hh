@@ -0,0 +1,512 @@
+/**
+ * @file   IExpr.hh
+ *
+ * @brief  Expression templates for elementwise IMat/IVec arithmetic
+ *
+ * Elementwise arithmetic on IMat and IVec data can be written as an
+ * expression over views, which is evaluated in a single pass with no
+ * temporaries:
+ *
+ *    IView s(S);
+ *
+ *    s = ((n-1.0)/n)*s + (1.0/n)*IView(S_new);
+ *
+ * instead of
+ *
+ *    MatScale((n-1.0)/n, S);
+ *    MatAddScaled(1.0/n, S_new, S);
+ *
+ * The target has to be a named view: "IView(S) = ...;" would declare
+ * a new variable S.  Assigning to a view copies elements into it; a
+ * view cannot be pointed somewhere else.
+ *
+ * An IView is a non-owning view of an IMat, an IVec, a row, a column
+ * or a block of a matrix.  Vectors, rows and columns are all 1 x n
+ * views, so they can be mixed freely.  Expressions support +, - and
+ * scaling by a constant, and elementwise IMul(), IDiv(), IExp(),
+ * ILog(), ISqrt(), IAbs() and ISq().  Assigning to a view (=, +=, -=)
+ * evaluates the expression; ISum() reduces one.  If all operands are
+ * contiguous, the evaluation is a flat loop over the elements.
+ *
+ * The simplest forms are handed to BLAS level 1, which is as fast as
+ * any loop for them: copy (Y = X), scaling (Y *= a) and axpy
+ * (Y += a*X, Y -= a*X).  Anything with more than one operand is
+ * fused, which saves a full pass over memory per operation.  Matrix
+ * products should still use the IMatVecOps wrappers.
+ *
+ * Evaluation is elementwise, so the target may appear on the right
+ * hand side, as long as it is not through a transposed or shifted
+ * view of itself.
+ *
+ */
+
+#ifndef IEXPR_HH
+#define IEXPR_HH
+
+#include <math.h>
+
+#include <torch/general.h>
+
+#include "IMat.hh"
+#include "IVec.hh"
+#include "IMatVecOps.hh"
+
+using namespace Torch;
+
+/**
+ * @class IExpr
+ * @brief base class of all expressions (E is the expression type)
+ *
+ * An expression E provides rows(), cols(), contiguous(), the element
+ * operator()(i,j), and at(k), the k-th element in row-major order
+ * (only valid if contiguous() is true).
+ */
+
+template <class E>
+class IExpr
+{
+public:
+   const E &self() const { return *static_cast<const E *>(this); }
+};
+
+////////////////////
+// Views
+//////////////////////
+
+/**
+ * @class IView
+ * @brief view of matrix or vector data, usable as an expression or
+ *        as the target of one
+ */
+
+class IView : public IExpr<IView>
+{
+public:
+   real *base;          ///< first element
+   int m;               ///< rows
+   int n;               ///< columns
+   int rs;              ///< distance between rows
+   int cs;              ///< distance between columns
+
+public:
+
+   IView(real *base_, int m_, int n_, int rs_, int cs_ = 1)
+      : base(base_), m(m_), n(n_), rs(rs_), cs(cs_) {}
+
+   IView(IMat *A)                     ///< the whole matrix
+      : base(A->base), m(A->m), n(A->n), rs(A->ld), cs(1) {}
+
+   IView(IVec *v)                     ///< the vector, as 1 x n
+      : base(v->ptr), m(1), n(v->n), rs(v->n*v->stride), cs(v->stride) {}
+
+   IView(const IView &v)
+      : IExpr<IView>(), base(v.base), m(v.m), n(v.n), rs(v.rs), cs(v.cs) {}
+
+   int rows() const { return m; }
+   int cols() const { return n; }
+
+   bool contiguous() const
+   {
+      return cs == 1 && (rs == n || m == 1);
+   }
+
+   real operator()(int i, int j) const { return base[i*rs + j*cs]; }
+   real &operator()(int i, int j) { return base[i*rs + j*cs]; }
+
+   real at(int k) const { return base[k]; }
+
+   IView row(int i) const            ///< row i, as 1 x n
+   {
+      return IView(base + i*rs, 1, n, rs, cs);
+   }
+
+   IView col(int j) const            ///< column j, as 1 x m
+   {
+      return IView(base + j*cs, 1, m, rs, rs);
+   }
+
+   IView block(int i, int j, int m_, int n_) const
+   {
+      return IView(base + i*rs + j*cs, m_, n_, rs, cs);
+   }
+
+   IView t() const                   ///< transpose
+   {
+      return IView(base, n, m, cs, rs);
+   }
+
+   ////////////////////
+   // Evaluation
+   //////////////////////
+
+   IView &operator=(const IView &v);
+
+   IView &operator=(real val);
+
+   template <class E>
+   IView &operator=(const IExpr<E> &e);
+
+   template <class E>
+   IView &operator+=(const IExpr<E> &e);
+
+   template <class E>
+   IView &operator-=(const IExpr<E> &e);
+
+   IView &operator*=(real a);
+
+private:
+
+   template <class E, class Op>
+   void eval(const E &e, Op op);
+
+   bool axpy(real a, const IView &x);
+};
+
+////////////////////
+// Expression nodes
+//////////////////////
+
+/**
+ * @class IScaled
+ * @brief a*e
+ */
+
+template <class E>
+class IScaled : public IExpr<IScaled<E> >
+{
+public:
+   real a;
+   E e;
+
+   IScaled(real a_, const E &e_) : a(a_), e(e_) {}
+
+   int rows() const { return e.rows(); }
+   int cols() const { return e.cols(); }
+   bool contiguous() const { return e.contiguous(); }
+
+   real operator()(int i, int j) const { return a * e(i,j); }
+   real at(int k) const { return a * e.at(k); }
+};
+
+/**
+ * @class IBinary
+ * @brief elementwise Op(l, r)
+ */
+
+template <class L, class R, class Op>
+class IBinary : public IExpr<IBinary<L,R,Op> >
+{
+public:
+   L l;
+   R r;
+
+   IBinary(const L &l_, const R &r_) : l(l_), r(r_)
+   {
+      if (l.rows() != r.rows() || l.cols() != r.cols())
+         error("IExpr: operands are %d x %d and %d x %d\n",
+               l.rows(), l.cols(), r.rows(), r.cols());
+   }
+
+   int rows() const { return l.rows(); }
+   int cols() const { return l.cols(); }
+   bool contiguous() const { return l.contiguous() && r.contiguous(); }
+
+   real operator()(int i, int j) const { return Op::apply(l(i,j), r(i,j)); }
+   real at(int k) const { return Op::apply(l.at(k), r.at(k)); }
+};
+
+/**
+ * @class IUnary
+ * @brief elementwise Op(e)
+ */
+
+template <class E, class Op>
+class IUnary : public IExpr<IUnary<E,Op> >
+{
+public:
+   E e;
+
+   IUnary(const E &e_) : e(e_) {}
+
+   int rows() const { return e.rows(); }
+   int cols() const { return e.cols(); }
+   bool contiguous() const { return e.contiguous(); }
+
+   real operator()(int i, int j) const { return Op::apply(e(i,j)); }
+   real at(int k) const { return Op::apply(e.at(k)); }
+};
+
+// Elementwise operations
+
+struct IOpAdd  { static real apply(real x, real y) { return x + y; } };
+struct IOpSub  { static real apply(real x, real y) { return x - y; } };
+struct IOpMul  { static real apply(real x, real y) { return x * y; } };
+struct IOpDiv  { static real apply(real x, real y) { return x / y; } };
+
+struct IOpNeg  { static real apply(real x) { return -x; } };
+struct IOpExp  { static real apply(real x) { return exp(x); } };
+struct IOpLog  { static real apply(real x) { return log(x); } };
+struct IOpSqrt { static real apply(real x) { return sqrt(x); } };
+struct IOpAbs  { static real apply(real x) { return fabs(x); } };
+struct IOpSq   { static real apply(real x) { return x * x; } };
+
+// How the result is stored in the target
+
+struct IStoreSet { void operator()(real &y, real x) const { y = x; } };
+struct IStoreAdd { void operator()(real &y, real x) const { y += x; } };
+struct IStoreSub { void operator()(real &y, real x) const { y -= x; } };
+
+////////////////////
+// Operators
+//////////////////////
+
+template <class L, class R>
+inline IBinary<L,R,IOpAdd> operator+(const IExpr<L> &l, const IExpr<R> &r)
+{
+   return IBinary<L,R,IOpAdd>(l.self(), r.self());
+}
+
+template <class L, class R>
+inline IBinary<L,R,IOpSub> operator-(const IExpr<L> &l, const IExpr<R> &r)
+{
+   return IBinary<L,R,IOpSub>(l.self(), r.self());
+}
+
+template <class E>
+inline IScaled<E> operator*(real a, const IExpr<E> &e)
+{
+   return IScaled<E>(a, e.self());
+}
+
+template <class E>
+inline IScaled<E> operator*(const IExpr<E> &e, real a)
+{
+   return IScaled<E>(a, e.self());
+}
+
+template <class E>
+inline IScaled<E> operator/(const IExpr<E> &e, real a)
+{
+   return IScaled<E>(1.0/a, e.self());
+}
+
+template <class E>
+inline IUnary<E,IOpNeg> operator-(const IExpr<E> &e)
+{
+   return IUnary<E,IOpNeg>(e.self());
+}
+
+/** Elementwise product */
+template <class L, class R>
+inline IBinary<L,R,IOpMul> IMul(const IExpr<L> &l, const IExpr<R> &r)
+{
+   return IBinary<L,R,IOpMul>(l.self(), r.self());
+}
+
+/** Elementwise quotient */
+template <class L, class R>
+inline IBinary<L,R,IOpDiv> IDiv(const IExpr<L> &l, const IExpr<R> &r)
+{
+   return IBinary<L,R,IOpDiv>(l.self(), r.self());
+}
+
+template <class E>
+inline IUnary<E,IOpExp> IExp(const IExpr<E> &e) { return IUnary<E,IOpExp>(e.self()); }
+
+template <class E>
+inline IUnary<E,IOpLog> ILog(const IExpr<E> &e) { return IUnary<E,IOpLog>(e.self()); }
+
+template <class E>
+inline IUnary<E,IOpSqrt> ISqrt(const IExpr<E> &e) { return IUnary<E,IOpSqrt>(e.self()); }
+
+template <class E>
+inline IUnary<E,IOpAbs> IAbs(const IExpr<E> &e) { return IUnary<E,IOpAbs>(e.self()); }
+
+template <class E>
+inline IUnary<E,IOpSq> ISq(const IExpr<E> &e) { return IUnary<E,IOpSq>(e.self()); }
+
+/**
+ * Sum of the elements of an expression
+ *
+ * @param e expression
+ *
+ * @return the sum
+ */
+
+template <class E>
+inline real ISum(const IExpr<E> &e_)
+{
+   const E &e = e_.self();
+   int m = e.rows();
+   int n = e.cols();
+   real s = 0.0;
+
+   if (e.contiguous())
+   {
+      for (int k = 0; k < m*n; k++)
+         s += e.at(k);
+   }
+   else
+   {
+      for (int i = 0; i < m; i++)
+         for (int j = 0; j < n; j++)
+            s += e(i,j);
+   }
+
+   return s;
+}
+
+////////////////////
+// IView evaluation
+//////////////////////
+
+/**
+ * Evaluate e into this view, storing each element with op.
+ */
+
+template <class E, class Op>
+inline void IView::eval(const E &e, Op op)
+{
+   if (e.rows() != m || e.cols() != n)
+      error("IView: cannot assign a %d x %d expression to a %d x %d view\n",
+            e.rows(), e.cols(), m, n);
+
+   if (contiguous() && e.contiguous())
+   {
+      real *y = base;
+      int len = m*n;
+
+      for (int k = 0; k < len; k++)
+         op(y[k], e.at(k));
+   }
+   else
+   {
+      for (int i = 0; i < m; i++)
+      {
+         real *y = base + i*rs;
+
+         for (int j = 0; j < n; j++, y += cs)
+            op(*y, e(i,j));
+      }
+   }
+}
+
+/**
+ * y += a*x with BLAS, if both views are laid out as plain vectors.
+ *
+ * @return true if done
+ */
+
+inline bool IView::axpy(real a, const IView &x)
+{
+   if (x.m != m || x.n != n)
+      return false;
+
+   if (contiguous() && x.contiguous())
+      CBLAS(axpy)(m*n, a, x.base, 1, base, 1);
+   else if (m == 1)
+      CBLAS(axpy)(n, a, x.base, x.cs, base, cs);
+   else
+      return false;
+
+   return true;
+}
+
+inline IView &IView::operator=(const IView &v)
+{
+   if (v.m == m && v.n == n && contiguous() && v.contiguous())
+      CBLAS(copy)(m*n, v.base, 1, base, 1);
+   else if (v.m == m && v.n == n && m == 1)
+      CBLAS(copy)(n, v.base, v.cs, base, cs);
+   else
+      eval(v, IStoreSet());
+
+   return *this;
+}
+
+inline IView &IView::operator=(real val)
+{
+   for (int i = 0; i < m; i++)
+   {
+      real *y = base + i*rs;
+
+      for (int j = 0; j < n; j++, y += cs)
+         *y = val;
+   }
+
+   return *this;
+}
+
+template <class E>
+inline IView &IView::operator=(const IExpr<E> &e)
+{
+   eval(e.self(), IStoreSet());
+   return *this;
+}
+
+template <class E>
+inline IView &IView::operator+=(const IExpr<E> &e)
+{
+   eval(e.self(), IStoreAdd());
+   return *this;
+}
+
+template <class E>
+inline IView &IView::operator-=(const IExpr<E> &e)
+{
+   eval(e.self(), IStoreSub());
+   return *this;
+}
+
+/** Y += X with BLAS */
+template <>
+inline IView &IView::operator+=(const IExpr<IView> &e)
+{
+   if (!axpy(1.0, e.self()))
+      eval(e.self(), IStoreAdd());
+   return *this;
+}
+
+/** Y += a*X with BLAS */
+template <>
+inline IView &IView::operator+=(const IExpr<IScaled<IView> > &e)
+{
+   if (!axpy(e.self().a, e.self().e))
+      eval(e.self(), IStoreAdd());
+   return *this;
+}
+
+/** Y -= X with BLAS */
+template <>
+inline IView &IView::operator-=(const IExpr<IView> &e)
+{
+   if (!axpy(-1.0, e.self()))
+      eval(e.self(), IStoreSub());
+   return *this;
+}
+
+/** Y -= a*X with BLAS */
+template <>
+inline IView &IView::operator-=(const IExpr<IScaled<IView> > &e)
+{
+   if (!axpy(-e.self().a, e.self().e))
+      eval(e.self(), IStoreSub());
+   return *this;
+}
+
+inline IView &IView::operator*=(real a)
+{
+   if (contiguous())
+      CBLAS(scal)(m*n, a, base, 1);
+   else if (m == 1)
+      CBLAS(scal)(n, a, base, cs);
+   else
+   {
+      for (int i = 0; i < m; i++)
+         CBLAS(scal)(n, a, base + i*rs, cs);
+   }
+
+   return *this;
+}
+
+#endif // IEXPR_HH
@@ -82,6 +82,7 @@ static char *IMAT_CC_Id = "$Id: IMat.cc,v 1.2 2006/08/04 19:27:11 mrmcclai Exp $
 
 #include "IMat.hh"
 #include "IMatVecOps.hh"
+#include "IAlloc.hh"
 #include "gen_defines.h"
 
 ////////////////////
@@ -235,8 +236,8 @@ int IMat::init(int m_, int n_)
 
    is_alias = false;
 
-   base = (real *)allocator->alloc(sizeof(real) * m*n);
-   if (base)
+   base = (real *)IAlignedAlloc(allocator, sizeof(real) * m*n);
+   if (base || m*n == 0)
       real_size = m*n;
    else
       return -1;
@@ -250,22 +251,25 @@ int IMat::init(int m_, int n_)
 /** 
  * Fill ptr with pointers into base, for easy access.
  * 
+ * @param start first row to fill in; rows before it are assumed to
+ *              be up to date (base and ld have not changed)
  * 
  * @return 0 on success, -1 on failure
  */
 
-int IMat::fillPtr()
+int IMat::fillPtr(int start)
 {
    real *b;
    real **p;
    
    if (m > real_ptr_len)
    {
-      real **new_ptr = (real **)allocator->realloc(ptr, sizeof(real *)*m);
+      int new_len = IGrowSize(real_ptr_len, m);
+      real **new_ptr = (real **)allocator->realloc(ptr, sizeof(real *)*new_len);
       if (new_ptr)
       {
          ptr = new_ptr;
-         real_ptr_len = m;
+         real_ptr_len = new_len;
       }
       else
       {
@@ -274,10 +278,10 @@ int IMat::fillPtr()
       }
    }
    
-   b = base;
-   p = ptr;
+   b = base + start*ld;
+   p = ptr + start;
 
-   for (int i = 0; i < m; i++, b+=ld)
+   for (int i = start; i < m; i++, b+=ld)
       *p++ = b;
 
    return 0;
@@ -592,12 +596,16 @@ int IMat::reshape(int m_, int n_, bool clear)
    {
       if (!is_alias)
       {
-         new_base = (real *)allocator->realloc(base, sizeof(real) * m_*n_);
+         int new_size = IGrowSize(real_size, m_*n_);
+
+         new_base = (real *)IAlignedGrow(allocator, base, 
+                                         sizeof(real) * m*n, 
+                                         sizeof(real) * new_size);
    
          if (new_base != NULL)
          {
             base = new_base;
-            real_size = m_*n_;
+            real_size = new_size;
          }
          else
             return -1;
@@ -651,6 +659,41 @@ int IMat::resize(int m_, int n_)
    return 0;
 }
 
+/** 
+ * Make room for at least size elements, so that the matrix can grow
+ * to that size (e.g., with addRow() or appendRows()) without
+ * reallocating.  The contents and shape are not changed.
+ * 
+ * @param size number of elements to make room for
+ * 
+ * @return 0 on success, -1 on failure
+ */
+
+int IMat::reserve(int size)
+{
+   if (size <= real_size)
+      return 0;
+
+   if (is_alias)
+   {
+      error("Tried to reserve space in an aliased matrix!\n");
+      return -1;
+   }
+
+   real *new_base = (real *)IAlignedGrow(allocator, base, 
+                                         m*n*sizeof(real), 
+                                         size*sizeof(real));
+   if (new_base == NULL)
+      return -1;
+
+   base = new_base;
+   real_size = size;
+
+   fillPtr();
+
+   return 0;
+}
+
 /** 
  * Add rows to the bottom of the matrix
  * 
@@ -670,12 +713,16 @@ int IMat::addRow(unsigned int rows)
       }
 
       real *new_base;
+      int new_size = IGrowSize(real_size, (m+rows)*n);
 
-      new_base = (real *)allocator->realloc(base, (m+rows)*n*sizeof(real));
+      new_base = (real *)IAlignedGrow(allocator, base, 
+                                      m*n*sizeof(real), 
+                                      new_size*sizeof(real));
       if (new_base != NULL)
       {
          base = new_base;
-         real_size = (m+rows)*n;
+         real_size = new_size;
+         fillPtr();
       }
       else
          return -1;
@@ -684,7 +731,9 @@ int IMat::addRow(unsigned int rows)
    memset(base+m*n, 0, (n*rows)*sizeof(real));
    m+=rows;
 
-   fillPtr();
+   // only the new rows need pointers
+
+   fillPtr(m-rows);
 
    return 0;
 }
@@ -707,30 +756,43 @@ int IMat::addCol(unsigned int cols)
          return -1;
       }
 
-      real *new_base;
+      // Copy the rows straight to their new places, instead of
+      // reallocating and then moving every row again
 
-      new_base = (real *)allocator->realloc(base, m*(n+cols)*sizeof(real));
-      if (new_base != NULL)
+      int new_size = IGrowSize(real_size, m*(n+cols));
+      real *new_base = (real *)IAlignedAlloc(allocator, new_size*sizeof(real));
+
+      if (new_base == NULL)
+         return -1;
+
+      for (int i = 0; i < m; i++)
       {
-         base = new_base;
-         real_size = m*(n+cols);
-         fillPtr();
+         real *row = new_base + i*(n+cols);
+
+         memcpy(row, ptr[i], n*sizeof(real));
+         memset(row+n, 0, cols*sizeof(real));
       }
-      else
-         return -1;
-   }
 
-   for (int i = m-1; i >= 1; i--)
+      allocator->free(base);
+
+      base = new_base;
+      real_size = new_size;
+   }
+   else
    {
-      memmove(base + i*(n+cols), ptr[i], n*sizeof(real));
-      ptr[i] = base + i*(n+cols);
-      memset(ptr[i]+n, 0, cols*sizeof(real));
+      for (int i = m-1; i >= 1; i--)
+      {
+         memmove(base + i*(n+cols), ptr[i], n*sizeof(real));
+         memset(base + i*(n+cols) + n, 0, cols*sizeof(real));
+      }
+      if (base != NULL)
+         memset(base+n, 0, cols*sizeof(real));
    }
-   if (base != NULL)
-      memset(base+n, 0, cols*sizeof(real));
 
    n+=cols;
-   ld+=cols;
+   ld=n;
+
+   fillPtr();
       
    return 0;
 }
@@ -874,13 +936,17 @@ int IMat::appendRows(IMat *A,
    int copy_len = copy_rows*A->n*sizeof(real);
 
    if (m == 0 || n == 0)
-      init(copy_rows, A->n);
+   {
+      if (reshape(copy_rows, A->n) != 0)
+         return -1;
+   }
    else
    {
       if (A->n != n)               // row lengths should be the same
          return -1;
 
-      addRow(copy_rows);
+      if (addRow(copy_rows) != 0)
+         return -1;
    }
    
    memcpy(ptr[old_rows], A->ptr[start_row], copy_len);
@@ -1278,55 +1344,226 @@ int IMat::prod(IVec *out, int dim)
    return 0;
 }
 
-int IMat::sum(IVec *out, int dim, IVecInt *ind)
+////////////////////
+// Statistics helpers
+//////////////////////
+
+// Statistics over fewer elements than this are not worth threading
+
+#define IMAT_PAR_MIN   32768
+
+// Column block for column sums: each block is summed over all rows
+// by one thread, in row order, so the result does not depend on the
+// number of threads
+
+#define IMAT_COL_BLOCK 16
+
+/** 
+ * Sums of the columns of a set of rows (and optionally, sums of
+ * squared differences from mu), accumulated in row order.
+ * 
+ * @param rows pointers to the rows
+ * @param cnt number of rows
+ * @param n row length
+ * @param mu if not NULL, sum (x-mu).^2 instead of x
+ * @param out output (n elements, with stride)
+ */
+
+static void colReduce(real **rows, int cnt, int n, IVec *mu, IVec *out)
 {
-   int i;
-   
-   static IVec tmp;
+   int nb = (n + IMAT_COL_BLOCK - 1)/IMAT_COL_BLOCK;
 
-   if (dim == 1)
+#pragma omp parallel for schedule(static) if (cnt*n >= IMAT_PAR_MIN)
+   for (int b = 0; b < nb; b++)
    {
-      out->resize(n);
-      out->zero();
+      int j;
+      int j0 = b*IMAT_COL_BLOCK;
+      int len = min(IMAT_COL_BLOCK, n - j0);
+      real s[IMAT_COL_BLOCK];
+      real c[IMAT_COL_BLOCK];
 
-      if (ind)
+      for (j = 0; j < len; j++)
       {
-         for (i = 0; i < ind->n; i++)
+         s[j] = 0.0;
+         c[j] = mu ? (*mu)[j0+j] : 0.0;
+      }
+
+      if (mu)
+      {
+         for (int k = 0; k < cnt; k++)
          {
-            getRow((*ind)[i], &tmp);
-            VecAdd(&tmp,out);
+            real *x = rows[k] + j0;
+
+            for (j = 0; j < len; j++)
+            {
+               real t = x[j] - c[j];
+               s[j] += t*t;
+            }
          }
       }
       else
       {
-         for (i = 0; i < m; i++)
+         for (int k = 0; k < cnt; k++)
          {
-            getRow(i, &tmp);
-            VecAdd(&tmp,out);
+            real *x = rows[k] + j0;
+
+            for (j = 0; j < len; j++)
+               s[j] += x[j];
          }
       }
+
+      for (j = 0; j < len; j++)
+         (*out)[j0+j] = s[j];
    }
-   else
+}
+
+/** 
+ * Sums along the rows of a matrix, over all columns or a set of
+ * columns (and optionally, sums of squared differences from mu),
+ * accumulated in column order.
+ * 
+ * @param rows pointers to the rows
+ * @param m number of rows
+ * @param n row length
+ * @param ind if not NULL, the columns to sum over
+ * @param mu if not NULL, sum (x-mu).^2 instead of x
+ * @param out output (m elements, with stride)
+ */
+
+static void rowReduce(real **rows, int m, int n, IVecInt *ind, IVec *mu, IVec *out)
+{
+   int cnt = ind ? ind->n : n;
+   int *cols = ind ? ind->ptr : NULL;
+   int cs = ind ? ind->stride : 1;
+
+#pragma omp parallel for schedule(static) if (m*cnt >= IMAT_PAR_MIN)
+   for (int i = 0; i < m; i++)
    {
-      out->resize(m);
-      out->zero();
-      
-      if (ind)
+      real *x = rows[i];
+      real c = mu ? (*mu)[i] : 0.0;
+      real s = 0.0;
+
+      for (int k = 0; k < cnt; k++)
       {
-         for (i = 0; i < ind->n; i++)
+         real v = cols ? x[cols[k*cs]] : x[k];
+
+         if (mu)
          {
-            getCol((*ind)[i], &tmp);
-            VecAdd(&tmp,out);
+            real t = v - c;
+            s += t*t;
          }
+         else
+            s += v;
       }
-      else
+
+      (*out)[i] = s;
+   }
+}
+
+/** 
+ * Get pointers to the rows to use, for statistics along the columns.
+ * 
+ * @param ind the rows to use (all if NULL)
+ * @param buf space for the pointers, used if ind is not NULL
+ * 
+ * @return pointers to the rows
+ */
+
+static real **selectRows(real **ptr, IVecInt *ind, real ***buf, Allocator *allocator)
+{
+   if (ind == NULL)
+      return ptr;
+
+   *buf = (real **)allocator->alloc(sizeof(real *)*max(ind->n,1));
+
+   for (int k = 0; k < ind->n; k++)
+      (*buf)[k] = ptr[(*ind)[k]];
+
+   return *buf;
+}
+
+/** 
+ * Gather the rows (dim == 1) or columns (dim == 2) of the matrix in
+ * ind into the rows of out, and subtract mu from each.
+ * 
+ * @param mu mean to subtract
+ * @param dim 1 for rows, 2 for columns
+ * @param ind rows/columns to use (all if NULL)
+ * @param out output, one row per row/column used
+ * 
+ * @return number of rows/columns used
+ */
+
+int IMat::gatherCentered(IVec *mu, int dim, IVecInt *ind, IMat *out)
+{
+   real *c = mu->ptr;
+   int cs = mu->stride;
+
+   if (dim == 1)
+   {
+      int cnt = ind ? ind->n : m;
+
+      out->reshape(cnt, n);
+
+#pragma omp parallel for schedule(static) if (cnt*n >= IMAT_PAR_MIN)
+      for (int k = 0; k < cnt; k++)
       {
-         for (i = 0; i < n; i++)
-         {
-            getCol(i, &tmp);
-            VecAdd(&tmp,out);
-         }
+         real *x = ptr[ind ? ind->ptr[k*ind->stride] : k];
+         real *y = out->ptr[k];
+
+         for (int j = 0; j < n; j++)
+            y[j] = x[j] - c[j*cs];
+      }
+
+      return cnt;
+   }
+   else
+   {
+      int cnt = ind ? ind->n : n;
+
+      out->reshape(cnt, m);
+
+#pragma omp parallel for schedule(static) if (cnt*m >= IMAT_PAR_MIN)
+      for (int k = 0; k < cnt; k++)
+      {
+         int col = ind ? ind->ptr[k*ind->stride] : k;
+         real *y = out->ptr[k];
+
+         for (int i = 0; i < m; i++)
+            y[i] = ptr[i][col] - c[i*cs];
       }
+
+      return cnt;
+   }
+}
+
+/** 
+ * Sum along dimension dim.
+ * 
+ * @param out output
+ * @param dim 1 = sum each column over the rows, 2 = sum each row
+ *            over the columns
+ * @param ind rows (dim 1) or columns (dim 2) to sum over; all if NULL
+ * 
+ * @return 0 on success
+ */
+
+int IMat::sum(IVec *out, int dim, IVecInt *ind)
+{
+   if (dim == 1)
+   {
+      real **buf = NULL;
+      real **rows = selectRows(ptr, ind, &buf, allocator);
+
+      out->resize(n);
+      colReduce(rows, ind ? ind->n : m, n, NULL, out);
+
+      allocator->free(buf);
+   }
+   else
+   {
+      out->resize(m);
+      rowReduce(ptr, m, n, ind, NULL, out);
    }
 
    return 0;
@@ -1372,121 +1609,78 @@ int IMat::mean1(IVec *mu, int dim, IVecInt *ind)
    return 0;
 }
 
+/** 
+ * Standard deviation along dimension dim, given the mean, in one
+ * pass over the data.
+ * 
+ * @param mu mean along dim (from mean())
+ * @param sigma output
+ * @param dim 1 = std. dev. of each column, 2 = of each row
+ * @param ind rows (dim 1) or columns (dim 2) to use; all if NULL
+ * 
+ * @return 0 on success
+ */
+
 int IMat::std(IVec *mu, IVec *sigma, int dim, IVecInt *ind)
 {
-   real scale;
-   IVec vec;
-   IMat tmp;
+   real size;
 
-   sigma->resize(n);
-   
    if (dim == 1)
    {
-      int i;
-      
-      if (ind)
-      {
-         tmp.reshape(ind->n,n);
-         for (i = 0; i < ind->n; i++)
-         {
-            tmp.getRow(i, &vec);        // alias row i of tmp
-            getRow((*ind)[i], &vec, true); // copy row ind[i] of this
-                                        // matrix into row i of tmp
-            VecSub(mu, &vec);
-         }
-         
-      }
-      else
-      {
-         tmp.reshape(m,n);
-         MatCopy(this, &tmp);
-         for (i = 0; i < m; i++)
-         {
-            tmp.getRow(i, &vec);
-            VecSub(mu, &vec);
-         }
-      }
-      
-      MatDotTimes(1.0, &tmp, &tmp);
-      tmp.mean1(sigma, dim);
-      sigma->sqrt();
+      real **buf = NULL;
+      real **rows = selectRows(ptr, ind, &buf, allocator);
 
+      size = (real)(ind ? ind->n : m);
+
+      sigma->resize(n);
+      colReduce(rows, ind ? ind->n : m, n, mu, sigma);
+
+      allocator->free(buf);
    }
    else  // variance of columns
    {
-      int j;
+      size = (real)(ind ? ind->n : n);
 
-      if (ind)
-      {
-         tmp.reshape(n,ind->n);
-         for (j = 0; j < ind->n; j++)
-         {
-            tmp.getCol(j, &vec);        // alias row i of tmp
-            getCol((*ind)[j], &vec, true); // copy col ind[i] of this
-                                        // matrix into row i of tmp
-            VecSub(mu, &vec);
-         }
-         
-      }
-      else
-      {
-         tmp.reshape(m,n);
-         MatCopy(this, &tmp);
-         for (j = 0; j < m; j++)
-         {
-            tmp.getCol(j, &vec);
-            VecSub(mu, &vec);
-         }
-      }
-
-      MatDotTimes(1.0, &tmp, &tmp);
-      tmp.mean1(sigma, dim);
-      sigma->sqrt();
+      sigma->resize(m);
+      rowReduce(ptr, m, n, ind, mu, sigma);
    }
+
+   size = max(size,2);
+
+   VecScale(1.0/(size-1), sigma);
+   sigma->sqrt();
    
    return 0;
 }
 
 
+/** 
+ * Covariance along dimension dim, given the mean.  The rows/columns
+ * are gathered into a compact, centered buffer and the covariance is
+ * computed with a single rank-k update (syrk).  Only the upper
+ * triangle of Sigma is set.
+ * 
+ * @param mu mean along dim (from mean())
+ * @param Sigma output
+ * @param dim 1 = covariance of the columns, 2 = of the rows
+ * @param ind rows (dim 1) or columns (dim 2) to use; all if NULL
+ * 
+ * @return 0 on success
+ */
+
 int IMat::cov(IVec *mu, IMat *Sigma, int dim, IVecInt *ind)
 {
    real scale;
-   IVec vec;
    IMat tmp;
 
    Sigma->reshape(mu->n, mu->n);
    Sigma->zero();
    Sigma->eye();
    
+   scale = 1.0/(gatherCentered(mu, dim, ind, &tmp) - 1.0);
+
    if (dim == 1)
    {
-      int i;
-      
-      if (ind)
-      {
-         scale = 1.0/(ind->n - 1.0);
-         tmp.reshape(ind->n,n);
-         for (i = 0; i < ind->n; i++)
-         {
-            tmp.getRow(i, &vec);        // alias row i of tmp
-            getRow((*ind)[i], &vec, true); // copy row ind[i] of this
-                                        // matrix into row i of tmp
-            VecSub(mu, &vec);
-         }
-         
-      }
-      else
-      {
-         scale = 1.0/(m - 1.0);
-         tmp.reshape(m,n);
-         MatCopy(this, &tmp);
-         for (i = 0; i < m; i++)
-         {
-            tmp.getRow(i, &vec);
-            VecSub(mu, &vec);
-         }
-      }
-      
       //SymMatRankKUpdate(scale,
        //                 &tmp, CblasTrans,
       //                  0.0, Sigma);
@@ -1499,34 +1693,8 @@ int IMat::cov(IVec *mu, IMat *Sigma, int dim, IVecInt *ind)
    }
    else  // variance of columns
    {
-      int j;
-
-      if (ind)
-      {
-         scale = 1.0/(ind->n - 1.0);
-         tmp.reshape(n,ind->n);
-         for (j = 0; j < ind->n; j++)
-         {
-            tmp.getCol(j, &vec);        // alias row i of tmp
-            getCol((*ind)[j], &vec, true); // copy col ind[i] of this
-                                        // matrix into row i of tmp
-            VecSub(mu, &vec);
-         }
-         
-      }
-      else
-      {
-         scale = 1.0/(n - 1.0);
-         tmp.reshape(m,n);
-         MatCopy(this, &tmp);
-         for (j = 0; j < m; j++)
-         {
-            tmp.getCol(j, &vec);
-            VecSub(mu, &vec);
-         }
-      }
       SymMatRankKUpdate(scale,
-                        &tmp, CblasNoTrans,
+                        &tmp, CblasTrans,
                         0.0, Sigma);
 
    }
@@ -1534,85 +1702,30 @@ int IMat::cov(IVec *mu, IMat *Sigma, int dim, IVecInt *ind)
    return 0;
 }
 
+/** 
+ * Scatter matrix along dimension dim, given the mean (as cov(), but
+ * not normalized).  Only the upper triangle of scat is set.
+ * 
+ * @param mu mean along dim (from mean())
+ * @param scat output
+ * @param dim 1 = scatter of the columns, 2 = of the rows
+ * @param ind rows (dim 1) or columns (dim 2) to use; all if NULL
+ * 
+ * @return 0 on success
+ */
+
 int IMat::scatter(IVec *mu, IMat *scat, int dim, IVecInt *ind)
 {
-   real scale;
-   IVec vec;
    IMat tmp;
 
    scat->reshape(mu->n, mu->n);
    scat->zero();
-   
-   if (dim == 1)
-   {
-      int i;
-      
-      if (ind)
-      {
-         scale = 1.0/(ind->n - 1.0);
-         tmp.reshape(ind->n,n);
-         for (i = 0; i < ind->n; i++)
-         {
-            tmp.getRow(i, &vec);        // alias row i of tmp
-            getRow((*ind)[i], &vec, true); // copy row ind[i] of this
-                                        // matrix into row i of tmp
-            VecSub(mu, &vec);
-         }
-         
-      }
-      else
-      {
-         scale = 1.0/(m - 1.0);
-         tmp.reshape(m,n);
-         MatCopy(this, &tmp);
-         for (i = 0; i < m; i++)
-         {
-            tmp.getRow(i, &vec);
-            VecSub(mu, &vec);
-         }
-      }
-      
-      for (i = 0; i < tmp.m; i++)
-      {
-         tmp.getRow(i, &vec);
-         SymMatRankUpdate(1.0, &vec, scat);
-      }
-   }
-   else  // scatter of columns
-   {
-      int j;
 
-      if (ind)
-      {
-         scale = 1.0/(ind->n - 1.0);
-         tmp.reshape(n,ind->n);
-         for (j = 0; j < ind->n; j++)
-         {
-            tmp.getCol(j, &vec);        // alias row i of tmp
-            getCol((*ind)[j], &vec, true); // copy col ind[i] of this
-                                        // matrix into row i of tmp
-            VecSub(mu, &vec);
-         }
-         
-      }
-      else
-      {
-         scale = 1.0/(n - 1.0);
-         tmp.reshape(m,n);
-         MatCopy(this, &tmp);
-         for (j = 0; j < m; j++)
-         {
-            tmp.getCol(j, &vec);
-            VecSub(mu, &vec);
-         }
-      }
+   gatherCentered(mu, dim, ind, &tmp);
 
-      for (j = 0; j < tmp.m; j++)
-      {
-         tmp.getCol(j, &vec);
-         SymMatRankUpdate(1.0, &vec, scat);
-      }
-   }
+   SymMatRankKUpdate(1.0,
+                     &tmp, CblasTrans,
+                     0.0, scat);
    
    return 0;
 }
@@ -95,6 +95,7 @@ public:
    bool is_alias;       ///< if true, this matrix is an alias
 
    int real_size;       ///< the real size of the allocated/alias space
+                        ///< (capacity; grows geometrically, see IAlloc.hh)
    int real_ptr_len;    ///< the real length allocated for ptr
 
 public:
@@ -129,8 +130,14 @@ private:
    int init(int m_, int n_);                 ///< initialize with m_
                                              ///< rows, n_ columns
 
-   int fillPtr();                           ///< fill ptr with values
+   int fillPtr(int start = 0);               ///< fill ptr with values
                                              ///< to access array
+
+   int gatherCentered(IVec *mu,
+                      int dim,
+                      IVecInt *ind,
+                      IMat *out);            ///< out = selected
+                                             ///< rows/cols minus mu
 public:
 
    int set(real *base_, 
@@ -187,6 +194,10 @@ public:
 
    int resize(int m_, int n_);               ///< resize this matrix, adding or
                                              ///< removing rows/cols as necessary
+
+   int reserve(int size);                    ///< make room for size
+                                             ///< elements without
+                                             ///< changing the shape
    
    int addRow(unsigned int rows = 1);        ///< add rows to the matrix
    int addCol(unsigned int cols = 1);        ///< add cols to the matrix
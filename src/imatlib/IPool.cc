@@ -0,0 +1,163 @@
+/**
+ * @file   IPool.cc
+ *
+ * @brief  Pool of reusable temporary matrices and vectors
+ *
+ */
+
+#include <string.h>
+
+#include "IPool.hh"
+#include "IAlloc.hh"
+
+/** 
+ * Constructor
+ * 
+ */
+
+IPool::IPool():
+      mats(NULL),
+      n_mats(0),
+      used_mats(0),
+      vecs(NULL),
+      n_vecs(0),
+      used_vecs(0)
+{
+}
+
+/** 
+ * Destructor.  Any matrices or vectors still in use become invalid.
+ * 
+ */
+
+IPool::~IPool()
+{
+   int i;
+
+   for (i = 0; i < n_mats; i++)
+      delete mats[i];
+
+   for (i = 0; i < n_vecs; i++)
+      delete vecs[i];
+
+   delete[] mats;
+   delete[] vecs;
+}
+
+/** 
+ * Get a matrix from the pool.  Its contents are undefined.
+ * 
+ * @param m rows
+ * @param n cols
+ * 
+ * @return the matrix (valid until it is released), or NULL on failure
+ */
+
+IMat *IPool::getMat(int m, int n)
+{
+   if (used_mats == n_mats)
+   {
+      int new_len = IGrowSize(n_mats, n_mats+1);
+      IMat **new_mats = new IMat*[new_len];
+
+      if (n_mats > 0)
+         memcpy(new_mats, mats, n_mats*sizeof(IMat *));
+
+      for (int i = n_mats; i < new_len; i++)
+         new_mats[i] = new IMat();
+
+      delete[] mats;
+
+      mats = new_mats;
+      n_mats = new_len;
+   }
+
+   IMat *A = mats[used_mats];
+
+   if (A->reshape(m,n) != 0)
+      return NULL;
+
+   used_mats++;
+
+   return A;
+}
+
+/** 
+ * Get a vector from the pool.  Its contents are undefined.
+ * 
+ * @param n vector length
+ * 
+ * @return the vector (valid until it is released), or NULL on failure
+ */
+
+IVec *IPool::getVec(int n)
+{
+   if (used_vecs == n_vecs)
+   {
+      int new_len = IGrowSize(n_vecs, n_vecs+1);
+      IVec **new_vecs = new IVec*[new_len];
+
+      if (n_vecs > 0)
+         memcpy(new_vecs, vecs, n_vecs*sizeof(IVec *));
+
+      for (int i = n_vecs; i < new_len; i++)
+         new_vecs[i] = new IVec();
+
+      delete[] vecs;
+
+      vecs = new_vecs;
+      n_vecs = new_len;
+   }
+
+   IVec *v = vecs[used_vecs];
+
+   if (v->resize(n) != 0)
+      return NULL;
+
+   used_vecs++;
+
+   return v;
+}
+
+/** 
+ * Current position in the pool, for release().
+ * 
+ * @return the mark
+ */
+
+IPoolMark IPool::mark()
+{
+   IPoolMark mk;
+
+   mk.mats = used_mats;
+   mk.vecs = used_vecs;
+
+   return mk;
+}
+
+/** 
+ * Give back all matrices and vectors taken since mk was made.  They
+ * keep their storage for the next user.
+ * 
+ * @param mk mark from mark()
+ */
+
+void IPool::release(IPoolMark mk)
+{
+   if (mk.mats < used_mats)
+      used_mats = mk.mats;
+
+   if (mk.vecs < used_vecs)
+      used_vecs = mk.vecs;
+}
+
+/** 
+ * Give back all matrices and vectors.
+ * 
+ */
+
+void IPool::releaseAll()
+{
+   used_mats = 0;
+   used_vecs = 0;
+}
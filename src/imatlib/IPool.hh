@@ -0,0 +1,83 @@
+/**
+ * @file   IPool.hh
+ *
+ * @brief  Pool of reusable temporary matrices and vectors
+ *
+ * Code that needs a few scratch matrices or vectors on every call
+ * (per frame, per sequence, ...) would otherwise allocate and free
+ * them each time.  An IPool hands out IMat and IVec objects in stack
+ * order and keeps them, with their storage, when they are released,
+ * so after the first few calls no memory is allocated at all.
+ *
+ * Usage:
+ *
+ *    IPoolMark mk = pool.mark();
+ *    IVec *v = pool.getVec(n);
+ *    IMat *A = pool.getMat(m, n);
+ *    ...
+ *    pool.release(mk);          // v and A go back to the pool
+ *
+ * The contents of a matrix or vector from the pool are undefined.
+ * Objects from the pool must not be deleted, and must not be turned
+ * into aliases with set().  A pool is not thread safe; use one pool
+ * per thread.
+ *
+ */
+
+#ifndef IPOOL_HH
+#define IPOOL_HH
+
+#include <torch/general.h>
+
+#include "IMat.hh"
+#include "IVec.hh"
+
+using namespace Torch;
+
+/**
+ * Position in an IPool, from IPool::mark()
+ */
+
+struct IPoolMark
+{
+   int mats;            ///< matrices in use
+   int vecs;            ///< vectors in use
+};
+
+/**
+ * @class IPool
+ * @brief stack of reusable temporary matrices and vectors
+ *
+ */
+
+class IPool
+{
+private:
+   IMat **mats;         ///< all matrices owned by the pool
+   int n_mats;          ///< number of matrices owned
+   int used_mats;       ///< number of matrices handed out
+
+   IVec **vecs;         ///< all vectors owned by the pool
+   int n_vecs;          ///< number of vectors owned
+   int used_vecs;       ///< number of vectors handed out
+
+public:
+
+   IPool();                             ///< Empty pool
+
+   ~IPool();                            ///< Destructor; frees all
+                                        ///< matrices and vectors
+
+   IMat *getMat(int m, int n);          ///< get an m by n matrix
+
+   IVec *getVec(int n);                 ///< get an n length vector
+
+   IPoolMark mark();                    ///< current position
+
+   void release(IPoolMark mk);          ///< give back everything
+                                        ///< taken since mark mk
+
+   void releaseAll();                   ///< give back everything
+};
+
+#endif // IPOOL_HH
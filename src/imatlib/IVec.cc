@@ -74,6 +74,7 @@ static char *IVEC_CC_Id = "$Id: IVec.cc,v 1.1 2005/05/09 20:53:19 mrmcclai Exp $
 #include "IVec.hh"
 #include "IMat.hh"
 #include "IMatVecOps.hh"
+#include "IAlloc.hh"
 #include "gen_defines.h"
 
 using namespace Torch;
@@ -104,7 +105,7 @@ IVec::IVec(int n_):
       stride(1),
       is_alias(false)
 {
-   ptr = (real *)allocator->alloc(sizeof(real)*n);
+   ptr = (real *)IAlignedAlloc(allocator, sizeof(real)*n);
 }
 
 /** 
@@ -189,7 +190,7 @@ IVec::~IVec()
 
 int IVec::init(int n_)
 {
-   ptr = (real *)allocator->alloc(sizeof(real)*n_);
+   ptr = (real *)IAlignedAlloc(allocator, sizeof(real)*n_);
    
    n = n_;
    real_n = n_;
@@ -460,11 +461,13 @@ int IVec::ins(unsigned int pos, unsigned int len, real val)
       if (is_alias)
          return -1;
 
-      if ((new_ptr=(real *)allocator->realloc(ptr,(n+len)*sizeof(real)))==NULL)
+      int new_n = IGrowSize(real_n, n+len);
+
+      if ((new_ptr=(real *)IAlignedGrow(allocator,ptr,n*sizeof(real),new_n*sizeof(real)))==NULL)
          return -1;
 
       ptr = new_ptr;
-      real_n=n+len;
+      real_n=new_n;
    }
    
    if (pos < n)
@@ -523,13 +526,15 @@ int IVec::resize(unsigned int n_, bool clear)
          return -1;
       }
 
-      // Otherwise... resize the vector to n_
+      // Otherwise... grow the vector to at least n_
+
+      int new_n = IGrowSize(real_n, n_);
 
-      if ((new_ptr = (real *)allocator->realloc(ptr,(n_)*sizeof(real)))==NULL)
+      if ((new_ptr = (real *)IAlignedGrow(allocator,ptr,n*sizeof(real),new_n*sizeof(real)))==NULL)
          return -1;
       
       ptr = new_ptr;
-      real_n = n_;
+      real_n = new_n;
    }
 
    if (clear && n_>n)
@@ -540,6 +545,38 @@ int IVec::resize(unsigned int n_, bool clear)
    return 0;
 }
 
+/** 
+ * Make room for at least n_ elements, so that the vector can grow to
+ * that length without reallocating.  The contents and length are not
+ * changed.
+ * 
+ * @param n_ number of elements to make room for
+ * 
+ * @return 0 on success, -1 on failure
+ */
+
+int IVec::reserve(unsigned int n_)
+{
+   real *new_ptr;
+
+   if (n_ <= real_n)
+      return 0;
+
+   if (is_alias)
+   {
+      error("Tried to reserve space in an alias!\n");
+      return -1;
+   }
+
+   if ((new_ptr = (real *)IAlignedGrow(allocator,ptr,n*sizeof(real),n_*sizeof(real)))==NULL)
+      return -1;
+
+   ptr = new_ptr;
+   real_n = n_;
+
+   return 0;
+}
+
 int IVec::getInd(IVec *out, IVecInt *ind)
 {
    int i;
@@ -93,7 +93,7 @@ class IVec : public Object
 {
 public:
    int n;          ///< vector length
-   int real_n;     ///< allocated length
+   int real_n;     ///< allocated length (grows geometrically)
 
    int stride;     ///< length between successive elements of the vector
 
@@ -178,6 +178,10 @@ public:
    int resize(unsigned int n_, 
               bool clear = false);        ///< resize the vector
 
+   int reserve(unsigned int n_);          ///< make room for n_
+                                          ///< elements without
+                                          ///< changing the length
+
    ////////////////////
    // Copy/Alias a Sub-vector
    //////////////////////
@@ -2,6 +2,10 @@
 
 SequenceLearner::~SequenceLearner(){
 
+	for (unsigned int i = 0; i < staged.size(); i++) {
+		delete staged[i];
+	}
+
 }
 
 void SequenceLearner::init() {
@@ -50,6 +54,142 @@ void SequenceLearner::printToFile(string baseName) {
 void SequenceLearner::printToFile(string baseName, int n) {
 
 
+}
+
+//write the whole learner (settings, models, learning rate state) to a binary
+//snapshot file. see Snapshot.h for the format
+bool SequenceLearner::snapshot(const char * fileName) {
+
+	SnapshotWriter w;
+	if (!w.open(fileName, getType() ? SNAPSHOT_CONT : SNAPSHOT_DISC)) {
+		return false;
+	}
+
+	//sizes
+	w.putInt(r);
+	w.putInt(b);
+	putShape(w);
+
+	//learner settings
+	w.putInt(nInitialized);
+	w.putInt(epochs);
+	w.putInt(upobs);
+	w.putReal(lThresh);
+	w.putReal(prior);
+	w.putReal(eps);
+	w.putReal(eps_decay);
+
+	//models
+	for (int n = 0; n < nInitialized; n++) {
+		w.putMat(p[n]->A);
+		w.putVec(p[n]->prob);
+		w.putVec(pi[n]);
+		putRate(w, p[n]);
+		putObs(w, n);
+	}
+
+	return w.close();
+
+}
+
+//restore a snapshot written by snapshot(). the learner must have been
+//constructed with the same type and sizes. the whole file is read into staging
+//copies first, so if it can't be used (or is corrupt anywhere) nothing is changed
+bool SequenceLearner::restore(const char * fileName) {
+
+	SnapshotReader rd;
+	if (!rd.open(fileName, getType() ? SNAPSHOT_CONT : SNAPSHOT_DISC)) {
+		printf("%s is not a snapshot of this kind of learner\n", fileName);
+		return false;
+	}
+
+	if (!rd.expect(r) || !rd.expect(b) || !checkShape(rd)) {
+		printf("snapshot %s has different model sizes\n", fileName);
+		return false;
+	}
+
+	int n = rd.getInt();
+	int ep = rd.getInt();
+	bool up = rd.getInt() != 0;
+	double th = rd.getReal();
+	double pr = rd.getReal();
+	double e = rd.getReal();
+	double ed = rd.getReal();
+	if (!rd.ok() || n < 0 || n > b) {
+		return false;
+	}
+
+	//parse and check everything before touching the models
+	while ((int)staged.size() < n) {
+		staged.push_back(new StagedModel);
+	}
+	for (int i = 0; i < n; i++) {
+		StagedModel * s = staged[i];
+		s->A.resize(r, r);
+		s->prob.resize(r);
+		s->pi.resize(r);
+		rd.getMat(&s->A);
+		rd.getVec(&s->prob);
+		rd.getVec(&s->pi);
+		getRate(rd, s->rate);
+		if (!getObs(rd, i) || !rd.ok()) {
+			printf("snapshot %s is corrupt (model %d)\n", fileName, i);
+			return false;
+		}
+	}
+	if (!rd.atEnd()) {
+		printf("snapshot %s is corrupt (trailing data)\n", fileName);
+		return false;
+	}
+
+	//then swap them in
+	for (int i = 0; i < n; i++) {
+		StagedModel * s = staged[i];
+		MatCopy(&s->A, p[i]->A);
+		VecCopy(&s->pi, pi[i]);
+		setRate(p[i], s->rate);
+		setObs(i);
+
+		//drop the filter/RMLE state of the old model
+		p[i]->reset();
+		VecCopy(&s->prob, p[i]->prob);
+	}
+
+	nInitialized = n;
+	epochs = ep;
+	upobs = up;
+	lThresh = th;
+	prior = pr;
+	eps = e;
+	eps_decay = ed;
+
+	return true;
+
+}
+
+//learning rate state of a model (or its observation dist)
+void SequenceLearner::putRate(SnapshotWriter &w, StochasticClassifier * c) {
+
+	w.putInt(c->iter);
+	w.putReal(c->eps0);
+	w.putReal(c->eps_exp);
+
+}
+
+void SequenceLearner::getRate(SnapshotReader &rd, RateState &st) {
+
+	st.iter = rd.getInt();
+	st.eps0 = rd.getReal();
+	st.eps_exp = rd.getReal();
+
+}
+
+void SequenceLearner::setRate(StochasticClassifier * c, const RateState &st) {
+
+	c->iter = st.iter;
+	c->eps0 = st.eps0;
+	c->eps_exp = st.eps_exp;
+
 }
 
 bool SequenceLearner::generateSequence(IMat &data, int n, double dscale) {
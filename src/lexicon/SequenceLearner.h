@@ -28,6 +28,8 @@
 #include "../imatlib/IVec.hh"
 #include "../imatlib/IVecInt.hh"
 #include "../imatlib/IMatVecOps.hh"
+#include "../imatlib/IPool.hh"
+#include "Snapshot.h"
 
 //yarp libs
 #include <yarp/os/Bottle.h>
@@ -72,6 +74,10 @@ public:
     virtual bool generateSequence(IMat &data, int n, double dscale = 1.0);
     virtual bool generateSequence(IVecInt &data, int length, int n);
 
+    //binary snapshots of the full learner state
+    bool snapshot(const char *);
+    bool restore(const char *);
+
     //getters/setters
     int getEpochs() const { return epochs; }
     double getEps() const { return eps; }
@@ -100,6 +106,33 @@ protected:
     int epochs;
     double prior;
     double eps;
+    IPool pool;		//per-call temporaries, reused between calls
+
+    //learning rate state of a model as read from a snapshot
+    struct RateState {
+        int iter;
+        real eps0, eps_exp;
+    };
+
+    //a model read from a snapshot, held until the whole file has checked out
+    struct StagedModel {
+        IMat A;
+        IVec prob, pi;
+        RateState rate;
+    };
+    vector<StagedModel *> staged;		//reused between restores
+
+    //snapshot hooks for the model sizes and observation dists. getObs reads
+    //model n into the derived class's staging copy, setObs copies that into
+    //the live model once the whole snapshot has been read
+    virtual void putShape(SnapshotWriter &) { }
+    virtual bool checkShape(SnapshotReader &) { return false; }
+    virtual void putObs(SnapshotWriter &, int) { }
+    virtual bool getObs(SnapshotReader &, int) { return false; }
+    virtual void setObs(int) { }
+    void putRate(SnapshotWriter &, StochasticClassifier *);
+    void getRate(SnapshotReader &, RateState &);
+    void setRate(StochasticClassifier *, const RateState &);
 };
 
 #endif
@@ -1,7 +1,12 @@
 #define RL_E 1.0e-10
+#define EVAL_CHUNK 32		//frames scored between early-abandon checks
 
 #include "SequenceLearnerCont.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 SequenceLearnerCont::SequenceLearnerCont(int r_, int d_, int b_, int epochs_, double thresh_, double prior_, double eps_, double alpha_, double xi_, bool makeLR_)
 : d(d_), alpha(alpha_), xi(xi_), makeLR(makeLR_), SequenceLearner(r_, b_, epochs_, thresh_, prior_, eps_) {
 
@@ -52,6 +57,13 @@ SequenceLearnerCont::SequenceLearnerCont(int r_, int d_, int b_, int epochs_, do
 
 SequenceLearnerCont::~SequenceLearnerCont(){
 
+	for (unsigned int i = 0; i < scratch.size(); i++) {
+		delete scratch[i];
+	}
+	for (unsigned int i = 0; i < stagedObs.size(); i++) {
+		delete stagedObs[i];
+	}
+
 }
 
 
@@ -69,6 +81,7 @@ void SequenceLearnerCont::init() {
 		exemplar_initPos[i]->resize(d);
 		exemplar_length[i] = 0;
 		obs_dist[i]->eps0 = eps;
+		obs_dist[i]->log_domain = true;	//long utterances would underflow otherwise
 		p[i]->eps0 = eps;
 	}
 
@@ -92,6 +105,16 @@ void SequenceLearnerCont::scale(real ** samples, int length) {
 }
 
 
+//score with float32 emission evaluation (training stays in double)
+void SequenceLearnerCont::setSinglePrecision(bool single) {
+
+	for (int i = 0; i < b; i++) {
+		obs_dist[i]->single = single;
+	}
+
+}
+
+
 int SequenceLearnerCont::train(real ** samples, int length) {
 
 	int z = length;
@@ -143,19 +166,92 @@ int SequenceLearnerCont::train(real ** samples, int length) {
 }
 
 
+//batch EM (Baum-Welch) of model n on a set of sequences (one sample per
+//row, already scaled), starting from its current parameters. runs until
+//the likelihood stops improving or for iters iterations. covariances are
+//regularized after each M-step, like in train. returns the log10
+//likelihood per frame from the last E-step
+double SequenceLearnerCont::trainBatch(vector<IMat *> &seqs, int n, int iters) {
+
+	if (n < 0 || n >= nInitialized || seqs.empty() || iters <= 0) {
+		return -INF;
+	}
+
+	BaumWelch bw(p[n]);
+	bw.update_b = upobs;
+
+	double last = -INF;
+	for (int i = 0; i < iters; i++) {
+
+		bw.EStep(&seqs[0], seqs.size(), pi[n]);
+		double l = (bw.frames > 0) ? bw.log_prob/bw.frames/log(10.0) : -INF;
+		if (i > 0 && l - last < 1e-6) {
+			last = l;
+			break;
+		}
+		last = l;
+
+		bw.MStep(pi[n]);
+		if (stent) {
+			if (scm <= 0)
+				obs_dist[n]->covReg(ascf,xscf);
+			else
+				obs_dist[n]->covReg(alvec,xivec);
+		}
+
+	}
+
+	VecCopy(pi[n],p[n]->prob);
+
+	return last;
+
+}
+
+
 int SequenceLearnerCont::classify(real ** samples, int length) {
 
 	int lMaxIdx;
-	IVec L;
-	L.resize(nInitialized);
+	IPoolMark mk = pool.mark();
+	IVec &L = *pool.getVec(nInitialized);
+
+	loadSequence(samples, length);
+
+	int nWorkers = 1;
+#ifdef _OPENMP
+	nWorkers = omp_get_max_threads();
+	if (nWorkers > nInitialized) nWorkers = nInitialized;
+	if (nWorkers < 1) nWorkers = 1;
+#endif
+	//create scratch up front, the workers only read the vector
+	for (int w = 0; w < nWorkers; w++) {
+		getScratch(w);
+	}
 
-	//make an ML classification
+	//make an ML classification, scoring the models in parallel. a model
+	//is abandoned as soon as it cannot beat the best score so far
+	double best = -INF;
+
+#pragma omp parallel for schedule(dynamic,1) num_threads(nWorkers)
 	for (int i = 0; i < nInitialized; i++) {
-		L[i] = evaluate(samples, length, i);
+
+		int w = 0;
+#ifdef _OPENMP
+		w = omp_get_thread_num();
+#endif
+		double bound;
+#pragma omp critical (SequenceLearnerCont_best)
+		bound = best;
+
+		double l = evaluateSequence(i, scratch[w], bound);
+		L[i] = l;
+
+#pragma omp critical (SequenceLearnerCont_best)
+		if (l > best) best = l;
 	}
 
 	//find the max likelihood
 	L.vmax(&lMaxIdx);
+	pool.release(mk);
 
 	return lMaxIdx;
 
@@ -164,8 +260,45 @@ int SequenceLearnerCont::classify(real ** samples, int length) {
 
 double SequenceLearnerCont::evaluate(real ** samples, int length, int n) {
 
-	int z = length;
+	loadSequence(samples, length);
+
+	return evaluateSequence(n, getScratch(0), -INF);
+
+}
+
+
+void SequenceLearnerCont::loadSequence(real ** samples, int length) {
+
+	seqData.reshape(length, d);
+	for (int j = 0; j < length; j++) {
+		memcpy(seqData.ptr[j], samples[j], d*sizeof(real));
+	}
+
+}
+
+
+SequenceLearnerCont::EvalScratch * SequenceLearnerCont::getScratch(int w) {
+
+	while ((int)scratch.size() <= w) {
+		EvalScratch * ws = new EvalScratch;
+		ws->alpha.resize(r);
+		ws->alpha_prev.resize(r);
+		scratch.push_back(ws);
+	}
+
+	return scratch[w];
+
+}
+
+
+//log10 likelihood of seqData under model n, normalized by length. if the
+//score can no longer reach bound, returns -INF early. only touches model n
+//and ws, so different models can be scored concurrently.
+double SequenceLearnerCont::evaluateSequence(int n, EvalScratch * ws, double bound) {
+
+	int z = seqData.m;
 	double likelihood;
+	double norm = 1.0/((z+1)*M_LN10);
 
 
 	//reset the initial internal probabilities
@@ -183,40 +316,61 @@ double SequenceLearnerCont::evaluate(real ** samples, int length, int n) {
 	}
 	*/
 
-	/* NEW STYLE (FWD-BWD) */
-	IMat *alpha = new IMat(z, p[n]->r);
-	IMat *beta = new IMat(z, p[n]->r);
-	IVec *scal = new IVec(z);
+	/* NEW STYLE (FWD-BWD), emissions computed a chunk at a time */
+	IVec &alpha = ws->alpha;
+	IVec &alpha_prev = ws->alpha_prev;
 
-	IVec tmp(p[n]->r);
-	alpha->getRow(0,&tmp,false);
-	obs_dist[n]->Classify(samples[0]);
-	VecCopy(pi[n], &tmp);
-	scal->ptr[0] = VecDot(&tmp, obs_dist[n]->prob);
-	VecDotTimes(1.0/scal->ptr[0], obs_dist[n]->prob, &tmp);
-	likelihood += log10(scal->ptr[0])*(double)(1.0/(z+1));
+	//no frame can score more than the peak density of the model
+	double lfbound = (bound > -INF) ? obs_dist[n]->LogLikBound() : 0.0;
 
-	for (int j = 1; j < z; j++) {
+	for (int j0 = 0; j0 < z; j0 += EVAL_CHUNK) {
 
-	    IVec t(p[n]->r), tm1(p[n]->r);
-	    alpha->getRow(j-1,&tm1,false);
-	    alpha->getRow(j,&t,false);
+		int nj = (z - j0 < EVAL_CHUNK) ? z - j0 : EVAL_CHUNK;
+		ws->block.set(seqData.ptr[j0], nj, d);
+		obs_dist[n]->LogLikBlock(&ws->block, &ws->logF);
 
-	    MatVecMult(p[n]->A,CblasTrans,&tm1,&t);
-	    obs_dist[n]->Classify(samples[j]);
-	    VecDotTimes(1.0, obs_dist[n]->prob, &t);
+		for (int j = j0; j < j0 + nj; j++) {
 
-	    if (makeLR && j == z-1) {
-	    	likelihood += log10(obs_dist[n]->prob->ptr[p[n]->r-1])*(double)(1.0/(z+1));
-	    }
+			real *lf = ws->logF.ptr[j - j0];
+			real lfmax = -INF;
+			for (int i = 0; i < r; i++) {
+				if (lf[i] > lfmax) lfmax = lf[i];
+			}
 
-	    scal->ptr[j] = t.sum();
-	    VecScale(1.0/scal->ptr[j],&t);
-	    likelihood += log10(scal->ptr[j])*(double)(1.0/(z+1));
+			if (j == 0) {
+				VecCopy(pi[n], &alpha);
+			} else {
+				VecCopy(&alpha, &alpha_prev);
+				MatVecMult(p[n]->A,CblasTrans,&alpha_prev,&alpha);
+			}
 
-	}
+			//alpha = alpha .* f, with f scaled by exp(-lfmax) to avoid underflow
+			for (int i = 0; i < r; i++) {
+				alpha.ptr[i] *= exp(lf[i] - lfmax);
+			}
+
+			if (makeLR && j > 0 && j == z-1) {
+				likelihood += lf[r-1]*norm;
+			}
+
+			double scal = alpha.sum();
+			VecScale(1.0/scal,&alpha);
+			likelihood += (log(scal) + lfmax)*norm;
+
+		}
 
-	delete alpha, beta, scal;
+		//early abandon: the remaining frames (and the LR end term) add
+		//at most lfbound each
+		if (bound > -INF && j0 + nj < z) {
+			int left = z - j0 - nj;
+			double ub = likelihood + left*lfbound*norm;
+			if (makeLR && z > 1) ub += lfbound*norm;
+			if (ub + RL_E < bound) {
+				return -INF;
+			}
+		}
+
+	}
 
 	return likelihood;
 
@@ -424,6 +578,57 @@ void SequenceLearnerCont::printToFile(string baseName) {
 	}
 }
 
+void SequenceLearnerCont::putShape(SnapshotWriter &w) {
+	w.putInt(d);
+}
+
+bool SequenceLearnerCont::checkShape(SnapshotReader &rd) {
+	return rd.expect(d);
+}
+
+//gaussian parameters, learning rate state and exemplar info of model n
+void SequenceLearnerCont::putObs(SnapshotWriter &w, int n) {
+
+	w.putMat(obs_dist[n]->MU);
+	w.putMat(obs_dist[n]->R);
+	putRate(w, obs_dist[n]);
+	w.putVec(exemplar_initPos[n]);
+	w.putInt(exemplar_length[n]);
+
+}
+
+bool SequenceLearnerCont::getObs(SnapshotReader &rd, int n) {
+
+	while ((int)stagedObs.size() <= n) {
+		stagedObs.push_back(new StagedObs);
+	}
+	StagedObs * s = stagedObs[n];
+	s->MU.resize(obs_dist[n]->MU->m, obs_dist[n]->MU->n);
+	s->R.resize(obs_dist[n]->R->m, obs_dist[n]->R->n);
+	s->initPos.resize(exemplar_initPos[n]->n);
+
+	rd.getMat(&s->MU);
+	rd.getMat(&s->R);
+	getRate(rd, s->rate);
+	rd.getVec(&s->initPos);
+	s->length = rd.getInt();
+
+	return rd.ok();
+
+}
+
+void SequenceLearnerCont::setObs(int n) {
+
+	StagedObs * s = stagedObs[n];
+	MatCopy(&s->MU, obs_dist[n]->MU);
+	MatCopy(&s->R, obs_dist[n]->R);
+	setRate(obs_dist[n], s->rate);
+	VecCopy(&s->initPos, exemplar_initPos[n]);
+	exemplar_length[n] = s->length;
+	obs_dist[n]->invalidateDensityCache();
+
+}
+
 void SequenceLearnerCont::setScaling(int mode, double scc, IVec * scalevec) {
 
 	if (mode < 0) {
@@ -562,6 +767,10 @@ bool SequenceLearnerCont::generateSequence(IMat &data, int n, double dscale) {
 	Xd.setRow(0,&initPos);
 	H.setRow(0,pi[n]);
 
+	//density scratch space and state pmf, reused for every sample
+	NWorkspace nws(d/2);
+	IVec prob(r);
+
 	//recursively generate
 	for (int i = 0; i < exemplar_length[n]-1; i++) {
 
@@ -613,12 +822,11 @@ bool SequenceLearnerCont::generateSequence(IMat &data, int n, double dscale) {
 		data.setRow(i+1,&cpos);
 
 		//update pmf
-		IVec prob(r);
 		prob.zero();
 		for (int j = 0; j < r; j++) {
 
 			obs_dist[n]->MU->getRow(j,0,d/2,&mx,true);
-			prob(j) = N(&cpos,&mx,Sx[j],NULL,NULL);
+			prob(j) = N(&cpos,&mx,Sx[j],NULL,NULL,&nws);
 
 		}
 		prob.normalize();
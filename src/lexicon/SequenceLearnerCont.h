@@ -24,6 +24,7 @@
 #include "../RMLE/StochasticClassifier.hh"
 #include "../RMLE/Gaussian.hh"
 #include "../RMLE/N.hh"
+#include "../RMLE/BaumWelch.hh"
 #include "../imatlib/IMat.hh"
 #include "../imatlib/IVec.hh"
 #include "../imatlib/IVecInt.hh"
@@ -45,6 +46,7 @@ public:
 	//training (with classification)
 	int train(real **, int);
 	int initialize(real **, int, int);
+	double trainBatch(vector<IMat *> &, int, int);
 
 	//clasification
 	int classify(real **, int);
@@ -60,12 +62,40 @@ public:
 	bool generateSequence(IMat &data, int n, double dscale = 1.0);
 	void setScaling(int, double, IVec *);
 	void scale(real **, int);
+	void setSinglePrecision(bool);
 
 	//int nInitialized;
 
 
 private:
 
+	//per-worker scratch for scoring, reused between calls
+	struct EvalScratch {
+		IMat block;			//alias of a chunk of rows of the sequence
+		IMat logF;			//emission log likelihoods for the chunk
+		IVec alpha, alpha_prev;
+	};
+
+	void loadSequence(real **, int);
+	double evaluateSequence(int, EvalScratch *, double);
+	EvalScratch * getScratch(int);
+
+	//observation dist of a model as read from a snapshot
+	struct StagedObs {
+		IMat MU, R;
+		RateState rate;
+		IVec initPos;
+		int length;
+	};
+	vector<StagedObs *> stagedObs;		//reused between restores
+
+	//snapshot hooks
+	void putShape(SnapshotWriter &);
+	bool checkShape(SnapshotReader &);
+	void putObs(SnapshotWriter &, int);
+	bool getObs(SnapshotReader &, int);
+	void setObs(int);
+
 	//model parameters
 	int d;		//observation size
 
@@ -88,6 +118,10 @@ private:
 	IVec scv, alvec, xivec;			//scaling vector
 	double kv, kp;
 
+	//scoring
+	IMat seqData;		//sequence being scored, one sample per row
+	vector<EvalScratch *> scratch;
+
 
 };
 
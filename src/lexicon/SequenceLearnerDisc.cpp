@@ -26,6 +26,10 @@ SequenceLearnerDisc::SequenceLearnerDisc(int r_, int * d_, int n_, int b_, int e
 
 SequenceLearnerDisc::~SequenceLearnerDisc(){
 
+	for (unsigned int i = 0; i < stagedObs.size(); i++) {
+		delete stagedObs[i];
+	}
+
 }
 
 
@@ -93,11 +97,13 @@ int SequenceLearnerDisc::train(int ** samples, int length) {
 			if (!makeLR) {
 				//pi[lMaxIdx]->fill(1.0);
 				for (int k = 0; k < nOuts; k++) {
-					IVec tpi(r), sbi(d[k]);
+					IPoolMark mk = pool.mark();
+					IVec &tpi = *pool.getVec(r), &sbi = *pool.getVec(d[k]);
 					sbi.zero(); tpi.zero();
 					sbi.ptr[samples[0][k]] = 1.0;
 					GenMatVecMult(1.0,obs_dist[lMaxIdx]->b[k],CblasTrans,&sbi,p[lMaxIdx]->eps0,pi[lMaxIdx]);
 					//VecDotTimes(1.0,&tpi,&tmp);
+					pool.release(mk);
 				}
 				VecScale(1.0/pi[lMaxIdx]->sum(), pi[lMaxIdx]);
 			}
@@ -114,11 +120,48 @@ int SequenceLearnerDisc::train(int ** samples, int length) {
 }
 
 
+//batch EM (Baum-Welch) of model n on a set of sequences, starting from its
+//current parameters. each sequence has one sample per row with the symbols
+//stored as reals (negative symbols are missing). left-to-right models keep
+//their structure and pi. returns the log10 likelihood per frame from the
+//last E-step
+double SequenceLearnerDisc::trainBatch(vector<IMat *> &seqs, int n, int iters) {
+
+	if (n < 0 || n >= nInitialized || seqs.empty() || iters <= 0) {
+		return -INF;
+	}
+
+	BaumWelch bw(p[n]);
+	bw.update_pi = !makeLR;
+
+	double last = -INF;
+	for (int i = 0; i < iters; i++) {
+
+		bw.EStep(&seqs[0], seqs.size(), pi[n]);
+		double l = (bw.frames > 0) ? bw.log_prob/bw.frames/log(10.0) : -INF;
+		if (i > 0 && l - last < 1e-6) {
+			last = l;
+			break;
+		}
+		last = l;
+
+		bw.MStep(pi[n]);
+		if (makeLR) {
+			makeALR(n);
+		}
+
+	}
+
+	return last;
+
+}
+
+
 int SequenceLearnerDisc::classify(int ** samples, int length) {
 
 	int lMaxIdx;
-	IVec L;
-	L.resize(nInitialized);
+	IPoolMark mk = pool.mark();
+	IVec &L = *pool.getVec(nInitialized);
 
 	//make an ML classification
 	for (int i = 0; i < nInitialized; i++) {
@@ -127,6 +170,7 @@ int SequenceLearnerDisc::classify(int ** samples, int length) {
 
 	//find the max likelihood
 	L.vmax(&lMaxIdx);
+	pool.release(mk);
 
 	return lMaxIdx;
 
@@ -240,11 +284,13 @@ int SequenceLearnerDisc::initialize(int ** samples, int length, int n) {
 			if (!makeLR) {
 				pi[n]->fill(1.0);
 				for (int k = 0; k < nOuts; k++) {
-					IVec tpi(r), sbi(d[k]);
+					IPoolMark mk = pool.mark();
+					IVec &tpi = *pool.getVec(r), &sbi = *pool.getVec(d[k]);
 					sbi.zero(); tpi.zero();
 					sbi.ptr[samples[0][k]] = 1.0;
 					GenMatVecMult(1.0,obs_dist[n]->b[k],CblasTrans,&sbi,1.0,&tpi);
 					VecDotTimes(1.0,&tpi,pi[n]);
+					pool.release(mk);
 				}
 				VecScale(1.0/pi[n]->sum(), pi[n]);
 			}
@@ -436,6 +482,71 @@ void SequenceLearnerDisc::printToFile(string baseName) {
 	}
 }
 
+void SequenceLearnerDisc::putShape(SnapshotWriter &w) {
+
+	w.putInt(nOuts);
+	for (int j = 0; j < nOuts; j++) {
+		w.putInt(d[j]);
+	}
+
+}
+
+bool SequenceLearnerDisc::checkShape(SnapshotReader &rd) {
+
+	if (!rd.expect(nOuts)) {
+		return false;
+	}
+	for (int j = 0; j < nOuts; j++) {
+		if (!rd.expect(d[j])) {
+			return false;
+		}
+	}
+
+	return true;
+
+}
+
+//pmf tables, learning rate state and class vectors of model n
+void SequenceLearnerDisc::putObs(SnapshotWriter &w, int n) {
+
+	for (int j = 0; j < nOuts; j++) {
+		w.putMat(obs_dist[n]->b[j]);
+		w.putVec(cvex[n][j]);
+	}
+	putRate(w, obs_dist[n]);
+
+}
+
+bool SequenceLearnerDisc::getObs(SnapshotReader &rd, int n) {
+
+	while ((int)stagedObs.size() <= n) {
+		stagedObs.push_back(new StagedObs(nOuts));
+	}
+	StagedObs * s = stagedObs[n];
+
+	for (int j = 0; j < nOuts; j++) {
+		s->b[j].resize(obs_dist[n]->b[j]->m, obs_dist[n]->b[j]->n);
+		s->cv[j].resize(cvex[n][j]->n);
+		rd.getMat(&s->b[j]);
+		rd.getVec(&s->cv[j]);
+	}
+	getRate(rd, s->rate);
+
+	return rd.ok();
+
+}
+
+void SequenceLearnerDisc::setObs(int n) {
+
+	StagedObs * s = stagedObs[n];
+	for (int j = 0; j < nOuts; j++) {
+		MatCopy(&s->b[j], obs_dist[n]->b[j]);
+		VecCopy(&s->cv[j], cvex[n][j]);
+	}
+	setRate(obs_dist[n], s->rate);
+
+}
+
 void SequenceLearnerDisc::packObs(Bottle &dst, int n) {
 
 	//pack B
@@ -25,6 +25,7 @@
 #include "../RMLE/HMM.hh"
 #include "../RMLE/StochasticClassifier.hh"
 #include "../RMLE/IndepPMF.hh"
+#include "../RMLE/BaumWelch.hh"
 #include "../imatlib/IMat.hh"
 #include "../imatlib/IVec.hh"
 #include "../imatlib/IMatVecOps.hh"
@@ -44,6 +45,7 @@ public:
 	//training (with classification)
 	int train(int **, int);
 	int initialize(int **, int, int);
+	double trainBatch(vector<IMat *> &, int, int);
 
 	//clasification
 	int classify(int **, int);
@@ -79,6 +81,23 @@ private:
 	void makeALR(int);
 	int ProbProject(IMat *, int);
 
+	//observation dists of a model as read from a snapshot
+	struct StagedObs {
+		IMat * b;		//one per output
+		IVec * cv;
+		RateState rate;
+		StagedObs(int n) : b(new IMat[n]), cv(new IVec[n]) { }
+		~StagedObs() { delete [] b; delete [] cv; }
+	};
+	vector<StagedObs *> stagedObs;		//reused between restores
+
+	//snapshot hooks
+	void putShape(SnapshotWriter &);
+	bool checkShape(SnapshotReader &);
+	void putObs(SnapshotWriter &, int);
+	bool getObs(SnapshotReader &, int);
+	void setObs(int);
+
 };
 
 #endif
@@ -0,0 +1,282 @@
+#include "Snapshot.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_END "SNAPEND"
+
+//fixed size file header
+struct SnapshotHeader {
+	char magic[8];
+	int version;
+	int realSize;
+	int type;
+	int reserved;
+};
+
+
+SnapshotWriter::~SnapshotWriter() {
+
+	//never finished, throw the partial file away
+	if (fp != NULL) {
+		fclose(fp);
+		remove(tmpName.c_str());
+	}
+
+}
+
+//start a snapshot of the given learner type
+bool SnapshotWriter::open(const char * fileName, int type) {
+
+	name = fileName;
+	tmpName = name + ".tmp";
+	failed = false;
+
+	fp = fopen(tmpName.c_str(), "wb");
+	if (fp == NULL) {
+		return false;
+	}
+
+	SnapshotHeader h;
+	memset(&h, 0, sizeof(h));
+	strcpy(h.magic, SNAPSHOT_MAGIC);
+	h.version = SNAPSHOT_VERSION;
+	h.realSize = sizeof(real);
+	h.type = type;
+	put(&h, sizeof(h));
+
+	return ok();
+
+}
+
+//write the end marker and move the file into place
+bool SnapshotWriter::close() {
+
+	if (fp == NULL) {
+		return false;
+	}
+
+	pad();
+	put(SNAPSHOT_END, 8);
+	if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+		failed = true;
+	}
+	fclose(fp);
+	fp = NULL;
+
+	if (failed || rename(tmpName.c_str(), name.c_str()) != 0) {
+		remove(tmpName.c_str());
+		return false;
+	}
+
+	return true;
+
+}
+
+void SnapshotWriter::put(const void * src, size_t n) {
+
+	if (ok() && fwrite(src, 1, n, fp) != n) {
+		failed = true;
+	}
+
+}
+
+void SnapshotWriter::pad() {
+
+	static const char zeros[8] = {0};
+	long p = ok() ? ftell(fp) : 0;
+	if (p % 8 != 0) {
+		put(zeros, 8 - p % 8);
+	}
+
+}
+
+void SnapshotWriter::putInt(int v) {
+	put(&v, sizeof(int));
+}
+
+void SnapshotWriter::putReal(real v) {
+	pad();
+	put(&v, sizeof(real));
+}
+
+void SnapshotWriter::putMat(IMat * M) {
+
+	putInt(M->m);
+	putInt(M->n);
+	pad();
+	for (int i = 0; i < M->m; i++) {
+		put(M->ptr[i], M->n*sizeof(real));
+	}
+
+}
+
+void SnapshotWriter::putVec(IVec * v) {
+
+	putInt(v->n);
+	pad();
+	for (int i = 0; i < v->n; i++) {
+		real x = (*v)(i);
+		put(&x, sizeof(real));
+	}
+
+}
+
+
+SnapshotReader::~SnapshotReader() {
+	close();
+}
+
+//map a snapshot file and check that it is complete and of the given learner type
+bool SnapshotReader::open(const char * fileName, int type) {
+
+	close();
+	failed = false;
+
+	int fd = ::open(fileName, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)(sizeof(SnapshotHeader) + 8)) {
+		::close(fd);
+		return false;
+	}
+
+	void * m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED) {
+		return false;
+	}
+	base = (char *)m;
+	len = st.st_size;
+
+	const SnapshotHeader * h = (const SnapshotHeader *)base;
+	if (strncmp(h->magic, SNAPSHOT_MAGIC, 8) != 0 || h->version != SNAPSHOT_VERSION ||
+			h->realSize != (int)sizeof(real) || h->type != type ||
+			memcmp(base + len - 8, SNAPSHOT_END, 8) != 0) {
+		close();
+		return false;
+	}
+
+	pos = sizeof(SnapshotHeader);
+	end = len - 8;
+
+	return true;
+
+}
+
+void SnapshotReader::close() {
+
+	if (base != NULL) {
+		munmap(base, len);
+		base = NULL;
+	}
+	len = pos = end = 0;
+
+}
+
+//next n bytes of the payload, NULL (and failed) if past the end
+const char * SnapshotReader::get(size_t n) {
+
+	if (!ok() || pos + n > end) {
+		failed = true;
+		return NULL;
+	}
+
+	const char * p = base + pos;
+	pos += n;
+	return p;
+
+}
+
+void SnapshotReader::skipPad() {
+	if (pos % 8 != 0) {
+		get(8 - pos % 8);
+	}
+}
+
+int SnapshotReader::getInt() {
+
+	int v = 0;
+	const char * p = get(sizeof(int));
+	if (p != NULL) {
+		memcpy(&v, p, sizeof(int));
+	}
+	return v;
+
+}
+
+real SnapshotReader::getReal() {
+
+	real v = 0.0;
+	skipPad();
+	const char * p = get(sizeof(real));
+	if (p != NULL) {
+		memcpy(&v, p, sizeof(real));
+	}
+	return v;
+
+}
+
+//read an int and fail if it isn't the expected value (sizes, counts)
+bool SnapshotReader::expect(int v) {
+
+	if (getInt() != v) {
+		failed = true;
+	}
+	return ok();
+
+}
+
+//true if the whole payload has been read
+bool SnapshotReader::atEnd() {
+
+	skipPad();
+	return ok() && pos == end;
+
+}
+
+//read a matrix into M, which must already have the stored size
+bool SnapshotReader::getMat(IMat * M) {
+
+	if (!expect(M->m) || !expect(M->n)) {
+		return false;
+	}
+
+	skipPad();
+	for (int i = 0; i < M->m; i++) {
+		const char * p = get(M->n*sizeof(real));
+		if (p == NULL) {
+			return false;
+		}
+		memcpy(M->ptr[i], p, M->n*sizeof(real));
+	}
+
+	return true;
+
+}
+
+//read a vector into v, which must already have the stored size
+bool SnapshotReader::getVec(IVec * v) {
+
+	if (!expect(v->n)) {
+		return false;
+	}
+
+	skipPad();
+	for (int i = 0; i < v->n; i++) {
+		const char * p = get(sizeof(real));
+		if (p == NULL) {
+			return false;
+		}
+		memcpy(&(*v)(i), p, sizeof(real));
+	}
+
+	return true;
+
+}
@@ -0,0 +1,96 @@
+/*
+ * Snapshot.h
+ *
+ *  binary snapshot files for the lexicon models (see SequenceLearner::snapshot).
+ *
+ *  layout: a fixed header (magic, format version, sizeof(real), learner type),
+ *  then a flat stream of ints and reals, each array padded to 8 bytes, then an
+ *  end marker. matrices are stored as rows x cols followed by the data, row
+ *  major. numbers are in host byte order; a snapshot is meant to be restored on
+ *  the machine (or at least the architecture) that wrote it.
+ *
+ *  the writer goes to <name>.tmp and renames it over <name> on close, so a
+ *  crash while writing leaves the previous snapshot intact. the reader maps the
+ *  whole file and checks the header and end marker before anything is read.
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <torch/general.h>
+#include <stdio.h>
+#include <string>
+
+#include "../imatlib/IMat.hh"
+#include "../imatlib/IVec.hh"
+
+#define SNAPSHOT_MAGIC "LEXSNAP"
+#define SNAPSHOT_VERSION 1
+
+//learner types
+#define SNAPSHOT_CONT 0
+#define SNAPSHOT_DISC 1
+
+using namespace std;
+
+class SnapshotWriter
+{
+
+public:
+
+	SnapshotWriter() : fp(NULL), failed(false) { }
+	~SnapshotWriter();
+
+	bool open(const char *, int);
+	bool close();
+
+	void putInt(int);
+	void putReal(real);
+	void putMat(IMat *);
+	void putVec(IVec *);
+
+	bool ok() const { return fp != NULL && !failed; }
+
+private:
+
+	FILE * fp;
+	string name, tmpName;
+	bool failed;
+
+	void put(const void *, size_t);
+	void pad();
+
+};
+
+class SnapshotReader
+{
+
+public:
+
+	SnapshotReader() : base(NULL), len(0), pos(0), failed(false) { }
+	~SnapshotReader();
+
+	bool open(const char *, int);
+	void close();
+
+	int getInt();
+	real getReal();
+	bool getMat(IMat *);
+	bool getVec(IVec *);
+	bool expect(int);
+	bool atEnd();
+
+	bool ok() const { return base != NULL && !failed; }
+
+private:
+
+	char * base;
+	size_t len, pos, end;
+	bool failed;
+
+	const char * get(size_t);
+	void skipPad();
+
+};
+
+#endif
@@ -0,0 +1,249 @@
+//binary feature store, see featstore.h for the layout
+
+#include "featstore.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HEADER_SIZE 32
+
+
+FeatureStoreWriter::FeatureStoreWriter() : fp(NULL), dim(0) {
+
+}
+
+FeatureStoreWriter::~FeatureStoreWriter() {
+
+	close();
+
+}
+
+/* open - start a new store (overwrites an existing file)
+ *
+ * input parameters:
+ *
+ * 		fname - store file name
+ * 		dim_ - feature dimension
+ *
+ */
+bool FeatureStoreWriter::open(const char * fname, int dim_) {
+
+	close();
+
+	fp = fopen(fname, "wb");
+	if (fp == NULL) {
+		return false;
+	}
+
+	dim = dim_;
+	names.clear();
+	offsets.clear();
+	lengths.clear();
+
+	//placeholder header, filled in on close
+	char header[HEADER_SIZE];
+	memset(header, 0, HEADER_SIZE);
+	return fwrite(header, 1, HEADER_SIZE, fp) == HEADER_SIZE;
+
+}
+
+/* addEntry - append one sequence
+ *
+ * input parameters:
+ *
+ * 		ename - name of the sequence (e.g. the source file)
+ * 		data - frames x dim features, row major
+ * 		frames - number of frames
+ *
+ */
+bool FeatureStoreWriter::addEntry(const char * ename, const double * data, int frames) {
+
+	if (fp == NULL) {
+		return false;
+	}
+
+	int64_t off = (int64_t)ftello(fp);
+	if (frames > 0 && fwrite(data, sizeof(double)*dim, frames, fp) != (size_t)frames) {
+		return false;
+	}
+
+	names.push_back(ename);
+	offsets.push_back(off);
+	lengths.push_back(frames);
+
+	return true;
+
+}
+
+/* close - write out the index and header */
+bool FeatureStoreWriter::close() {
+
+	if (fp == NULL) {
+		return false;
+	}
+
+	bool ok = true;
+	int64_t indexOff = (int64_t)ftello(fp);
+	char pad[8];
+	memset(pad, 0, 8);
+
+	for (unsigned int i = 0; i < names.size(); i++) {
+		int32_t len = (int32_t)names[i].size();
+		ok = ok && fwrite(&offsets[i], sizeof(int64_t), 1, fp) == 1;
+		ok = ok && fwrite(&lengths[i], sizeof(int32_t), 1, fp) == 1;
+		ok = ok && fwrite(&len, sizeof(int32_t), 1, fp) == 1;
+		ok = ok && fwrite(names[i].c_str(), 1, len, fp) == (size_t)len;
+		if (len % 8) {
+			ok = ok && fwrite(pad, 1, 8 - len%8, fp) == (size_t)(8 - len%8);
+		}
+	}
+
+	//header
+	char header[HEADER_SIZE];
+	int32_t version = FEATSTORE_VERSION;
+	int32_t d = dim;
+	int64_t n = names.size();
+	memcpy(header, FEATSTORE_MAGIC, 8);
+	memcpy(header+8, &version, 4);
+	memcpy(header+12, &d, 4);
+	memcpy(header+16, &n, 8);
+	memcpy(header+24, &indexOff, 8);
+	ok = ok && fseeko(fp, 0, SEEK_SET) == 0;
+	ok = ok && fwrite(header, 1, HEADER_SIZE, fp) == HEADER_SIZE;
+
+	ok = (fclose(fp) == 0) && ok;
+	fp = NULL;
+
+	return ok;
+
+}
+
+
+FeatureStore::FeatureStore() : base(NULL), mapSize(0), dim(0) {
+
+}
+
+FeatureStore::~FeatureStore() {
+
+	close();
+
+}
+
+/* open - map a store and read its index
+ *
+ * input parameters:
+ *
+ * 		fname - store file name
+ *
+ */
+bool FeatureStore::open(const char * fname) {
+
+	close();
+
+	int fd = ::open(fname, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE) {
+		::close(fd);
+		return false;
+	}
+
+	void * m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED) {
+		return false;
+	}
+	base = (const char *)m;
+	mapSize = st.st_size;
+
+	//check the header
+	int32_t version, d;
+	int64_t n, indexOff;
+	memcpy(&version, base+8, 4);
+	memcpy(&d, base+12, 4);
+	memcpy(&n, base+16, 8);
+	memcpy(&indexOff, base+24, 8);
+	if (memcmp(base, FEATSTORE_MAGIC, 8) != 0 || version != FEATSTORE_VERSION ||
+			d <= 0 || n < 0 || indexOff < HEADER_SIZE || indexOff > (int64_t)mapSize) {
+		printf("%s is not a feature store\n", fname);
+		close();
+		return false;
+	}
+	dim = d;
+
+	//read the index
+	const char * p = base + indexOff;
+	const char * end = base + mapSize;
+	for (int64_t i = 0; i < n; i++) {
+
+		int64_t off;
+		int32_t frames, len;
+		if (p + 16 > end) {
+			break;
+		}
+		memcpy(&off, p, 8);
+		memcpy(&frames, p+8, 4);
+		memcpy(&len, p+12, 4);
+		p += 16;
+
+		//entries must lie between the header and the index, aligned for
+		//the double pointers handed out by data()
+		if (off < HEADER_SIZE || off % 8 != 0 || frames < 0 || len < 0) {
+			break;
+		}
+		int64_t padded = (int64_t)len + (len%8 ? 8 - len%8 : 0);
+		if (padded > end - p ||
+				(int64_t)frames > (indexOff - off)/((int64_t)dim*(int64_t)sizeof(double))) {
+			break;
+		}
+
+		names.push_back(string(p, len));
+		offsets.push_back(off);
+		lengths.push_back(frames);
+		p += padded;
+
+	}
+
+	if ((int64_t)names.size() != n) {
+		printf("%s: index is truncated or corrupt\n", fname);
+		close();
+		return false;
+	}
+
+	return true;
+
+}
+
+void FeatureStore::close() {
+
+	if (base != NULL) {
+		munmap((void *)base, mapSize);
+	}
+	base = NULL;
+	mapSize = 0;
+	dim = 0;
+
+	names.clear();
+	offsets.clear();
+	lengths.clear();
+
+}
+
+/* find - index of the entry with the given name (-1 if not present) */
+int FeatureStore::find(const char * ename) const {
+
+	for (unsigned int i = 0; i < names.size(); i++) {
+		if (names[i] == ename) {
+			return i;
+		}
+	}
+
+	return -1;
+
+}
@@ -0,0 +1,86 @@
+#ifndef FEATSTORE_H_
+#define FEATSTORE_H_
+
+//libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* binary feature store
+ *
+ * one file holding the feature sequences (e.g. MFCCs) of a whole corpus,
+ * laid out so it can be mapped straight into memory:
+ *
+ * 		header	-- "MFCCFEAT", int32 version, int32 dim, int64 entries,
+ * 				   int64 index offset (32 bytes)
+ * 		data	-- each sequence as frames x dim doubles, row major
+ * 		index	-- per entry: int64 data offset (bytes, from start of file),
+ * 				   int32 frames, int32 name length, name (padded to 8 bytes)
+ *
+ * all numbers are in host byte order.
+ */
+
+#define FEATSTORE_MAGIC "MFCCFEAT"
+#define FEATSTORE_VERSION 1
+
+using namespace std;
+
+class FeatureStoreWriter {
+
+public:
+
+	//constructor/destructor
+	FeatureStoreWriter();
+	virtual ~FeatureStoreWriter();
+
+	//logistics
+	bool open(const char *, int);
+	bool addEntry(const char *, const double *, int);
+	bool close();
+
+private:
+
+	FILE * fp;
+	int dim;
+
+	//index, written out on close
+	vector<string> names;
+	vector<int64_t> offsets;
+	vector<int32_t> lengths;
+
+};
+
+class FeatureStore {
+
+public:
+
+	//constructor/destructor
+	FeatureStore();
+	virtual ~FeatureStore();
+
+	//logistics
+	bool open(const char *);
+	void close();
+
+	//access
+	int size() const { return (int)names.size(); }
+	int getDim() const { return dim; }
+	int length(int i) const { return lengths[i]; }
+	const char * name(int i) const { return names[i].c_str(); }
+	const double * frames(int i) const { return (const double *)(base + offsets[i]); }
+	int find(const char *) const;
+
+private:
+
+	const char * base;	//mapped file
+	size_t mapSize;
+	int dim;
+
+	vector<string> names;
+	vector<int64_t> offsets;
+	vector<int32_t> lengths;
+
+};
+
+#endif
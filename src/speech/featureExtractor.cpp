@@ -0,0 +1,239 @@
+/*
+ *  featureExtractor.cpp
+ *
+ * 	offline feature extraction for a corpus of recordings. reads WAV (or
+ *  any libsndfile format) files, computes MFCCs the same way the live
+ *  audioProcessing module does, and writes them all to one binary
+ *  feature store (see featstore.h). files are processed in parallel, and
+ *  written in the order given.
+ *  each file is taken as one utterance (no activity detection is done).
+ *
+ * Usage:
+ *	mfccExtract [options] out.feat file1.wav file2.wav ...
+ *
+ * Options: (defaults match audioProcessing)
+ *	--list		-- text file with one input file name per line (in addition to/instead of args)
+ *	--channel	-- channel to use (D 0)
+ *	--decimate	-- decimate by X (D 2)
+ *	--frameSize	-- processing frame size (D 512)
+ *	--overlap	-- frame overlap (D 128)
+ *	--nwindows	-- number of mel windows (D 30)
+ *	--ncoeffs	-- number of mfccs per frame, 0th not included (D 15)
+ */
+
+//mfcc library include
+#include "mfcc.h"
+#include "featstore.h"
+
+//misc
+#include <sndfile.h>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//defines
+#define PCM16_MAX 32767	//full scale of the robot's 16 bit samples
+
+using namespace std;
+
+//same parameters as audioProcessing
+struct ExtractParams {
+	int channel;
+	int decimate;
+	int frameSize;
+	int overlap;
+	int w;
+	int d;
+};
+
+/* readSignal - read one channel of a sound file, decimated and scaled like
+ * the samples audioProcessing gets from the robot
+ */
+bool readSignal(const char * fname, const ExtractParams & ep, vector<double> & signal, double & fs) {
+
+	SF_INFO sfinfo;
+	memset(&sfinfo, 0, sizeof(sfinfo));
+	SNDFILE * sf = sf_open(fname, SFM_READ, &sfinfo);
+	if (sf == NULL) {
+		printf("could not open %s: %s\n", fname, sf_strerror(NULL));
+		return false;
+	}
+
+	if (ep.channel >= sfinfo.channels) {
+		printf("%s has only %d channel(s)\n", fname, sfinfo.channels);
+		sf_close(sf);
+		return false;
+	}
+
+	vector<double> all((size_t)sfinfo.frames*sfinfo.channels);
+	sf_count_t got = 0;
+	if (all.size() > 0) {
+		got = sf_readf_double(sf, &all[0], sfinfo.frames);
+	}
+	sf_close(sf);
+
+	//libsndfile normalizes to [-1,1) by 1/32768, the robot path by 1/32767
+	double sc = 32768.0/(double)PCM16_MAX;
+	signal.clear();
+	for (sf_count_t i = 0; i < got; i += ep.decimate) {
+		signal.push_back(all[i*sfinfo.channels + ep.channel]*sc);
+	}
+
+	fs = (double)sfinfo.samplerate/ep.decimate;
+
+	return true;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	ExtractParams ep;
+	ep.channel = 0;
+	ep.decimate = 2;
+	ep.frameSize = 512;
+	ep.overlap = 128;
+	ep.w = 30;
+	ep.d = 15;
+
+	string outName;
+	vector<string> files;
+
+	//parse args
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg.size() > 2 && arg.substr(0,2) == "--" && i+1 < argc) {
+			string val(argv[++i]);
+			if (arg == "--channel") ep.channel = atoi(val.c_str());
+			else if (arg == "--decimate") ep.decimate = atoi(val.c_str());
+			else if (arg == "--frameSize") ep.frameSize = atoi(val.c_str());
+			else if (arg == "--overlap") ep.overlap = atoi(val.c_str());
+			else if (arg == "--nwindows") ep.w = atoi(val.c_str());
+			else if (arg == "--ncoeffs") ep.d = atoi(val.c_str());
+			else if (arg == "--list") {
+				FILE * lf = fopen(val.c_str(), "r");
+				if (lf == NULL) {
+					printf("could not open list %s\n", val.c_str());
+					return -1;
+				}
+				char line[4096];
+				while (fgets(line, sizeof(line), lf) != NULL) {
+					line[strcspn(line, "\r\n")] = '\0';
+					if (line[0] != '\0') {
+						files.push_back(line);
+					}
+				}
+				fclose(lf);
+			}
+			else {
+				printf("unknown option %s\n", arg.c_str());
+				return -1;
+			}
+		}
+		else if (outName.empty()) {
+			outName = arg;
+		}
+		else {
+			files.push_back(arg);
+		}
+	}
+
+	if (outName.empty() || files.empty() || ep.decimate < 1 ||
+			ep.frameSize <= 2*ep.overlap || ep.d >= ep.w) {
+		printf("usage: %s [options] out.feat file1.wav file2.wav ...\n", argv[0]);
+		return -1;
+	}
+
+	FeatureStoreWriter store;
+	if (!store.open(outName.c_str(), ep.d)) {
+		printf("could not open %s for writing\n", outName.c_str());
+		return -1;
+	}
+
+	//one processor per worker, remade only if the sample rate changes
+	int nWorkers = 1;
+#ifdef _OPENMP
+	nWorkers = omp_get_max_threads();
+#endif
+	vector<MFCCProcessor *> procs(nWorkers, (MFCCProcessor *)NULL);
+	vector<double> procFs(nWorkers, 0.0);
+
+	int nFiles = files.size();
+	int nDone = 0, nFailed = 0;
+
+#pragma omp parallel for ordered schedule(dynamic,1) num_threads(nWorkers)
+	for (int f = 0; f < nFiles; f++) {
+
+		int w = 0;
+#ifdef _OPENMP
+		w = omp_get_thread_num();
+#endif
+
+		vector<double> signal;
+		double fs;
+		bool ok = readSignal(files[f].c_str(), ep, signal, fs);
+
+		vector<double> feats;
+		int frames = 0;
+
+		if (ok) {
+
+			//the fftw planner is not reentrant
+			if (procs[w] == NULL || procFs[w] != fs) {
+#pragma omp critical (fftw_planner)
+				{
+					delete procs[w];
+					procs[w] = new MFCCProcessor(ep.d, ep.w, ep.frameSize, ep.overlap, fs, 0.0, fs/2.0, false);
+				}
+				procFs[w] = fs;
+			}
+
+			MFCCProcessor * M = procs[w];
+			M->flushPipeline();
+			if (signal.size() > 0) {
+				M->pushData(&signal[0], signal.size());
+			}
+
+			feats.resize((signal.size()/(ep.frameSize-2*ep.overlap) + 1)*ep.d);
+			while ((frames+1)*ep.d <= (int)feats.size() && M->getMFCCs(&feats[frames*ep.d])) {
+				frames++;
+			}
+
+		}
+
+		//entries are written in input order, so the store doesn't depend on
+		//which worker finishes first
+#pragma omp ordered
+		{
+			if (ok) {
+				ok = store.addEntry(files[f].c_str(), frames > 0 ? &feats[0] : NULL, frames);
+			}
+			if (ok) {
+				nDone++;
+			} else {
+				nFailed++;
+			}
+			printf("[%d/%d] %s: %d frames%s\n", nDone+nFailed, nFiles, files[f].c_str(), frames, ok ? "" : " (FAILED)");
+		}
+
+	}
+
+	for (int w = 0; w < nWorkers; w++) {
+		delete procs[w];
+	}
+
+	if (!store.close()) {
+		printf("error writing %s\n", outName.c_str());
+		return -1;
+	}
+
+	printf("wrote %d sequences to %s (%d failed)\n", nDone, outName.c_str(), nFailed);
+
+	return nFailed > 0 ? 1 : 0;
+
+}
@@ -4,8 +4,8 @@
 #include "mfcc.h"
 
 
-MFCCProcessor::MFCCProcessor(int c_, int m_, int n_, int overlap_, double fs_, double fl_, double fh_, bool getZeroth)
-	: m(m_), n(n_), c(c_), fs(fs_), fl(fl_), fh(fh_), overlap(overlap_), z(getZeroth) {
+MFCCProcessor::MFCCProcessor(int c_, int m_, int n_, int overlap_, double fs_, double fl_, double fh_, bool getZeroth, bool usePower)
+	: m(m_), n(n_), c(c_), fs(fs_), fl(fl_), fh(fh_), overlap(overlap_), z(getZeroth), power(usePower) {
 
 	//set up processing
 	init();
@@ -15,61 +15,68 @@ MFCCProcessor::MFCCProcessor(int c_, int m_, int n_, int overlap_, double fs_, d
 MFCCProcessor::~MFCCProcessor() {
 
 	//destroy fftw things
-	fftw_destroy_plan(p);
-	fftw_destroy_plan(q);
+	MFCC_FFTW(destroy_plan)(p);
+	MFCC_FFTW(destroy_plan)(q);
 
-	fftw_free(out);
-	delete tmfcc;
+	MFCC_FFTW(free)(out);
+	MFCC_FFTW(free)(tmfcc);
+	reserveBatch(0);
 
 	//clear out data
-	data.clear();
+	delete [] ring;
 
-	delete frame;
-	delete logEnergy;
+	MFCC_FFTW(free)(frame);
+	MFCC_FFTW(free)(spec);
+	MFCC_FFTW(free)(logEnergy);
 
 	//clear out window
-	delete window;
+	delete [] window;
 
 	//clear out banks
-	for (int i = 0; i < m; i++) {
-		delete banks[i];
-	}
-	delete banks;
+	delete [] bankStart;
+	delete [] bankLen;
+	delete [] bankOff;
+	delete [] bankW;
 
 }
 
 void MFCCProcessor::init() {
 
 	//get a queue and then flush it
-	data.clear();
+	ring = NULL;
+	ringSize = 0;
+	head = 0;
+	count = 0;
+	reserve(2*n);
 	flushPipeline();
 
 	//fill in the banks
-	banks = new double * [m];
-	for (int i = 0; i < m; i++) {
-		banks[i] = new double[n/2];
-	}
-
 	fillBanks();
 
 	//set up windowing function (hamming)
-	window = new double[n];
+	window = new mfcc_real[n];
 	for (int i = 0; i < n; i++) {
 		window[i] = 0.54 + 0.46*cos((double)(2*PI*(-(n/2)+i)/n));
 	}
 
 	//grab space for processing
-	//frame = new double[n];
-	//logEnergy = new double[m];
-	frame = (double*) fftw_malloc(sizeof(double) * n);
-	logEnergy = (double*) fftw_malloc(sizeof(double) * m);
+	frame = (mfcc_real*) MFCC_FFTW(malloc)(sizeof(mfcc_real) * n);
+	spec = (mfcc_real*) MFCC_FFTW(malloc)(sizeof(mfcc_real) * (n/2));
+	logEnergy = (mfcc_real*) MFCC_FFTW(malloc)(sizeof(mfcc_real) * m);
 
 	//set up fft/dct stuff
-    out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * (n/2)+1);
-    //tmfcc = new double[m];
-    tmfcc = (double*) fftw_malloc(sizeof(double) * m);
-    p = fftw_plan_dft_r2c_1d(n, frame, out, NULL);
-    q = fftw_plan_r2r_1d(m, logEnergy, tmfcc, FFTW_REDFT10, NULL);
+    out = (mfcc_complex*) MFCC_FFTW(malloc)(sizeof(mfcc_complex) * (n/2+1));
+    tmfcc = (mfcc_real*) MFCC_FFTW(malloc)(sizeof(mfcc_real) * m);
+    p = MFCC_FFTW(plan_dft_r2c_1d)(n, frame, out, FFTW_MEASURE);
+    q = MFCC_FFTW(plan_r2r_1d)(m, logEnergy, tmfcc, FFTW_REDFT10, FFTW_MEASURE);
+
+	//batch stuff is set up on first use
+	bSize = 0;
+	bCap = 0;
+	bFrames = NULL;
+	bOut = NULL;
+	bLogEnergy = NULL;
+	bMfcc = NULL;
 
 }
 
@@ -84,35 +91,78 @@ void MFCCProcessor::fillBanks() {
 		cf[i] = (int)cf[i];
 	}
 
-	//fill in each bank
+	//find the support of each (triangular) bank, then fill in its weights
+	bankStart = new int[m];
+	bankLen = new int[m];
+	bankOff = new int[m];
+	int total = 0;
 	for (int i = 1; i < m+1; i++) {
-		for (int j = 0; j < n/2; j++) {
-			if (j < (int)cf[i-1]) {
-				banks[i-1][j] = 0;
-			}
-			else if (j >= (int)cf[i-1] && j < (int)cf[i]) {
-				banks[i-1][j] = (double)(j-cf[i-1])/(cf[i]-cf[i-1]);
-			}
-			else if (j >= (int)cf[i] && j < (int)cf[i+1]) {
-				banks[i-1][j] = (double)(cf[i+1]-j)/(cf[i+1]-cf[i]);
+		int s = max((int)cf[i-1], 0);
+		int e = min((int)cf[i+1], n/2);
+		bankStart[i-1] = s;
+		bankLen[i-1] = max(e-s, 0);
+		bankOff[i-1] = total;
+		total += bankLen[i-1];
+	}
+
+	bankW = new mfcc_real[max(total, 1)];
+	for (int i = 1; i < m+1; i++) {
+		mfcc_real * w = bankW + bankOff[i-1];
+		for (int k = 0; k < bankLen[i-1]; k++) {
+			int j = bankStart[i-1] + k;
+			if (j < (int)cf[i]) {
+				w[k] = (double)(j-cf[i-1])/(cf[i]-cf[i-1]);
 			}
 			else {
-				banks[i-1][j] = 0;
+				w[k] = (double)(cf[i+1]-j)/(cf[i+1]-cf[i]);
 			}
 		}
 	}
 
-	delete cf;
+	delete [] cf;
 
 }
 
-bool MFCCProcessor::pushData(double * incData, int l) {
+/* reserve - make room for at least l queued samples
+ *
+ * the ring grows by doubling, so its size stays a power of 2 and
+ * indices can be wrapped with a mask
+ */
+void MFCCProcessor::reserve(int l) {
 
+	if (l <= ringSize) {
+		return;
+	}
+
+	int newSize = (ringSize > 0) ? ringSize : 1;
+	while (newSize < l) {
+		newSize *= 2;
+	}
 
-	for (int i = 0; i < l; i++) {
-		data.push_back(incData[i]);
+	//unwrap the queued samples into the new ring
+	mfcc_real * newRing = new mfcc_real[newSize];
+	for (int i = 0; i < count; i++) {
+		newRing[i] = ring[(head+i) & (ringSize-1)];
 	}
 
+	delete [] ring;
+	ring = newRing;
+	ringSize = newSize;
+	head = 0;
+
+}
+
+bool MFCCProcessor::pushData(double * incData, int l) {
+
+	reserve(count+l);
+
+	//copy in at most two contiguous pieces
+	int tail = (head+count) & (ringSize-1);
+	int first = min(l, ringSize-tail);
+	copy(incData, incData+first, ring+tail);
+	copy(incData+first, incData+l, ring);
+	count += l;
+
 	return true;
 
 }
@@ -120,7 +170,8 @@ bool MFCCProcessor::pushData(double * incData, int l) {
 void MFCCProcessor::flushPipeline() {
 
 	//clear out the queue
-	data.clear();
+	head = 0;
+	count = 0;
 
 	/*
 	//prime it with some zeros
@@ -134,7 +185,7 @@ void MFCCProcessor::flushPipeline() {
 
 int MFCCProcessor::queuedSamples() {
 
-	return data.size();
+	return count;
 
 }
 
@@ -143,15 +194,53 @@ void MFCCProcessor::zeroPad(int n, int side) {
 	//side <= 0 -> pad front of queue
 	//side > 0	-> pad back of queue
 
+	reserve(count+overlap);
+
 	if (side > 0) {
 		for (int i = 0; i < overlap; i++) {
-			data.push_back(0.0);
+			ring[(head+count+i) & (ringSize-1)] = 0.0;
 		}
 	} else {
+		head = (head-overlap) & (ringSize-1);
 		for (int i = 0; i < overlap; i++) {
-			data.push_front(0.0);
+			ring[(head+i) & (ringSize-1)] = 0.0;
 		}
 	}
+	count += overlap;
+
+}
+
+/* projectBanks - log filterbank energies of one frame
+ *
+ * input parameters:
+ *
+ * 		o - dft of the frame (n/2+1 bins)
+ * 		logE - log10 energy in each bank (to be filled, m values)
+ *
+ */
+void MFCCProcessor::projectBanks(const mfcc_complex * o, mfcc_real * logE) {
+
+	//magnitude (or power) spectrum in one pass over the bins
+	for (int j = 0; j < n/2; j++) {
+		spec[j] = o[j][0]*o[j][0]+o[j][1]*o[j][1];
+	}
+	if (!power) {
+		for (int j = 0; j < n/2; j++) {
+			spec[j] = sqrt(spec[j]);
+		}
+	}
+
+	//project onto banks (only the bins each bank covers)
+	for (int i = 0; i < m; i++) {
+		const mfcc_real * w = bankW + bankOff[i];
+		const mfcc_real * x = spec + bankStart[i];
+		mfcc_real e = 0.0;
+		for (int k = 0; k < bankLen[i]; k++) {
+			e += x[k]*w[k];
+		}
+		//take log
+		logE[i] = log10(e);
+	}
 
 }
 
@@ -159,42 +248,37 @@ void MFCCProcessor::zeroPad(int n, int side) {
  *
  * input parameters:
  *
- * 		mfccs - list of cepstral coeffs (to be filled)
+ * 		mfccs - list of cepstral coeffs (to be filled, c values)
  *
  */
-bool MFCCProcessor::getMFCCs(double *& mfccs) {
+bool MFCCProcessor::getMFCCs(double * mfccs) {
 
 	//check for a frame
-	//if (data.empty()) {
-	if (data.size() < n) {
+	if (count < n) {
 
 		return false;
 
 	}
 	else {
 
-		mfccs = new double[c];
-
-		copy(data.begin(),data.begin()+n,frame);
-		for (int i = 0; i < n; i++) {
-			frame[i] *= window[i];
+		//window straight out of the ring (at most two pieces)
+		int first = min(n, ringSize-head);
+		const mfcc_real * src = ring+head;
+		for (int i = 0; i < first; i++) {
+			frame[i] = src[i]*window[i];
+		}
+		for (int i = first; i < n; i++) {
+			frame[i] = ring[i-first]*window[i];
 		}
 
 		//take dft
-		fftw_execute(p);
+		MFCC_FFTW(execute)(p);
 
-		//project abs onto banks
-		for (int i = 0; i < m; i++) {
-			logEnergy[i] = 0.0;
-			for (int j = 0; j < n/2; j++) {
-				logEnergy[i] += sqrt(out[j][0]*out[j][0]+out[j][1]*out[j][1])*banks[i][j];
-			}
-			//take log
-			logEnergy[i] = log10(logEnergy[i]);
-		}
+		//project abs onto banks, take log
+		projectBanks(out, logEnergy);
 
 		//take DCT
-		fftw_execute(q);
+		MFCC_FFTW(execute)(q);
 
 		//loadout
 		for (int i = 0; i < c; i++) {
@@ -206,12 +290,157 @@ bool MFCCProcessor::getMFCCs(double *& mfccs) {
 		}
 
 		//de-queue a 'frame' (frameSize = n-2*overlap)
-		for (int i = 0; i < (n-overlap*2); i++) {
-			data.pop_front();
-		}
+		int step = n-overlap*2;
+		head = (head+step) & (ringSize-1);
+		count -= step;
 
 	}
 
 	return true;
 
 }
+
+/* batchFrames - number of frames batchMFCCs gets out of a signal
+ *
+ * input parameters:
+ *
+ * 		length - number of samples in (each channel of) the signal
+ *
+ */
+int MFCCProcessor::batchFrames(int length) {
+
+	int step = n-overlap*2;
+	if (length < n || step <= 0) {
+		return 0;
+	}
+	return (length-n)/step + 1;
+
+}
+
+/* reserveBatch - (re)plan the batch transforms for l frames
+ *
+ * the buffers only ever grow (geometrically); the plans are redone
+ * whenever the number of frames changes, with FFTW_ESTIMATE so that is
+ * cheap. l = 0 releases everything
+ */
+void MFCCProcessor::reserveBatch(int l) {
+
+	if (l > 0 && l == bSize) {
+		return;
+	}
+
+	if (bSize > 0) {
+		MFCC_FFTW(destroy_plan)(bp);
+		MFCC_FFTW(destroy_plan)(bq);
+		bSize = 0;
+	}
+
+	if (l <= 0 || l > bCap) {
+		MFCC_FFTW(free)(bFrames);
+		MFCC_FFTW(free)(bOut);
+		MFCC_FFTW(free)(bLogEnergy);
+		MFCC_FFTW(free)(bMfcc);
+		bFrames = NULL;
+		bOut = NULL;
+		bLogEnergy = NULL;
+		bMfcc = NULL;
+		bCap = 0;
+	}
+
+	if (l <= 0) {
+		return;
+	}
+
+	if (bCap == 0) {
+		int size = 1;
+		while (size < l) {
+			size *= 2;
+		}
+
+		bFrames = (mfcc_real*) MFCC_FFTW(malloc)(sizeof(mfcc_real) * n * size);
+		bOut = (mfcc_complex*) MFCC_FFTW(malloc)(sizeof(mfcc_complex) * (n/2+1) * size);
+		bLogEnergy = (mfcc_real*) MFCC_FFTW(malloc)(sizeof(mfcc_real) * m * size);
+		bMfcc = (mfcc_real*) MFCC_FFTW(malloc)(sizeof(mfcc_real) * m * size);
+		bCap = size;
+	}
+
+	//one plan each for all frames: frames are contiguous rows
+	int nf = n, nh = n/2+1;
+	MFCC_FFTW(r2r_kind) kind = FFTW_REDFT10;
+	bp = MFCC_FFTW(plan_many_dft_r2c)(1, &nf, l, bFrames, NULL, 1, n,
+			bOut, NULL, 1, nh, FFTW_ESTIMATE);
+	bq = MFCC_FFTW(plan_many_r2r)(1, &m, l, bLogEnergy, NULL, 1, m,
+			bMfcc, NULL, 1, m, &kind, FFTW_ESTIMATE);
+
+	bSize = l;
+
+}
+
+/* batchMFCCs - calculate the MFCCs for whole signals at once
+ *
+ * frames are taken every n-2*overlap samples, as in streaming mode, but
+ * the streaming queue is not touched. all channels share the filterbank
+ * and a single fft plan covering every frame. the batch plans are made
+ * with FFTW_ESTIMATE, the streaming ones with FFTW_MEASURE, and fftw may
+ * pick different algorithms for them, so a channel's MFCCs equal what
+ * getMFCCs() gives for the same frames only within FFT rounding.
+ *
+ * input parameters:
+ *
+ * 		signal - K channels of length samples each
+ * 		K - number of channels
+ * 		length - number of samples per channel
+ * 		mfccs - cepstral coeffs (to be filled, K*batchFrames(length) rows of
+ * 				c values; channel k's frames start at row k*batchFrames(length))
+ *
+ * returns the number of frames per channel
+ */
+int MFCCProcessor::batchMFCCs(double ** signal, int K, int length, double * mfccs) {
+
+	int F = batchFrames(length);
+	int step = n-overlap*2;
+	int total = K*F;
+
+	if (total <= 0) {
+		return 0;
+	}
+
+	reserveBatch(total);
+
+	//window all the frames into the batch
+	for (int k = 0; k < K; k++) {
+		for (int f = 0; f < F; f++) {
+			const double * src = signal[k] + f*step;
+			mfcc_real * dst = bFrames + (k*F+f)*n;
+			for (int i = 0; i < n; i++) {
+				dst[i] = src[i]*window[i];
+			}
+		}
+	}
+
+	//take all dfts
+	MFCC_FFTW(execute)(bp);
+
+	//project abs onto banks, take log
+	for (int t = 0; t < total; t++) {
+		projectBanks(bOut + t*(n/2+1), bLogEnergy + t*m);
+	}
+
+	//take all DCTs
+	MFCC_FFTW(execute)(bq);
+
+	//loadout
+	for (int t = 0; t < total; t++) {
+		const mfcc_real * cc = bMfcc + t*m;
+		for (int i = 0; i < c; i++) {
+			if (z) {
+				mfccs[t*c+i] = cc[i];
+			} else {
+				mfccs[t*c+i] = cc[i+1];
+			}
+		}
+	}
+
+	return F;
+
+}
@@ -6,7 +6,7 @@
 #include <math.h>
 #include <fftw3.h>
 #include <stdlib.h>
-#include <deque>
+#include <string.h>
 #include <algorithm>
 //#include <vector>
 
@@ -14,6 +14,20 @@
 //misc defines
 #define PI 3.14159
 
+//sample type used inside the processor. build with MFCC_FLOAT to run the
+//ring, fft and filterbank in single precision (links against fftw3f)
+#ifdef MFCC_FLOAT
+typedef float mfcc_real;
+typedef fftwf_complex mfcc_complex;
+typedef fftwf_plan mfcc_plan;
+#define MFCC_FFTW(name) fftwf_ ## name
+#else
+typedef double mfcc_real;
+typedef fftw_complex mfcc_complex;
+typedef fftw_plan mfcc_plan;
+#define MFCC_FFTW(name) fftw_ ## name
+#endif
+
 using namespace std;
 
 class MFCCProcessor  {
@@ -21,7 +35,7 @@ class MFCCProcessor  {
 public:
 
 	//constructor/destructor
-	MFCCProcessor(int c_, int m_, int n_, int overlap_, double fs_, double fl_, double fh_, bool getZeroth);
+	MFCCProcessor(int c_, int m_, int n_, int overlap_, double fs_, double fl_, double fh_, bool getZeroth, bool usePower = false);
 	virtual ~MFCCProcessor();
 
 	//logistics
@@ -31,7 +45,9 @@ public:
 	void zeroPad(int, int);
 
 	//processing
-	bool getMFCCs(double *&);
+	bool getMFCCs(double *);
+	int batchFrames(int);
+	int batchMFCCs(double **, int, int, double *);
 
 
 private:
@@ -39,6 +55,9 @@ private:
 	//auxiliary functions
 	void init();
 	void fillBanks();
+	void reserve(int);
+	void projectBanks(const mfcc_complex *, mfcc_real *);
+	void reserveBatch(int);
 
 	//parameters
 	int m;			//number of filterbanks to use
@@ -49,22 +68,40 @@ private:
 	double fl;		//filter bank low freq
 	double fh;		//filter bank high freq
 	int overlap;	//num of samples to take from prev and next buff
-
-	//banks
-	double ** banks;
-	double * window;
-
-	//data queue
-	deque<double> data;
-	//vector<double> data;
-	double * frame;
-	double * logEnergy;
+	bool power;		//use the power spectrum instead of the magnitude
+
+	//banks (sparse: bank i covers bins bankStart[i]..bankStart[i]+bankLen[i]-1,
+	//with weights starting at bankW+bankOff[i])
+	int * bankStart;
+	int * bankLen;
+	int * bankOff;
+	mfcc_real * bankW;
+	mfcc_real * window;
+
+	//data queue (ring buffer, capacity is a power of 2)
+	mfcc_real * ring;
+	int ringSize;
+	int head;		//index of the oldest sample
+	int count;		//number of queued samples
+	mfcc_real * frame;
+	mfcc_real * spec;		//magnitude (or power) spectrum of the frame
+	mfcc_real * logEnergy;
 
 	//fftw/dct data holders
-    fftw_complex *out;
-	double * tmfcc;
-    fftw_plan p;
-    fftw_plan q;
+    mfcc_complex *out;
+	mfcc_real * tmfcc;
+    mfcc_plan p;
+    mfcc_plan q;
+
+	//batch mode: many windowed frames in, one fft/dct plan for all
+	int bSize;			//frames the batch plans are made for
+	int bCap;			//frames the batch buffers can hold
+	mfcc_real * bFrames;
+	mfcc_complex * bOut;
+	mfcc_real * bLogEnergy;
+	mfcc_real * bMfcc;
+    mfcc_plan bp;
+    mfcc_plan bq;
 
 
 };
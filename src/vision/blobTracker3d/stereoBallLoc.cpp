@@ -34,6 +34,8 @@
 #include <stdlib.h>
 #include <deque>
 
+#include "../stereoSync/stereoSync.h"
+
 //namespaces
 using namespace std;
 using namespace cv;
@@ -50,8 +52,7 @@ protected:
 	ResourceFinder &rf;
 	string name;
 
-	BufferedPort<ImageOf<PixelRgb> > *portImgL;
-	BufferedPort<ImageOf<PixelRgb> > *portImgR;
+	StereoSync<ImageOf<PixelRgb> > input;	//left/right images matched by timestamp
 	BufferedPort<ImageOf<PixelRgb> > *portImgD;
 	BufferedPort<Bottle>			 *portDetLoc;
 
@@ -71,13 +72,9 @@ public:
         name=rf.check("name",Value("stereoBallLoc")).asString().c_str();
         tol=rf.check("tol",Value(5.0)).asDouble();
 
-        portImgL=new BufferedPort<ImageOf<PixelRgb> >;
-        string portImlName="/"+name+"/img:l";
-        portImgL->open(portImlName.c_str());
-
-        portImgR=new BufferedPort<ImageOf<PixelRgb> >;
-        string portImrName="/"+name+"/img:r";
-        portImgR->open(portImrName.c_str());
+        input.open("/"+name+"/img:l", "/"+name+"/img:r");
+        input.setTolerance(rf.check("syncTol",Value(0.01)).asDouble(), 0.0,
+        		rf.check("syncAge",Value(0.5)).asDouble());
 
         portImgD=new BufferedPort<ImageOf<PixelRgb> >;
         string portImdName="/"+name+"/img:o";
@@ -127,9 +124,10 @@ public:
     virtual void run()
     {
 
-        // get both input images
-        ImageOf<PixelRgb> *pImgL=portImgL->read(false);
-        ImageOf<PixelRgb> *pImgR=portImgR->read(false);
+        // get both input images, taken at the same time
+        ImageOf<PixelRgb> *pImgL, *pImgR;
+        yarp::sig::Vector *pHead;
+        bool havePair = input.getPair(pImgL, pImgR, pHead);
         ImageOf<PixelRgb> *tImg;
 
         ImageOf<PixelFloat> *pImgBRL;
@@ -137,7 +135,7 @@ public:
         ImageOf<PixelFloat> *oImg;
 
         //if we have both images
-        if (pImgL && pImgR)
+        if (havePair)
         {
 
         	//set up processing
@@ -284,20 +282,16 @@ public:
     virtual void threadRelease()
     {
 
-    	portImgL->interrupt();
-    	portImgR->interrupt();
+    	input.interrupt();
     	portImgD->interrupt();
     	portDetLoc->interrupt();
     	portGazeRpc->interrupt();
 
-    	portImgL->close();
-    	portImgR->close();
+    	input.close();
     	portImgD->close();
     	portDetLoc->close();
     	portGazeRpc->close();
 
-    	delete portImgL;
-    	delete portImgR;
     	delete portImgD;
     	delete portDetLoc;
     	delete portGazeRpc;
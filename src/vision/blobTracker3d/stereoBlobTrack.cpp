@@ -43,7 +43,10 @@
  *  	name					-- module port basename (D /stereoBlobTrack)
  *  	robot					-- robot name, changes default traj time values (D icub)
  *  	mode					-- output data mode; arg should be either 'xyz' for cart or 'azelv' for azimuth/elevation/vergence (D xyz)
- *  	verbose					-- setting flag makes the position echo to stdout when triggered
+ *  	syncTol					-- max. timestamp difference (s) between left and right images (D 0.01)
+ *  	syncAge					-- unpaired images are dropped after this long (s) (D 0.5)
+ *  	verbose					-- setting flag makes the position echo to stdout when triggered (and prints
+ *  								the stereo pairing latency)
  *
  *  outputs:
  *  	/stereoBlobTrack/img:o  -- debug image, shows right threshold image w/ target blob locations marked
@@ -77,6 +80,8 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include "../stereoSync/stereoSync.h"
+
 //namespaces
 using namespace std;
 using namespace cv;
@@ -96,8 +101,7 @@ protected:
 	ResourceFinder &rf;
 	string name;
 
-	BufferedPort<ImageOf<PixelRgb> > *portImgL;
-	BufferedPort<ImageOf<PixelRgb> > *portImgR;
+	StereoSync<ImageOf<PixelRgb> > input;	//left/right images matched by timestamp
 	BufferedPort<ImageOf<PixelRgb> > *portImgD;
 	BufferedPort<yarp::sig::Vector>  *portPos;
 
@@ -174,13 +178,9 @@ public:
 		}
 
 		//open up ports
-		portImgL=new BufferedPort<ImageOf<PixelRgb> >;
-		string portImlName="/"+name+"/img:l";
-		portImgL->open(portImlName.c_str());
-
-		portImgR=new BufferedPort<ImageOf<PixelRgb> >;
-		string portImrName="/"+name+"/img:r";
-		portImgR->open(portImrName.c_str());
+		input.open("/"+name+"/img:l", "/"+name+"/img:r");
+		input.setTolerance(rf.check("syncTol",Value(0.01)).asDouble(), 0.0,
+				rf.check("syncAge",Value(0.5)).asDouble());
 
 		portImgD=new BufferedPort<ImageOf<PixelRgb> >;
 		string portImdName="/"+name+"/img:o";
@@ -219,9 +219,10 @@ public:
 	virtual void run()
 	{
 
-		// get both input images
-		ImageOf<PixelRgb> *pImgL=portImgL->read(false);
-		ImageOf<PixelRgb> *pImgR=portImgR->read(false);
+		// get both input images, taken at the same time
+		ImageOf<PixelRgb> *pImgL, *pImgR;
+		yarp::sig::Vector *pHead;
+		bool havePair = input.getPair(pImgL, pImgR, pHead);
 		ImageOf<PixelRgb> *tImg;
 
 		ImageOf<PixelFloat> *pImgBRL;
@@ -229,7 +230,7 @@ public:
 		ImageOf<PixelFloat> *oImg;
 
 		//if we have both images
-		if (pImgL && pImgR)
+		if (havePair)
 		{
 
 			//set up processing
@@ -344,6 +345,9 @@ public:
 				du = (loc[0] - 160 + loc[2] -160)/2.0;
 				dv = (loc[1] - 120 + loc[3] -120)/2.0;
 				printf("left/right average divergence: %f\n", sqrt(du*du+dv*dv));
+				if (verbose) {
+					printf("stereo pairing latency: %f, skew: %f, dropped: %d\n", input.getLatency(), input.getSkew(), input.getDropped());
+				}
 				if (sqrt(du*du+dv*dv) < tol) {
 
 					if (!stopped) {
@@ -406,18 +410,14 @@ public:
 
 		clientGazeCtrl.close();
 
-		portImgL->interrupt();
-		portImgR->interrupt();
+		input.interrupt();
 		portImgD->interrupt();
 		portPos->interrupt();
 
-		portImgL->close();
-		portImgR->close();
+		input.close();
 		portImgD->close();
 		portPos->close();
 
-		delete portImgL;
-		delete portImgR;
 		delete portImgD;
 		delete portPos;
 
@@ -0,0 +1,119 @@
+/*
+ *  centerSurround.h
+ *
+ * 	random center-surround salience kernel used by csSalience (see there for
+ * 	the paper). every pixel of an interleaved L*a*b float image is compared
+ * 	against one shared set of random centers, so the cost is (centers)*(w*h):
+ * 	with a fixed number of centers it is linear in image size. rows are split
+ * 	across threads when OpenMP is available; centers come from a counter based
+ * 	rng, so the result depends only on the key, not on the number of threads.
+ * 	csSalienceBench.cpp times this over several image sizes (BUILD_CS_BENCH).
+ *
+ */
+
+#ifndef CENTERSURROUND_H_
+#define CENTERSURROUND_H_
+
+#include <cv.h>
+
+#include <math.h>
+#include <vector>
+
+//namespaces
+using namespace cv;
+
+//default number of centers per frame
+#define CS_DEFAULT_CENTERS 128
+
+/* CSCenters
+ * Desc: center samples, stored flat so the inner loop runs over contiguous
+ * arrays. kept by the caller so buffers are reused between frames
+ */
+struct CSCenters {
+	std::vector<float> x, y, l, a, b;
+};
+
+/* csMix
+ * Desc: splitmix64 finalizer, used as a counter based rng
+ */
+inline unsigned long long csMix(unsigned long long x) {
+
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+
+}
+
+/* csUniform
+ * Desc: k-th uniform [0,1) draw of the stream with the given key
+ */
+inline double csUniform(unsigned long long key, unsigned long long k) {
+	return (csMix(key + k) >> 11)*(1.0/9007199254740992.0);
+}
+
+/* centerSurroundSal
+ * Desc: random center-surround salience of the interleaved Lab image M
+ * (CV_32FC3, as scaled by cvtColor) into N (CV_32FC3). nc center pixels are
+ * drawn from the stream key, and every pixel accumulates its color difference
+ * to each of them over their (integer) distance, with weight w
+ */
+inline void centerSurroundSal(const Mat &M, Mat &N, int nc, float w,
+		unsigned long long key, CSCenters &cen) {
+
+	const int rows = M.rows, cols = M.cols;
+	N.create(rows, cols, CV_32FC3);
+	N.setTo(Scalar::all(0));
+	if (nc <= 0) {
+		return;
+	}
+
+	cen.x.resize(nc); cen.y.resize(nc);
+	cen.l.resize(nc); cen.a.resize(nc); cen.b.resize(nc);
+
+	for (int i = 0; i < nc; i++) {
+		int x = (int)(cols*csUniform(key, 2*i));
+		int y = (int)(rows*csUniform(key, 2*i+1));
+		const float * f = M.ptr<float>(y) + 3*x;
+		cen.x[i] = x; cen.y[i] = y;
+		cen.l[i] = f[0]; cen.a[i] = f[1]; cen.b[i] = f[2];
+	}
+
+	const float * cx = &cen.x[0], * cy = &cen.y[0];
+	const float * cl = &cen.l[0], * ca = &cen.a[0], * cb = &cen.b[0];
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < rows; y++) {
+
+		const float * f = M.ptr<float>(y);
+		float * n = N.ptr<float>(y);
+		const float sy = y;
+
+		for (int x = 0; x < cols; x++) {
+
+			const float sx = x;
+			const float sl = f[3*x], sa = f[3*x+1], sb = f[3*x+2];
+			float accL = 0.0f, accA = 0.0f, accB = 0.0f;
+
+			//a center on the pixel itself is skipped (zero weight)
+#if defined(_OPENMP) && _OPENMP >= 201307
+			#pragma omp simd reduction(+:accL,accA,accB)
+#endif
+			for (int i = 0; i < nc; i++) {
+				float dx = cx[i] - sx, dy = cy[i] - sy;
+				float dd = dx*dx + dy*dy;
+				float inv = dd > 0 ? 1.0f/floorf(sqrtf(dd)) : 0.0f;
+				accL += fabsf(cl[i] - sl)*inv;
+				accA += fabsf(ca[i] - sa)*inv;
+				accB += fabsf(cb[i] - sb)*inv;
+			}
+
+			n[3*x] = w*accL; n[3*x+1] = w*accA; n[3*x+2] = w*accB;
+
+		}
+
+	}
+
+}
+
+#endif
@@ -12,17 +12,153 @@
  *
  *		s = 255 - min(rn, gn, bn)
  *
+ *	the image is processed a row at a time: each row is split into float channel
+ *	arrays, run through a branch-free SSE/AVX kernel (plain C++ elsewhere) that
+ *	writes the salience row directly, and the normalized pixels are packed back.
+ *	rows are split across threads when OpenMP is available. results are bit-exact
+ *	with normalizeColorRef, the original per-pixel version, except for pure black
+ *	pixels, where that gives 0/0 (NaN salience); these now get 0 for both outputs.
+ *	normalizeColorBench.cpp checks this over every color (BUILD_COLOR_BENCH).
  *
  */
 
+#ifndef COLORTRANSFORM_H_
+#define COLORTRANSFORM_H_
 
 #include <yarp/sig/Image.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 //namespaces
 using namespace yarp::sig;
 
-//apply color normalization and invert to get color based salience
-void normalizeColor(ImageOf<PixelRgb> &src, ImageOf<PixelRgb> &dst, ImageOf<PixelFloat> &sal) {
+//images below this many pixels are not worth splitting across threads
+#define NORMCOLOR_PAR_MIN 65536
+
+/* normalizeColorSpan
+ * Desc: normalize n pixels given as float channel arrays r, g, b into rn, gn, bn
+ * and write their color salience to s
+ */
+inline void normalizeColorSpan(const float *r, const float *g, const float *b,
+		float *rn, float *gn, float *bn, float *s, int n) {
+
+	int i = 0;
+
+#ifdef __AVX__
+	const __m256 k255x8 = _mm256_set1_ps(255.0f), zerox8 = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		__m256 R = _mm256_loadu_ps(r+i), G = _mm256_loadu_ps(g+i), B = _mm256_loadu_ps(b+i);
+		__m256 blk = _mm256_cmp_ps(_mm256_max_ps(R, _mm256_max_ps(G, B)), zerox8, _CMP_EQ_OQ);
+		__m256 qr = _mm256_min_ps(_mm256_div_ps(_mm256_mul_ps(k255x8, R), _mm256_max_ps(G, B)), k255x8);
+		__m256 qg = _mm256_min_ps(_mm256_div_ps(_mm256_mul_ps(k255x8, G), _mm256_max_ps(B, R)), k255x8);
+		__m256 qb = _mm256_min_ps(_mm256_div_ps(_mm256_mul_ps(k255x8, B), _mm256_max_ps(R, G)), k255x8);
+		qr = _mm256_andnot_ps(blk, qr);
+		qg = _mm256_andnot_ps(blk, qg);
+		qb = _mm256_andnot_ps(blk, qb);
+		__m256 c = _mm256_min_ps(qr, _mm256_min_ps(qg, qb));
+		_mm256_storeu_ps(rn+i, qr);
+		_mm256_storeu_ps(gn+i, qg);
+		_mm256_storeu_ps(bn+i, qb);
+		_mm256_storeu_ps(s+i, _mm256_andnot_ps(blk, _mm256_sub_ps(k255x8, c)));
+	}
+#endif
+
+#ifdef __SSE2__
+	const __m128 k255 = _mm_set1_ps(255.0f), zero = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 R = _mm_loadu_ps(r+i), G = _mm_loadu_ps(g+i), B = _mm_loadu_ps(b+i);
+		__m128 blk = _mm_cmpeq_ps(_mm_max_ps(R, _mm_max_ps(G, B)), zero);
+		__m128 qr = _mm_min_ps(_mm_div_ps(_mm_mul_ps(k255, R), _mm_max_ps(G, B)), k255);
+		__m128 qg = _mm_min_ps(_mm_div_ps(_mm_mul_ps(k255, G), _mm_max_ps(B, R)), k255);
+		__m128 qb = _mm_min_ps(_mm_div_ps(_mm_mul_ps(k255, B), _mm_max_ps(R, G)), k255);
+		qr = _mm_andnot_ps(blk, qr);
+		qg = _mm_andnot_ps(blk, qg);
+		qb = _mm_andnot_ps(blk, qb);
+		__m128 c = _mm_min_ps(qr, _mm_min_ps(qg, qb));
+		_mm_storeu_ps(rn+i, qr);
+		_mm_storeu_ps(gn+i, qg);
+		_mm_storeu_ps(bn+i, qb);
+		_mm_storeu_ps(s+i, _mm_andnot_ps(blk, _mm_sub_ps(k255, c)));
+	}
+#endif
+
+	//same arithmetic as the vector paths: a zero divisor gives inf, which
+	//saturates at 255, and 0/0 only happens for black
+	for (; i < n; i++) {
+		float qr = 255.0f*r[i]/(g[i] > b[i] ? g[i] : b[i]);
+		float qg = 255.0f*g[i]/(b[i] > r[i] ? b[i] : r[i]);
+		float qb = 255.0f*b[i]/(r[i] > g[i] ? r[i] : g[i]);
+		qr = qr < 255.0f ? qr : 255.0f;
+		qg = qg < 255.0f ? qg : 255.0f;
+		qb = qb < 255.0f ? qb : 255.0f;
+		bool blk = r[i] == 0.0f && g[i] == 0.0f && b[i] == 0.0f;
+		float c = qr < qg ? qr : qg;
+		c = c < qb ? c : qb;
+		rn[i] = blk ? 0.0f : qr;
+		gn[i] = blk ? 0.0f : qg;
+		bn[i] = blk ? 0.0f : qb;
+		s[i] = blk ? 0.0f : 255.0f - c;
+	}
+
+}
+
+/* normalizeColorRow
+ * Desc: one image row of w pixels. buf is scratch space for 6*w floats
+ */
+inline void normalizeColorRow(const unsigned char *in, unsigned char *out, float *sal, float *buf, int w) {
+
+	float *r = buf, *g = buf + w, *b = buf + 2*w;
+	float *rn = buf + 3*w, *gn = buf + 4*w, *bn = buf + 5*w;
+
+	for (int i = 0; i < w; i++) {
+		r[i] = in[3*i]; g[i] = in[3*i+1]; b[i] = in[3*i+2];
+	}
+
+	normalizeColorSpan(r, g, b, rn, gn, bn, sal, w);
+
+	for (int i = 0; i < w; i++) {
+		out[3*i] = (unsigned char)rn[i];
+		out[3*i+1] = (unsigned char)gn[i];
+		out[3*i+2] = (unsigned char)bn[i];
+	}
+
+}
+
+//apply color normalization and invert to get color based salience. nthreads
+//limits the number of threads (0 -- OpenMP default)
+inline void normalizeColor(ImageOf<PixelRgb> &src, ImageOf<PixelRgb> &dst, ImageOf<PixelFloat> &sal, int nthreads = 0) {
+
+	dst.resize(src);
+	sal.resize(src);
+
+	const int w = src.width(), h = src.height();
+	const bool par = w*h >= NORMCOLOR_PAR_MIN && nthreads != 1;
+#ifdef _OPENMP
+	const int nt = nthreads > 0 ? nthreads : omp_get_max_threads();
+#endif
+
+	#pragma omp parallel num_threads(nt) if(par)
+	{
+		float * buf = new float[6*w];
+		#pragma omp for schedule(static)
+		for (int j = 0; j < h; j++) {
+			normalizeColorRow(src.getRow(j), dst.getRow(j), (float *)sal.getRow(j), buf, w);
+		}
+		delete [] buf;
+	}
+
+}
+
+//original per-pixel implementation, kept as the reference the kernel is checked against
+inline void normalizeColorRef(ImageOf<PixelRgb> &src, ImageOf<PixelRgb> &dst, ImageOf<PixelFloat> &sal) {
 
 
 	dst.resize(src);
@@ -66,3 +202,5 @@ void normalizeColor(ImageOf<PixelRgb> &src, ImageOf<PixelRgb> &dst, ImageOf<Pixe
 	}
 
 }
+
+#endif
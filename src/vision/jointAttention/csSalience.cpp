@@ -39,6 +39,14 @@
  *		scale		-- scale factor to apply to final image (D 1.0)
  *		mfsize		-- window size of median filter (D 3)
  *		ds			-- downsampling image by ds before processing (D 1 -- no resizing)
+ *		csamples	-- number of center samples per frame, at most sratio*w*h. every pixel is
+ *						compared against all of them, and contributions are reweighted so the
+ *						map keeps the scale of the paper's sampling. the count doesn't depend
+ *						on image size, so the cost is linear in w*h (D 0 -- 128 centers)
+ *		seed		-- rng seed. samples depend only on the seed and frame count, not on the
+ *						number of threads (D 0 -- seeded from the clock)
+ *		server		-- shared memory name of a salienceServer to take the L*a*b image from,
+ *						instead of converting img:i here (O)
  *		name		-- module port basename (D /csSalience)
  *
  *	outputs:
@@ -64,9 +72,10 @@
 #include <math.h>
 #include <stdlib.h>
 #include <deque>
+#include <vector>
 
-#include <gsl/gsl_randist.h>
-#include <gsl/gsl_rng.h>
+#include "../salienceServer/salienceShm.h"
+#include "centerSurround.h"
 
 //namespaces
 using namespace std;
@@ -90,10 +99,16 @@ protected:
 	int ds;
 	int mfsize;
 	int d1, d2;
+	int csamples;
 
-	//rng
-	const gsl_rng_type * T;
-	gsl_rng * r;
+	//rng state: samples are a function of (seed, frame, sample index)
+	unsigned long long seed;
+	unsigned long long frame;
+
+	//center samples, kept between frames
+	CSCenters cen;
+
+	SalienceShmReader * shm;
 
 public:
 
@@ -108,6 +123,8 @@ public:
 		ds = rf.check("ds",Value(1)).asInt();
 		mfsize = rf.check("mfsize",Value(3)).asInt();
 		scale = rf.check("scale", Value(1.0)).asDouble();
+		csamples = rf.check("csamples", Value(0)).asInt();
+		seed = rf.check("seed", Value(0)).asInt();
 
 		portImgIn=new BufferedPort<ImageOf<PixelRgb> >;
 		string portInName="/"+name+"/img:i";
@@ -118,48 +135,33 @@ public:
 		portImgOut->open(portOutName.c_str());
 
 		//setup rng
-		gsl_rng_default_seed = time(NULL);
-		gsl_rng_env_setup();
-		T = gsl_rng_default;
-		r = gsl_rng_alloc (T);
-
-		return true;
-
-	}
+		if (seed == 0) {
+			seed = time(NULL);
+		}
+		frame = 0;
 
-	void centerSurroundSal(const Mat *M, Mat *N, int d1, int d2) {
-
-		int x1, y1, x2, y2, dst;
-		double * fv = new double[3];
-		N[0] = Mat::zeros(M[0].rows, M[0].cols, CV_32F);
-		N[1] = Mat::zeros(M[1].rows, M[1].cols, CV_32F);
-		N[2] = Mat::zeros(M[2].rows, M[2].cols, CV_32F);
-		for (int i = 0; i < d1; i++) {
-			x1 = (int)(N[0].cols*gsl_rng_uniform(r));
-			y1 = (int)(N[0].rows*gsl_rng_uniform(r));
-			for (int k = 0; k < 3; k++) {
-				fv[k] = M[k].at<float>(y1,x1);
-			}
-			for (int j = 0; j < d2; j++) {
-				x2 = (int)(N[0].cols*gsl_rng_uniform(r));
-				y2 = (int)(N[0].rows*gsl_rng_uniform(r));
-				if (!(x1 == x2 && y1 == y2)) {
-					dst = sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2));
-					for (int k = 0; k < 3; k++) {
-						N[k].at<float>(y2,x2) = N[k].at<float>(y2,x2) +
-								abs(fv[k]-M[k].at<float>(y2,x2))/dst;
-					}
-				}
-			}
+		shm = NULL;
+		if (rf.check("server")) {
+			shm = new SalienceShmReader;
+			shm->open(rf.find("server").asString().c_str());
 		}
 
+		return true;
+
 	}
 
 	virtual void run()
 	{
 
-		// get inputs
-		ImageOf<PixelRgb> *pImgIn=portImgIn->read(false);
+		// get inputs (with a server, pImgIn is already in L*a*b)
+		ImageOf<PixelRgb> *pImgIn = NULL;
+		if (shm) {
+			if (shm->read(SALSHM_BIT(SALSHM_LAB))) {
+				pImgIn = &shm->lab;
+			}
+		} else {
+			pImgIn = portImgIn->read(false);
+		}
 
 		// process camera image
 		if (pImgIn)
@@ -169,60 +171,62 @@ public:
 
 			double timein = Time::now();
 
-			//convert to L*a*b space
-			Mat I((IplImage *)pImgIn->getIplImage(), true);
-			Mat J, K;
-			cvtColor(I,I,CV_RGB2Lab);
-			I.convertTo(J, CV_32FC3);
-
+			//convert to L*a*b space (into a new image, pImgIn is the port's
+			//buffer and must not be written)
+			Mat I((IplImage *)pImgIn->getIplImage(), false);
+			Mat Lab, J, K;
+			if (shm) {
+				Lab = I;
+			} else {
+				cvtColor(I, Lab, CV_RGB2Lab);
+			}
+			Lab.convertTo(J, CV_32FC3);
 
 			//downsample for processing if so desired
 			if (ds > 1) {
 				resize(J, K, Size(), 1.0/(float)ds, 1.0/(float)ds);
+			} else {
+				K = J;
 			}
 
-			//split the image up into channels
-			Mat * C = new Mat[3];
-			split(K, C);
-
-			//undo the scaling done by cvtColor
-			C[0] = C[0]*100.0/255.0;
-			C[1] = C[1]-128.0;
-			C[2] = C[2]-128.0;
-
-			//get single channel center-surround salience values
-			Mat * S = new Mat[3];
-			Mat L, A, B, Ls, As, Bs;
-			d1 = d2 = (int)(sratio*K.rows*K.cols);
-			centerSurroundSal(C, S, d1, d2);
+			//get center-surround salience values for all three channels. the
+			//a/b offsets cvtColor adds cancel in the differences, and the L
+			//scaling is undone when the channels are combined
+			//the paper pairs each of d1 centers with d2 random surround pixels,
+			//so a pixel meets d1*d2/(w*h) centers on average. every pixel is
+			//compared against a fixed number of shared centers instead, weighted
+			//to keep the expected map, so the cost is linear in image size
+			Mat S, Sm, R;
+			const double npx = (double)K.rows*K.cols;
+			d1 = d2 = (int)(sratio*npx);
+			int nc = csamples > 0 ? csamples : CS_DEFAULT_CENTERS;
+			if (nc > d1) nc = d1;
+			float w = nc > 0 ? d1*(double)d2/(npx*nc) : 0.0f;
+			centerSurroundSal(K, S, nc, w, csMix(seed ^ csMix(frame++)), cen);
 
 			//median filter each channel
 			if (mfsize == 1) {
-				S[0].copyTo(Ls);
-				S[1].copyTo(As);
-				S[2].copyTo(Bs);
+				Sm = S;
 			} else {
-				medianBlur(S[0], Ls, mfsize);
-				medianBlur(S[1], As, mfsize);
-				medianBlur(S[2], Bs, mfsize);
+				medianBlur(S, Sm, mfsize);
 			}
 
 			//resample to original image size
 			if (ds > 1) {
-				resize(Ls, L, Size(J.cols, J.rows));
-				resize(As, A, Size(J.cols, J.rows));
-				resize(Bs, B, Size(J.cols, J.rows));
+				resize(Sm, R, Size(J.cols, J.rows));
+			} else {
+				R = Sm;
 			}
 
 			//create the combined map
 			imgOut.resize(*pImgIn);
-			double val;
-			for (int i = 0; i < imgOut.width(); i++) {
-				for (int j = 0; j < imgOut.height(); j++) {
-					val = scale*sqrt(L.at<float>(j,i)*L.at<float>(j,i) +
-							A.at<float>(j,i)*A.at<float>(j,i) +
-							B.at<float>(j,i)*B.at<float>(j,i));
-					imgOut.pixel(i,j) = val;
+			const float lsc = 100.0/255.0;
+			for (int j = 0; j < imgOut.height(); j++) {
+				const float * f = R.ptr<float>(j);
+				float * o = (float *)imgOut.getRow(j);
+				for (int i = 0; i < imgOut.width(); i++) {
+					float l = lsc*f[3*i];
+					o[i] = scale*sqrt(l*l + f[3*i+1]*f[3*i+1] + f[3*i+2]*f[3*i+2]);
 				}
 			}
 			portImgOut->write();
@@ -240,8 +244,7 @@ public:
 
 		delete portImgIn;
 		delete portImgOut;
-
-		gsl_rng_free (r);
+		delete shm;
 
 	}
 
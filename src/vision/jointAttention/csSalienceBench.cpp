@@ -0,0 +1,133 @@
+/*
+ *  csSalienceBench.cpp
+ *
+ * 	times centerSurroundSal (centerSurround.h) with the default number of
+ * 	centers on a synthetic L*a*b image at 160x120 up to 1280x960, and checks
+ * 	that the time per pixel stays flat, i.e. that the cost is linear in image
+ * 	size. also checks that the map doesn't depend on the number of threads.
+ *
+ * 	built when BUILD_CS_BENCH is on. exits nonzero if the time per pixel at
+ * 	any size is more than CS_BENCH_TOL times that at the smallest size, or if
+ * 	the threaded map differs from the single threaded one
+ *
+ *  usage: csSalienceBench [threads]	(D 0 -- OpenMP default)
+ *
+ */
+
+#include <cv.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "centerSurround.h"
+
+//namespaces
+using namespace cv;
+
+#define CS_BENCH_SIZES 4
+#define CS_BENCH_TOL 1.5
+#define CS_BENCH_PIXELS 20000000.0
+
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+/* makeScene
+ * Desc: smooth gradient with a few blocks of distinct color, in cvtColor's
+ * 8 bit Lab scaling
+ */
+static void makeScene(Mat &M, int cols, int rows) {
+
+	M.create(rows, cols, CV_32FC3);
+	for (int y = 0; y < rows; y++) {
+		float * f = M.ptr<float>(y);
+		for (int x = 0; x < cols; x++) {
+			float l = 255.0f*x/cols, a = 128.0f, b = 128.0f + 40.0f*y/rows;
+			if ((x*8/cols + y*6/rows) % 5 == 0) {
+				l = 200.0f; a = 60.0f; b = 190.0f;
+			}
+			f[3*x] = l; f[3*x+1] = a; f[3*x+2] = b;
+		}
+	}
+
+}
+
+int main(int argc, char *argv[]) {
+
+	int nthreads = (argc > 1) ? atoi(argv[1]) : 0;
+#ifdef _OPENMP
+	if (nthreads <= 0) {
+		nthreads = omp_get_max_threads();
+	}
+#else
+	nthreads = 1;
+#endif
+
+	const int sizes[CS_BENCH_SIZES][2] = {{160,120}, {320,240}, {640,480}, {1280,960}};
+	double perPx[CS_BENCH_SIZES];
+	long badThread = 0;
+	bool slow = false;
+
+	CSCenters cen;
+	Mat M, N, N1;
+
+	for (int s = 0; s < CS_BENCH_SIZES; s++) {
+
+		const int cols = sizes[s][0], rows = sizes[s][1];
+		const double npx = (double)cols*rows;
+		makeScene(M, cols, rows);
+
+		//same weighting as csSalience at the default sratio
+		int d1 = (int)(0.03*npx);
+		int nc = CS_DEFAULT_CENTERS < d1 ? CS_DEFAULT_CENTERS : d1;
+		float w = d1*(double)d1/(npx*nc);
+
+		//threads don't change the map
+#ifdef _OPENMP
+		omp_set_num_threads(1);
+#endif
+		centerSurroundSal(M, N1, nc, w, csMix(s), cen);
+#ifdef _OPENMP
+		omp_set_num_threads(nthreads);
+#endif
+		centerSurroundSal(M, N, nc, w, csMix(s), cen);
+		for (int y = 0; y < rows; y++) {
+			if (memcmp(N.ptr<float>(y), N1.ptr<float>(y), 3*cols*sizeof(float)) != 0) {
+				badThread++;
+			}
+		}
+
+		//enough frames for about the same total work at each size
+		int reps = (int)(CS_BENCH_PIXELS/npx);
+		if (reps < 1) reps = 1;
+		double t0 = now();
+		for (int r = 0; r < reps; r++) {
+			centerSurroundSal(M, N, nc, w, csMix(r), cen);
+		}
+		double t = (now() - t0)/reps;
+		perPx[s] = t/npx;
+
+		printf("%dx%d: %d centers, %.2fms/frame, %.2fns/pixel\n",
+				cols, rows, nc, 1e3*t, 1e9*perPx[s]);
+
+		if (perPx[s] > CS_BENCH_TOL*perPx[0]) {
+			slow = true;
+		}
+
+	}
+
+	printf("rows differing across thread counts: %ld\n", badThread);
+	printf("time per pixel %s (threads %d)\n", slow ? "grows with image size" : "flat", nthreads);
+
+	return (badThread || slow) ? 1 : 0;
+
+}
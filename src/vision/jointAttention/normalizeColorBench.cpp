@@ -0,0 +1,90 @@
+/*
+ *  normalizeColorBench.cpp
+ *
+ * 	checks normalizeColor (colorTransform.h) against normalizeColorRef, the
+ * 	original per-pixel version, over every 24 bit color, and times both. the
+ * 	colors are laid out as one 4096x4096 image. outputs have to match bit for
+ * 	bit, except for black, where the reference gives 0/0 (NaN salience); black
+ * 	must come out as 0 for both maps.
+ *
+ * 	built when BUILD_COLOR_BENCH is on. exits nonzero on any mismatch
+ *
+ *  usage: normalizeColorBench [threads]	(D 0 -- OpenMP default)
+ *
+ */
+
+#include <yarp/sig/Image.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "colorTransform.h"
+
+//namespaces
+using namespace yarp::sig;
+
+#define BENCH_SIDE 4096
+
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+int main(int argc, char *argv[]) {
+
+	int nthreads = (argc > 1) ? atoi(argv[1]) : 0;
+
+	//every color once
+	ImageOf<PixelRgb> src, dRef, dNew;
+	ImageOf<PixelFloat> sRef, sNew;
+	src.resize(BENCH_SIDE, BENCH_SIDE);
+	for (int k = 0; k < BENCH_SIDE*BENCH_SIDE; k++) {
+		src.pixel(k % BENCH_SIDE, k / BENCH_SIDE) = PixelRgb(k & 255, (k >> 8) & 255, k >> 16);
+	}
+
+	double t0 = now();
+	normalizeColorRef(src, dRef, sRef);
+	double t1 = now();
+	normalizeColor(src, dNew, sNew, 1);
+	double t2 = now();
+	normalizeColor(src, dNew, sNew, nthreads);
+	double t3 = now();
+
+	long badDst = 0, badSal = 0, badBlack = 0;
+	for (int j = 0; j < BENCH_SIDE; j++) {
+		for (int i = 0; i < BENCH_SIDE; i++) {
+
+			PixelRgb p = src.pixel(i,j);
+			PixelRgb a = dRef.pixel(i,j), b = dNew.pixel(i,j);
+			float fa = sRef.pixel(i,j), fb = sNew.pixel(i,j);
+
+			if (p.r == 0 && p.g == 0 && p.b == 0) {
+				if (b.r != 0 || b.g != 0 || b.b != 0 || fb != 0.0f) {
+					badBlack++;
+				}
+				continue;
+			}
+
+			if (a.r != b.r || a.g != b.g || a.b != b.b) {
+				badDst++;
+			}
+			if (memcmp(&fa, &fb, sizeof(float)) != 0) {
+				badSal++;
+			}
+
+		}
+	}
+
+	printf("normalized image mismatches: %ld\n", badDst);
+	printf("salience mismatches: %ld\n", badSal);
+	printf("black pixel errors: %ld\n", badBlack);
+	printf("reference: %.3fs, kernel (1 thread): %.3fs, kernel (threads %d): %.3fs\n",
+			t1-t0, t2-t1, nthreads, t3-t2);
+
+	return (badDst || badSal || badBlack) ? 1 : 0;
+
+}
@@ -38,8 +38,9 @@
  * 			motion map is then temporally filtered with a leaky integrator, and the color salience
  * 			map is applied as a mask. detections are reported as the centroid of all points
  * 			above the threshold.
- * TODOs: yarp this. also maybe it should be possible to receive the salience maps so they only
- * 			get computed once? also it may be worthwhile to look at how this can be generalized
+ * 			with 'server <shm>' the image and both maps are taken from a running salienceServer
+ * 			instead of being computed here.
+ * TODOs: yarp this. also it may be worthwhile to look at how this can be generalized
  *
  */
 
@@ -66,6 +67,8 @@
 #include <stdlib.h>
 #include <deque>
 
+#include "../salienceServer/salienceShm.h"
+
 //namespaces
 using namespace std;
 using namespace cv;
@@ -95,6 +98,7 @@ protected:
 
 	MotionSalience * filter;
 	ColorSalience * cfilter;
+	SalienceShmReader * shm;
 
 	double alpha;
 	double detthresh;
@@ -141,6 +145,12 @@ public:
         cfilter = new ColorSalience;
         cfilter->open(rf);
 
+        shm = NULL;
+        if (rf.check("server")) {
+        	shm = new SalienceShmReader;
+        	shm->open(rf.find("server").asString().c_str());
+        }
+
         accu = new ImageOf<PixelFloat>;
         accu->resize(0,0);
         deccu = new ImageOf<PixelFloat>;
@@ -156,20 +166,34 @@ public:
     {
 
         // get inputs
-        ImageOf<PixelRgb> *pImgIn=portImgIn->read(false);
+        ImageOf<PixelRgb> *pImgIn = NULL;
+        if (shm) {
+        	if (shm->read(SALSHM_BIT(SALSHM_RGB) | SALSHM_BIT(SALSHM_MOTION) | SALSHM_BIT(SALSHM_VCOLOR))) {
+        		pImgIn = &shm->rgb;
+        	}
+        } else {
+        	pImgIn = portImgIn->read(false);
+        }
 
         // process camera image
         if (pImgIn)
         {
 
-        	ImageOf<PixelRgb> *pDest = new ImageOf<PixelRgb>;
-        	ImageOf<PixelFloat> *pSal = new ImageOf<PixelFloat>;
-        	ImageOf<PixelFloat> *cSal = new ImageOf<PixelFloat>;
+        	ImageOf<PixelRgb> *pDest = NULL;
+        	ImageOf<PixelFloat> *pSal, *cSal;
         	ImageOf<PixelRgb> &imgOut=portImgOut->prepare();
 
-        	//apply motion salience filter
-        	filter->apply(*pImgIn, *pDest, *pSal);
-        	cfilter->apply(*pImgIn, *pDest, *cSal);
+        	//apply motion salience filter (or take both maps from the server)
+        	if (shm) {
+        		pSal = &shm->motion;
+        		cSal = &shm->vcolor;
+        	} else {
+        		pDest = new ImageOf<PixelRgb>;
+        		pSal = new ImageOf<PixelFloat>;
+        		cSal = new ImageOf<PixelFloat>;
+        		filter->apply(*pImgIn, *pDest, *pSal);
+        		cfilter->apply(*pImgIn, *pDest, *cSal);
+        	}
 
         	//set up dimensions if first sample
         	if (accu->height() == 0 || accu->width() == 0) {
@@ -268,9 +292,11 @@ public:
 
             delete msk;
             delete C;
-            delete pDest;
-            delete pSal;
-            delete cSal;
+            if (!shm) {
+            	delete pDest;
+            	delete pSal;
+            	delete cSal;
+            }
 
         }
     }
@@ -291,6 +317,7 @@ public:
     	delete portImgOut;
     	delete portDetLoc;
     	delete filter;
+    	delete shm;
 
     }
 
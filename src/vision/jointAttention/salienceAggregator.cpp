@@ -34,6 +34,9 @@
  *  	colthresh	-- color salience threshold (D 50.0)
  *  	inthresh	-- intensity salience threshold (D 130.0)
  *  	minobjsize	-- minimum segmented obj size; smaller objects not chosen (D 100.0)
+ *  	server		-- shared memory name of a salienceServer. if given, the camera image and
+ *  					the color and intensity salience maps are taken from it, and img:i
+ *  					is not used (O)
  *  	name		-- module ports basename (D /objectSalience)
  *
  * outputs:
@@ -60,6 +63,7 @@
 #include <iCub/vis/Salience.h>
 #include <iCub/vis/IntensitySalience.h>
 #include "colorTransform.h"
+#include "../salienceServer/salienceShm.h"
 
 #include <cv.h>
 
@@ -95,6 +99,7 @@ protected:
 	BufferedPort<yarp::sig::Matrix>	*portObjOut;
 
 	IntensitySalience * ifilter;
+	SalienceShmReader * shm;
 
 	double colthresh, inthresh;
 	int minobjsize;
@@ -131,6 +136,12 @@ public:
 		ifilter = new IntensitySalience;
 		ifilter->open(rf);
 
+		shm = NULL;
+		if (rf.check("server")) {
+			shm = new SalienceShmReader;
+			shm->open(rf.find("server").asString().c_str());
+		}
+
 		return true;
 
 	}
@@ -139,24 +150,39 @@ public:
 	{
 
 		// get inputs
-		ImageOf<PixelRgb> *pImgIn=portImgIn->read(false);
+		ImageOf<PixelRgb> *pImgIn = NULL;
 		ImageOf<PixelRgb> *cDest = NULL;
 		ImageOf<PixelFloat> *cSal = NULL;
 		ImageOf<PixelFloat> *iSal = NULL;
-
+		if (shm) {
+			if (shm->read(SALSHM_BIT(SALSHM_RGB) | SALSHM_BIT(SALSHM_COLOR) | SALSHM_BIT(SALSHM_INTENSITY))) {
+				pImgIn = &shm->rgb;
+			}
+		} else {
+			pImgIn = portImgIn->read(false);
+		}
 
 		if (pImgIn) {
 
 			ImageOf<PixelRgb> &imgOut= portImgOut->prepare();
 			ImageOf<PixelFloat> *pJAIn = portGazeIn->read(true);
 
-			cDest = new ImageOf<PixelRgb>;
-			cSal = new ImageOf<PixelFloat>;
-			iSal = new ImageOf<PixelFloat>;
-			ifilter->apply(*pImgIn, *cDest, *iSal);
+			if (shm) {
+
+				cSal = &shm->color;
+				iSal = &shm->intensity;
 
-			//apply color normalization and invert to get color based salience
-			normalizeColor(*pImgIn, *cDest, *cSal);
+			} else {
+
+				cDest = new ImageOf<PixelRgb>;
+				cSal = new ImageOf<PixelFloat>;
+				iSal = new ImageOf<PixelFloat>;
+				ifilter->apply(*pImgIn, *cDest, *iSal);
+
+				//apply color normalization and invert to get color based salience
+				normalizeColor(*pImgIn, *cDest, *cSal);
+
+			}
 
 			Mat Y,Z,Tmp;
 			Mat * M = new Mat(cSal->height(), cSal->width(), CV_32F, (void *)cSal->getRawImage());
@@ -295,9 +321,11 @@ public:
 			delete Mt;
 			delete Nt;
 			delete mark;
-			delete cDest;
-			delete iSal;
-			delete cSal;
+			if (!shm) {
+				delete cDest;
+				delete iSal;
+				delete cSal;
+			}
 
 		}
 
@@ -318,6 +346,7 @@ public:
 		delete portImgOut;
 		delete portGazeIn;
 		delete portObjOut;
+		delete shm;
 
 	}
 
@@ -42,6 +42,8 @@
  * 		wta		-- flag to enable winner-take-all behavior. for each top-down event, only the closest
  * 					object is made salient. it is set to full (255.0) salience. (O)
  *	 	name	-- module basename (D /topDownObjMap)
+ *	 	server	-- shared memory name of a salienceServer. if given, the reference image and
+ *	 				its L*a*b conversion are taken from it instead of img:i (O)
  *
  *	 (feature extractor params)
  *	 	all		-- flag to turn on complete feature set, which is completely off by default
@@ -88,6 +90,7 @@
 //internal cv includes
 #include "visFeatExtractor.h"
 #include "colorTransform.h"
+#include "../salienceServer/salienceShm.h"
 
 //namespaces
 using namespace std;
@@ -182,6 +185,8 @@ protected:
 	int decaytime;
 	bool wta;
 
+	SalienceShmReader * shm;
+
 
 public:
 
@@ -195,6 +200,12 @@ public:
 		decaytime=rf.check("decay",Value(60)).asInt();
 		wta = rf.check("wta");
 
+		shm = NULL;
+		if (rf.check("server")) {
+			shm = new SalienceShmReader;
+			shm->open(rf.find("server").asString().c_str());
+		}
+
 		V = new visFeatures(false);
 		if (rf.check("all"))
 			V->setAllFeatures(true);
@@ -247,7 +258,14 @@ public:
 	{
 
 		//get latest image
-		ImageOf<PixelRgb> *pImgIn=portImgIn->read(false);
+		ImageOf<PixelRgb> *pImgIn = NULL;
+		if (shm) {
+			if (shm->read(SALSHM_BIT(SALSHM_RGB) | SALSHM_BIT(SALSHM_LAB))) {
+				pImgIn = &shm->rgb;
+			}
+		} else {
+			pImgIn = portImgIn->read(false);
+		}
 		ImageOf<PixelFloat> &mapOut= portMapOut->prepare();
 		ImageOf<PixelRgb> &imgOut= portImgOut->prepare();
 
@@ -284,7 +302,7 @@ public:
 						cts[j][0] = contours[i].at(j).y;
 						cts[j][1] = contours[i].at(j).x;
 					}
-					objFeatures.push_back(V->extractFeatures(*pImgIn, cts));
+					objFeatures.push_back(V->extractFeatures(*pImgIn, cts, shm ? &shm->lab : NULL));
 
 				}
 
@@ -388,6 +406,7 @@ public:
 		delete portImgOut;
 
 		delete V;
+		delete shm;
 
 	}
 
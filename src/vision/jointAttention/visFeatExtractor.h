@@ -94,8 +94,9 @@ public:
 
 	}
 
-	//extraction functions
-	yarp::sig::Vector extractFeatures(ImageOf<PixelRgb> &_IM, Matrix &_msk) {
+	//extraction functions. _lab is the image already in L*a*b (8 bit, as from
+	//cvtColor), if the caller has it; otherwise _IM is converted here
+	yarp::sig::Vector extractFeatures(ImageOf<PixelRgb> &_IM, Matrix &_msk, ImageOf<PixelRgb> *_lab = NULL) {
 
 		vector<Point> vp,hp;
 		vector<vector<Point> > objCont;
@@ -104,8 +105,13 @@ public:
 		double cArea, hArea;
 
 		//load in image and create the object mask
-		Mat I((IplImage *)_IM.getIplImage(), true);
-		cvtColor(I,I,CV_RGB2Lab);
+		Mat I;
+		if (_lab) {
+			I = Mat((IplImage *)_lab->getIplImage(), true);
+		} else {
+			I = Mat((IplImage *)_IM.getIplImage(), true);
+			cvtColor(I,I,CV_RGB2Lab);
+		}
 		Mat M = Mat::zeros(_IM.height(), _IM.width(), CV_8UC1);
 		for (int i = 0; i < _msk.rows(); i++) {
 
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2011 Logan Niehaus
+ *
+ * 	Author: Logan Niehaus
+ * 	Email:  niehaula@gmail.com
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *  salienceServer.cpp
+ *
+ * 	computes the low level feature maps of a camera stream once per frame and
+ * 	shares them with the attention modules on the same machine through shared
+ * 	memory (see salienceShm.h). modules started with 'server <shm>' take their
+ * 	camera image and maps from here instead of converting the image themselves.
+ *
+ * 	maps: the camera image, L*a*b (8 bit, as from cvtColor), the normalized color
+ * 	image and color salience (colorTransform.h), and the iCub::vis intensity,
+ * 	motion and color saliences.
+ *
+ *  inputs:
+ *  	/salienceServer/img:i	-- rgb input image
+ *
+ *  params:
+ *  	name	-- module port basename (D /salienceServer)
+ *  	shm		-- name of the shared memory segment (D /salienceServer)
+ *  	(the iCub::vis filters read their own parameters from the same config)
+ *
+ *  outputs:
+ *  	shared memory segment <shm>
+ *
+ */
+
+#include <yarp/os/Network.h>
+#include <yarp/os/RFModule.h>
+#include <yarp/os/BufferedPort.h>
+#include <yarp/os/RateThread.h>
+#include <yarp/os/Stamp.h>
+#include <yarp/os/Time.h>
+#include <yarp/sig/Image.h>
+
+#include <iCub/vis/Salience.h>
+#include <iCub/vis/IntensitySalience.h>
+#include <iCub/vis/MotionSalience.h>
+#include <iCub/vis/ColorSalience.h>
+
+#include <cv.h>
+
+#include <string>
+#include <stdio.h>
+
+#include "../jointAttention/colorTransform.h"
+#include "salienceShm.h"
+
+//namespaces
+using namespace std;
+using namespace cv;
+using namespace yarp;
+using namespace yarp::os;
+using namespace yarp::sig;
+using namespace iCub::vis;
+
+
+class salServerThread : public RateThread
+{
+protected:
+
+	ResourceFinder &rf;
+	string name;
+	string shmName;
+
+	BufferedPort<ImageOf<PixelRgb> > *portImgIn;
+	SalienceShmWriter shm;
+
+	IntensitySalience * ifilter;
+	MotionSalience * mfilter;
+	ColorSalience * cfilter;
+
+	//per frame maps, kept between frames
+	ImageOf<PixelRgb> lab, norm, tmp;
+	ImageOf<PixelFloat> color, intensity, motion, vcolor;
+
+public:
+
+	salServerThread(ResourceFinder &_rf) : RateThread(10), rf(_rf)
+	{ }
+
+	virtual bool threadInit()
+	{
+
+		name=rf.check("name",Value("salienceServer")).asString().c_str();
+		shmName=rf.check("shm",Value("/salienceServer")).asString().c_str();
+
+		portImgIn=new BufferedPort<ImageOf<PixelRgb> >;
+		string portInName="/"+name+"/img:i";
+		portImgIn->open(portInName.c_str());
+
+		ifilter = new IntensitySalience;
+		ifilter->open(rf);
+		mfilter = new MotionSalience;
+		mfilter->open(rf);
+		cfilter = new ColorSalience;
+		cfilter->open(rf);
+
+		return true;
+
+	}
+
+	virtual void run()
+	{
+
+		ImageOf<PixelRgb> *pImgIn=portImgIn->read(false);
+		if (!pImgIn) {
+			return;
+		}
+
+		Stamp st;
+		double stamp = (portImgIn->getEnvelope(st) && st.isValid()) ? st.getTime() : Time::now();
+
+		//(re)create the segment for this image size
+		if (!shm.ok() || shm.width() != pImgIn->width() || shm.height() != pImgIn->height()) {
+			if (!shm.open(shmName, pImgIn->width(), pImgIn->height())) {
+				fprintf(stderr, "could not create shared memory segment %s\n", shmName.c_str());
+				return;
+			}
+		}
+
+		//compute the maps
+		lab.resize(*pImgIn);
+		Mat I((IplImage *)pImgIn->getIplImage(), false);
+		Mat L((IplImage *)lab.getIplImage(), false);
+		cvtColor(I, L, CV_RGB2Lab);
+
+		normalizeColor(*pImgIn, norm, color);
+		ifilter->apply(*pImgIn, tmp, intensity);
+		mfilter->apply(*pImgIn, tmp, motion);
+		cfilter->apply(*pImgIn, tmp, vcolor);
+
+		//and publish them
+		shm.begin();
+		shm.put(SALSHM_RGB, *pImgIn);
+		shm.put(SALSHM_LAB, lab);
+		shm.put(SALSHM_NORM, norm);
+		shm.put(SALSHM_COLOR, color);
+		shm.put(SALSHM_INTENSITY, intensity);
+		shm.put(SALSHM_MOTION, motion);
+		shm.put(SALSHM_VCOLOR, vcolor);
+		shm.commit(stamp);
+
+	}
+
+	virtual void threadRelease()
+	{
+
+		portImgIn->interrupt();
+		portImgIn->close();
+		delete portImgIn;
+
+		ifilter->close();
+		mfilter->close();
+		cfilter->close();
+		delete ifilter;
+		delete mfilter;
+		delete cfilter;
+
+		shm.close();
+
+	}
+
+};
+
+class salServerModule: public RFModule
+{
+protected:
+	salServerThread *thr;
+
+public:
+	salServerModule() { }
+
+	virtual bool configure(ResourceFinder &rf)
+	{
+		Time::turboBoost();
+
+		thr=new salServerThread(rf);
+		if (!thr->start())
+		{
+			delete thr;
+			return false;
+		}
+
+		return true;
+	}
+
+	virtual bool close()
+	{
+		thr->stop();
+		delete thr;
+
+		return true;
+	}
+
+	virtual double getPeriod()    { return 1.0;  }
+	virtual bool   updateModule() { return true; }
+};
+
+
+int main(int argc, char *argv[])
+{
+
+	Network yarp;
+
+	if (!yarp.checkNetwork())
+		return -1;
+
+	ResourceFinder rf;
+
+	rf.configure("ICUB_ROOT",argc,argv);
+
+	salServerModule mod;
+
+	return mod.runModule(rf);
+}
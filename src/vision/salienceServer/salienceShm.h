@@ -0,0 +1,350 @@
+/*
+ *  salienceShm.h
+ *
+ * 	shared memory transport for the salience server. the server computes the
+ * 	per-frame feature maps once and writes them into a POSIX shared memory
+ * 	segment; modules on the same machine map the segment and copy out the maps
+ * 	they use, instead of each converting the camera image themselves.
+ *
+ * 	the segment holds a header and one slot per map, rows packed. a frame is
+ * 	guarded by a sequence counter which is odd while the server writes; readers
+ * 	retry the copy if the counter moved underneath them. if the server restarts
+ * 	or the image size changes the segment is recreated, and readers reattach on
+ * 	their next read. a server that died without letting go of the segment
+ * 	can't mark it, so readers also check every SALSHM_RECHECK seconds that the
+ * 	name still refers to the segment they have mapped.
+ *
+ *  usage:
+ *
+ *  	SalienceShmReader sal;
+ *  	sal.open("/salienceServer");
+ *  	...
+ *  	if (sal.read(SALSHM_BIT(SALSHM_RGB) | SALSHM_BIT(SALSHM_MOTION))) {
+ *  		... sal.rgb, sal.motion ...		//valid until the next read
+ *  	}
+ *
+ */
+
+#ifndef SALIENCESHM_H_
+#define SALIENCESHM_H_
+
+#include <yarp/sig/Image.h>
+
+#include <string>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SALSHM_MAGIC "SALSHM1"
+#define SALSHM_RECHECK		0.5		//seconds between reader checks for a replaced segment
+
+//maps in a frame
+#define SALSHM_RGB			0		//camera image (PixelRgb)
+#define SALSHM_LAB			1		//L*a*b, 8 bit as from cvtColor (PixelRgb)
+#define SALSHM_NORM			2		//normalized color image, see colorTransform.h (PixelRgb)
+#define SALSHM_COLOR		3		//normalized color salience (PixelFloat)
+#define SALSHM_INTENSITY	4		//iCub::vis intensity salience (PixelFloat)
+#define SALSHM_MOTION		5		//iCub::vis motion salience (PixelFloat)
+#define SALSHM_VCOLOR		6		//iCub::vis color salience (PixelFloat)
+#define SALSHM_NMAPS		7
+
+#define SALSHM_BIT(m)		(1u << (m))
+#define SALSHM_ALL			((1u << SALSHM_NMAPS) - 1)
+
+
+struct SalienceShmHeader {
+	char magic[8];
+	int width, height;
+	size_t size;						//whole segment, 0 once the server let go of it
+	size_t offset[SALSHM_NMAPS];
+	volatile unsigned int seq;			//odd while a frame is being written
+	volatile unsigned int frame;
+	double stamp;
+};
+
+//bytes per pixel of a map
+inline int salShmPixelSize(int m) {
+	return m <= SALSHM_NORM ? 3 : 4;
+}
+
+//monotonic clock, in seconds
+inline double salShmNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+//copy a map between an image and its slot (rows are packed in the slot)
+inline void salShmCopy(char * slot, yarp::sig::Image &img, int m, bool toSlot) {
+
+	size_t row = img.width()*salShmPixelSize(m);
+	for (int r = 0; r < img.height(); r++) {
+		if (toSlot) {
+			memcpy(slot + r*row, img.getRow(r), row);
+		} else {
+			memcpy(img.getRow(r), slot + r*row, row);
+		}
+	}
+
+}
+
+
+/* SalienceShmWriter
+ * Desc: server side of the segment
+ */
+class SalienceShmWriter {
+
+public:
+
+	SalienceShmWriter() : hdr(NULL), len(0) { }
+	~SalienceShmWriter() { close(); }
+
+	/* open
+	 * Desc: create the segment for maps of the given size (replacing any old one)
+	 */
+	bool open(const std::string &_name, int width, int height) {
+
+		close();
+		name = _name;
+
+		size_t off = (sizeof(SalienceShmHeader) + 63) & ~(size_t)63;
+		size_t offset[SALSHM_NMAPS];
+		for (int m = 0; m < SALSHM_NMAPS; m++) {
+			offset[m] = off;
+			off += ((size_t)width*height*salShmPixelSize(m) + 63) & ~(size_t)63;
+		}
+
+		shm_unlink(name.c_str());
+		int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0666);
+		if (fd < 0) {
+			return false;
+		}
+		if (ftruncate(fd, off) != 0) {
+			::close(fd);
+			shm_unlink(name.c_str());
+			return false;
+		}
+		void * p = mmap(NULL, off, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			shm_unlink(name.c_str());
+			return false;
+		}
+
+		hdr = (SalienceShmHeader *)p;
+		len = off;
+		memset(hdr, 0, sizeof(SalienceShmHeader));
+		hdr->width = width;
+		hdr->height = height;
+		memcpy(hdr->offset, offset, sizeof(offset));
+		hdr->size = len;
+		__sync_synchronize();
+		strcpy(hdr->magic, SALSHM_MAGIC);
+
+		return true;
+
+	}
+
+	/* close
+	 * Desc: unmap and remove the segment. readers still attached see size 0
+	 */
+	void close() {
+
+		if (hdr != NULL) {
+			hdr->size = 0;
+			__sync_synchronize();
+			munmap(hdr, len);
+			shm_unlink(name.c_str());
+			hdr = NULL;
+			len = 0;
+		}
+
+	}
+
+	bool ok() const { return hdr != NULL; }
+	int width() const { return hdr ? hdr->width : 0; }
+	int height() const { return hdr ? hdr->height : 0; }
+
+	//start a frame
+	void begin() {
+		hdr->seq++;
+		__sync_synchronize();
+	}
+
+	//copy one map of the current frame into its slot
+	void put(int m, yarp::sig::Image &img) {
+		if (img.width() == hdr->width && img.height() == hdr->height) {
+			salShmCopy((char *)hdr + hdr->offset[m], img, m, true);
+		}
+	}
+
+	//publish the frame
+	void commit(double stamp) {
+		hdr->stamp = stamp;
+		hdr->frame++;
+		__sync_synchronize();
+		hdr->seq++;
+	}
+
+private:
+
+	SalienceShmHeader * hdr;
+	size_t len;
+	std::string name;
+
+};
+
+
+/* SalienceShmReader
+ * Desc: consumer side. maps are copied out into the public images
+ */
+class SalienceShmReader {
+
+public:
+
+	yarp::sig::ImageOf<yarp::sig::PixelRgb> rgb, lab, norm;
+	yarp::sig::ImageOf<yarp::sig::PixelFloat> color, intensity, motion, vcolor;
+	double stamp;
+
+	SalienceShmReader() : stamp(0.0), hdr(NULL), len(0), lastFrame(0), lastCheck(0.0) { }
+	~SalienceShmReader() { close(); }
+
+	/* open
+	 * Desc: attach to the named segment. if the server isn't up yet this
+	 * returns false, and read keeps trying to attach
+	 */
+	bool open(const std::string &_name) {
+		name = _name;
+		return attach();
+	}
+
+	void close() {
+		if (hdr != NULL) {
+			munmap(hdr, len);
+			hdr = NULL;
+			len = 0;
+		}
+	}
+
+	bool ok() const { return hdr != NULL; }
+
+	/* read
+	 * Desc: copy the given maps (SALSHM_BIT mask) of the newest frame. returns
+	 * false if there is no frame newer than the last one read
+	 */
+	bool read(unsigned int maps) {
+
+		//drop a mapping whose server is gone or was replaced
+		double now = salShmNow();
+		if (hdr != NULL && now - lastCheck >= SALSHM_RECHECK) {
+			lastCheck = now;
+			if (replaced()) {
+				close();
+			}
+		}
+
+		if ((hdr == NULL || hdr->size != len) && !attach()) {
+			return false;
+		}
+
+		const int w = hdr->width, h = hdr->height;
+		yarp::sig::Image * img[SALSHM_NMAPS] = {&rgb, &lab, &norm, &color, &intensity, &motion, &vcolor};
+
+		for (int tries = 0; tries < 8; tries++) {
+
+			unsigned int s = hdr->seq;
+			__sync_synchronize();
+			if (s & 1) {
+				usleep(500);
+				continue;
+			}
+			if (hdr->frame == lastFrame) {
+				return false;
+			}
+
+			unsigned int f = hdr->frame;
+			double t = hdr->stamp;
+			for (int m = 0; m < SALSHM_NMAPS; m++) {
+				if (maps & SALSHM_BIT(m)) {
+					img[m]->resize(w, h);
+					salShmCopy((char *)hdr + hdr->offset[m], *img[m], m, false);
+				}
+			}
+
+			__sync_synchronize();
+			if (hdr->seq == s) {
+				lastFrame = f;
+				stamp = t;
+				return true;
+			}
+
+		}
+
+		return false;
+
+	}
+
+private:
+
+	SalienceShmHeader * hdr;
+	size_t len;
+	unsigned int lastFrame;
+	std::string name;
+	dev_t dev;						//identity of the mapped segment
+	ino_t ino;
+	double lastCheck;
+
+	//true if the name no longer refers to the mapped segment
+	bool replaced() {
+
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			return true;
+		}
+		struct stat st;
+		bool r = fstat(fd, &st) != 0 || st.st_dev != dev || st.st_ino != ino;
+		::close(fd);
+		return r;
+
+	}
+
+	bool attach() {
+
+		close();
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SalienceShmHeader)) {
+			::close(fd);
+			return false;
+		}
+		void * p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+
+		hdr = (SalienceShmHeader *)p;
+		len = st.st_size;
+		if (strncmp(hdr->magic, SALSHM_MAGIC, 8) != 0 || hdr->size != len) {
+			close();
+			return false;
+		}
+		dev = st.st_dev;
+		ino = st.st_ino;
+		lastFrame = 0;
+		lastCheck = salShmNow();
+
+		return true;
+
+	}
+
+};
+
+#endif
@@ -50,6 +50,11 @@
  *		nmaps					-- number of stereo map ports to open. maps are labeled /egoRemapper/mapN:l, with
  *										N ranging from 0 to nmaps-1 (D 1)
  *  	name					-- module port basename (D /egoRemapper)
+ *  	syncTol, syncHeadTol	-- max. timestamp difference (s) between left and right maps (D 0.01), and
+ *  								between a map pair and the head angles (D 0.02). see stereoSync.h
+ *  	syncAge					-- unpaired maps are dropped after this long (s) (D 0.5)
+ *  	warpTol					-- the warp maps are rebuilt only once some head joint has moved more
+ *  								than this (deg) from the pose they were made for (D 0.1)
  *  	verbose					-- setting flag makes the module shoot debug info to stdout
  *
  *  outputs:
@@ -85,6 +90,8 @@
 #include <iCub/iKin/iKinFwd.h>
 #include <iCub/ctrl/math.h>
 
+#include "../stereoSync/stereoSync.h"
+
 //namespaces
 using namespace std;
 using namespace cv;
@@ -119,9 +126,8 @@ protected:
 	ResourceFinder &rf;
 	string name;
 
-	BufferedPort<yarp::sig::Vector> *portHAngIn;
-	BufferedPort<ImageOf<PixelFloat> > **portImgL;
-	BufferedPort<ImageOf<PixelFloat> > **portImgR;
+	StampedPortBuffer<yarp::sig::Vector> headIn;		//head angles, shared by all the stereo inputs
+	StereoSync<ImageOf<PixelFloat> > **input;		//left/right maps matched by timestamp
 	BufferedPort<ImageOf<PixelFloat> > **portImgLO;
 	BufferedPort<ImageOf<PixelFloat> > **portImgRO;
 	BufferedPort<ImageOf<PixelFloat> > *portAggL;
@@ -147,15 +153,21 @@ protected:
 
 	//important matrices
 	Matrix rootToEgo, egoToRoot;
-	Matrix xrVals, yrVals, zrVals;
+	float * rayX, * rayY, * rayZ;	//root frame xyz of each egosphere pixel, row major
 	Mat * Mxl, * Myl, * Mxr, * Myr;
+	yarp::sig::Vector warpHead;		//head angles the maps were made for
+	double warpTol;
 
 	//mosaics and auxiliary objects
 	Mat ** mosaicl, ** mosaicr;
 	Mat * updMskL, * updMskR;
 	Mat * whtBlk;
-	Mat * maggL, * maggR;
-	Mat * msagL, * msagR;
+	Mat maggL, maggR;			//headers on the output port buffers, rebound each frame
+	Mat msagL, msagR;
+	Mat * outL, * outR;			//per map remapped outputs
+	Mat * mskL, * mskR;			//per map update masks (usually all the same buffer)
+	bool * fresh;				//per map, whether a new pair was remapped this frame
+	bool mskShared;				//current update masks are in use by a map this frame
 	bool status;
 
 	//aggregate image parameters
@@ -164,9 +176,17 @@ protected:
 
 public:
 
-	egoRemapperThread(ResourceFinder &_rf) : RateThread(50), rf(_rf)
+	egoRemapperThread(ResourceFinder &_rf) : RateThread(50), rf(_rf), headIn(32)
 	{ }
 
+	/* wrap
+	 * Desc: opencv header sharing the pixel buffer of a yarp float image
+	 */
+	static Mat wrap(ImageOf<PixelFloat> &img)
+	{
+		return Mat(img.height(), img.width(), CV_32F, (void *)img.getRawImage(), img.getRowSize());
+	}
+
 	bool getCamPrj(ResourceFinder &rf, const string &type, Matrix &Prj)
 	{
 		Bottle parType=rf.findGroup(type.c_str());
@@ -255,21 +275,21 @@ public:
 		//open up ports
 		string tmpName;
 		char mpnStr[10];
-		portImgL = new BufferedPort<ImageOf<PixelFloat> > * [nmaps];
-		portImgR = new BufferedPort<ImageOf<PixelFloat> > * [nmaps];
+		double syncTol = rf.check("syncTol",Value(0.01)).asDouble();
+		double syncHeadTol = rf.check("syncHeadTol",Value(0.02)).asDouble();
+		double syncAge = rf.check("syncAge",Value(0.5)).asDouble();
+		warpTol = rf.check("warpTol",Value(0.1)).asDouble();
+		input = new StereoSync<ImageOf<PixelFloat> > * [nmaps];
 		portImgLO = new BufferedPort<ImageOf<PixelFloat> > * [nmaps];
 		portImgRO = new BufferedPort<ImageOf<PixelFloat> > * [nmaps];
 		for (int i = 0; i < nmaps; i++) {
 
 			sprintf(mpnStr, "map%d", i);
 
-			portImgL[i] = new BufferedPort<ImageOf<PixelFloat> >;
-			tmpName = "/" + name + "/" + mpnStr + ":l";
-			portImgL[i]->open(tmpName.c_str());
-
-			portImgR[i] = new BufferedPort<ImageOf<PixelFloat> >;
-			tmpName = "/" + name + "/" + mpnStr + ":r";
-			portImgR[i]->open(tmpName.c_str());
+			input[i] = new StereoSync<ImageOf<PixelFloat> >;
+			input[i]->open("/" + name + "/" + mpnStr + ":l", "/" + name + "/" + mpnStr + ":r");
+			input[i]->attachHead(&headIn);
+			input[i]->setTolerance(syncTol, syncHeadTol, syncAge);
 
 			portImgLO[i] = new BufferedPort<ImageOf<PixelFloat> >;
 			tmpName = "/" + name + "/" + mpnStr + ":lo";
@@ -297,9 +317,7 @@ public:
 		string portSalRName="/"+name+"/sal:ro";
 		portSalRO->open(portSalRName.c_str());
 
-		portHAngIn=new BufferedPort<yarp::sig::Vector>;
-		string portHAngName="/"+name+"/pos:h";
-		portHAngIn->open(portHAngName.c_str());
+		headIn.open("/"+name+"/pos:h");
 
 		//define the root frame for the egosphere as the midpoint b/w eyes
 		eyeL = new iCubEye("left");
@@ -319,9 +337,9 @@ public:
 
 		//calculate and store the root xyz locs of the az/el map values for later use
 		double az, el;
-		xrVals.resize(erows, ecols); xrVals.zero();
-		yrVals.resize(erows, ecols); yrVals.zero();
-		zrVals.resize(erows, ecols); zrVals.zero();
+		rayX = new float[erows*ecols];
+		rayY = new float[erows*ecols];
+		rayZ = new float[erows*ecols];
 		yarp::sig::Vector xyzEgo(4);
 		yarp::sig::Vector xyzRoot(4);
 		for (int mi,mj,i = 0; i < erows; i++) {
@@ -337,7 +355,7 @@ public:
 
 				//output map should range from azlo/elhi in top left corner
 				mi = erows-1-i; mj = j;
-				xrVals(mi,mj) = xyzRoot(0); yrVals(mi,mj) = xyzRoot(1); zrVals(mi,mj) = xyzRoot(2);
+				rayX[mi*ecols+mj] = xyzRoot(0); rayY[mi*ecols+mj] = xyzRoot(1); rayZ[mi*ecols+mj] = xyzRoot(2);
 			}
 		}
 
@@ -356,6 +374,12 @@ public:
 			mosaicr[i] = new Mat(erows, ecols, CV_32F);
 			mosaicr[i]->setTo(Scalar(0));
 		}
+		outL = new Mat[nmaps];
+		outR = new Mat[nmaps];
+		mskL = new Mat[nmaps];
+		mskR = new Mat[nmaps];
+		fresh = new bool[nmaps];
+		mskShared = false;
 		updMskL = new Mat(erows, ecols, CV_32F);
 		updMskR = new Mat(erows, ecols, CV_32F);
 		whtBlk = new Mat(cyl*2, cxl*2, CV_32F);
@@ -365,152 +389,213 @@ public:
 
 	}
 
-	virtual void run()
+	/* setWarp
+	 * Desc: make the egosphere warping maps and update masks for the given head
+	 * angles. nothing is done if no joint has moved more than warpTol since the
+	 * maps were last made
+	 */
+	void setWarp(const yarp::sig::Vector &headAng)
 	{
 
+		if (warpHead.size() == headAng.size()) {
+			bool same = true;
+			for (int i = 0; i < (int)headAng.size(); i++) {
+				same = same && (fabs(warpHead[i] - headAng[i]) <= warpTol);
+			}
+			if (same) {
+				return;
+			}
+		}
+		warpHead = headAng;
+
 		//get the current head coordinates, assuming fixed torso for now
 		Matrix Hl, Hr;
-		yarp::sig::Vector *torsoAng = new yarp::sig::Vector(3);
-		yarp::sig::Vector *headAng = portHAngIn->read(true);
-		torsoAng->zero();
+		yarp::sig::Vector torsoAng(3);
+		torsoAng.zero();
 
 		//find the world to eye root matrices
 		yarp::sig::Vector angles(8);
-		angles[0] = (*torsoAng)[0]; angles[1] = (*torsoAng)[1]; angles[2] = (*torsoAng)[2];
-		angles[3] = (*headAng)[0]; angles[4] = (*headAng)[1];
-		angles[5] = (*headAng)[2]; angles[6] = (*headAng)[3];
-		angles[7] = (*headAng)[4] + (*headAng)[5]/2.0;
+		angles[0] = torsoAng[0]; angles[1] = torsoAng[1]; angles[2] = torsoAng[2];
+		angles[3] = headAng[0]; angles[4] = headAng[1];
+		angles[5] = headAng[2]; angles[6] = headAng[3];
+		angles[7] = headAng[4] + headAng[5]/2.0;
 		angles = PI*angles/180.0;
 		Hl = SE3inv(eyeL->getH(angles));
-		angles[7] = PI*((*headAng)[4] - (*headAng)[5]/2.0)/180.0;
+		angles[7] = PI*(headAng[4] - headAng[5]/2.0)/180.0;
 		Hr = SE3inv(eyeR->getH(angles));
 
-		//create spherical warping map for current configuration
-		Mxl->setTo(Scalar(-1)); Myl->setTo(Scalar(-1));
-		Mxr->setTo(Scalar(-1)); Myr->setTo(Scalar(-1));
+		//create spherical warping map for current configuration: transform the
+		//stored rays to xyz of each eye (z flipped so visible points are z > 0)
+		//and project. pixels behind a camera map to -1. the maps address the
+		//input image rotated by 180 deg (x -> w-1-x, y -> h-1-y, with w/h from
+		//the calibration), which keeps the output map convention without
+		//flipping the input first
+		float hl[12], hr[12];
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 4; c++) {
+				hl[4*r+c] = (r == 2 ? -1 : 1)*Hl(r,c);
+				hr[4*r+c] = (r == 2 ? -1 : 1)*Hr(r,c);
+			}
+		}
+		const float pl[4] = {(float)-fxl, (float)-fyl, (float)((int)(cxl*2)-1-cxl), (float)((int)(cyl*2)-1-cyl)};
+		const float pr[4] = {(float)-fxr, (float)-fyr, (float)((int)(cxr*2)-1-cxr), (float)((int)(cyr*2)-1-cyr)};
 
-		//transform to xyz of current eye root
-		yarp::sig::Vector xyz(4);
-		yarp::sig::Vector xyzLE(4);
-		yarp::sig::Vector xyzRE(4);
-		double u, v;
+		#pragma omp parallel for
 		for (int i = 0; i < erows; i++) {
+			const float * x = rayX + i*ecols;
+			const float * y = rayY + i*ecols;
+			const float * z = rayZ + i*ecols;
+			float * mxl = Mxl->ptr<float>(i), * myl = Myl->ptr<float>(i);
+			float * mxr = Mxr->ptr<float>(i), * myr = Myr->ptr<float>(i);
 			for (int j = 0; j < ecols; j++) {
-				xyz(0) = xrVals(i,j); xyz(1) = yrVals(i,j); xyz(2) = zrVals(i,j); xyz(3) = 1.0;
-				xyzLE = Hl*xyz;
-				xyzRE = Hr*xyz;
-				xyzLE(2) = -xyzLE(2); xyzRE(2) = -xyzRE(2);
-				if (xyzLE(2) > 0) {
-					u = xyzLE(0)/xyzLE(2); v = xyzLE(1)/xyzLE(2);
-					Mxl->at<float>(i,j) = u*fxl+cxl;
-					Myl->at<float>(i,j) = v*fyl+cyl;
-				}
-				if (xyzRE(2) > 0) {
-					u = xyzRE(0)/xyzRE(2); v = xyzRE(1)/xyzRE(2);
-					Mxr->at<float>(i,j) = u*fxr+cxr;
-					Myr->at<float>(i,j) = v*fyr+cyr;
-				}
+				float xl = hl[0]*x[j] + hl[1]*y[j] + hl[2]*z[j] + hl[3];
+				float yl = hl[4]*x[j] + hl[5]*y[j] + hl[6]*z[j] + hl[7];
+				float zl = hl[8]*x[j] + hl[9]*y[j] + hl[10]*z[j] + hl[11];
+				float xr = hr[0]*x[j] + hr[1]*y[j] + hr[2]*z[j] + hr[3];
+				float yr = hr[4]*x[j] + hr[5]*y[j] + hr[6]*z[j] + hr[7];
+				float zr = hr[8]*x[j] + hr[9]*y[j] + hr[10]*z[j] + hr[11];
+				float il = 1.0f/(zl > 0 ? zl : 1.0f);
+				float ir = 1.0f/(zr > 0 ? zr : 1.0f);
+				mxl[j] = zl > 0 ? xl*il*pl[0] + pl[2] : -1.0f;
+				myl[j] = zl > 0 ? yl*il*pl[1] + pl[3] : -1.0f;
+				mxr[j] = zr > 0 ? xr*ir*pr[0] + pr[2] : -1.0f;
+				myr[j] = zr > 0 ? yr*ir*pr[1] + pr[3] : -1.0f;
 			}
 		}
 
-		//create the update mask for mosaics
+		//create the update mask for mosaics. a map already remapped this frame
+		//keeps the mask it was made with, so only then is a new buffer needed
+		if (mskShared) {
+			*updMskL = Mat(erows, ecols, CV_32F);
+			*updMskR = Mat(erows, ecols, CV_32F);
+			mskShared = false;
+		}
 		remap(*whtBlk, *updMskL, *Mxl, *Myl, INTER_LINEAR);
 		remap(*whtBlk, *updMskR, *Mxr, *Myr, INTER_LINEAR);
 		erode(*updMskL, *updMskL, Mat());
 		erode(*updMskR, *updMskR, Mat());
 
+	}
+
+	virtual void run()
+	{
+
+		//wait for new head angles; each stereo pair is then remapped with the
+		//head angles from the time it was taken
+		if (headIn.update(true) == 0) {
+			return;
+		}
+
 		//prepare aggregator images
 		ImageOf<PixelFloat> &laggImg = portAggL->prepare();
 		ImageOf<PixelFloat> &raggImg = portAggR->prepare();
-		laggImg.resize(ecols, erows); laggImg.zero();
-		raggImg.resize(ecols,erows); raggImg.zero();
-		maggL = new Mat(laggImg.height(), laggImg.width(), CV_32F, (void *)laggImg.getRawImage());
-		maggR = new Mat(raggImg.height(), raggImg.width(), CV_32F, (void *)raggImg.getRawImage());
+		laggImg.resize(ecols, erows);
+		raggImg.resize(ecols, erows);
+		maggL = wrap(laggImg);
+		maggR = wrap(raggImg);
 
 		ImageOf<PixelFloat> &sagL = portSalLO->prepare();
 		ImageOf<PixelFloat> &sagR = portSalRO->prepare();
 		sagL.resize(cxl*2, cyl*2); sagL.zero();
 		sagR.resize(cxr*2 ,cyr*2); sagR.zero();
-		msagL = new Mat(sagL.height(), sagL.width(), CV_32F, (void *)sagL.getRawImage());
-		msagR = new Mat(sagR.height(), sagR.width(), CV_32F, (void *)sagR.getRawImage());
+		msagL = wrap(sagL);
+		msagR = wrap(sagR);
 
-		//check for any input images that are available, and apply map
+		//remap whichever input pairs are available straight into their output ports
 		ImageOf<PixelFloat> *pImgL;
 		ImageOf<PixelFloat> *pImgR;
-		Mat * Iiml, * Iimr, *Oiml, *Oimr;
+		yarp::sig::Vector *headAng;
 		status = true;
+		mskShared = false;
 		for (int i = 0; i < nmaps; i++) {
 
-			pImgL = portImgL[i]->read(false);
-			pImgR = portImgR[i]->read(false);
-			(*mosaicl[i]) = decays[i]*(*mosaicl[i]);
-			(*mosaicr[i]) = decays[i]*(*mosaicr[i]);
+			fresh[i] = input[i]->getPair(pImgL, pImgR, headAng);
+			status &= fresh[i];
+			if (!fresh[i]) {
+				continue;
+			}
 
-			if (pImgL && pImgR)
-			{
+			setWarp(headAng ? *headAng : headIn.data(headIn.size()-1));
 
-				ImageOf<PixelFloat> &loutImg = portImgLO[i]->prepare();
-				ImageOf<PixelFloat> &routImg = portImgRO[i]->prepare();
-				loutImg.resize(ecols,erows); routImg.resize(ecols,erows);
-
-				Iiml = new Mat(pImgL->height(), pImgL->width(), CV_32F, (void *)pImgL->getRawImage());
-				Iimr = new Mat(pImgR->height(), pImgR->width(), CV_32F, (void *)pImgR->getRawImage());
-				Oiml = new Mat(loutImg.height(), loutImg.width(), CV_32F, (void *)loutImg.getRawImage());
-				Oimr = new Mat(routImg.height(), routImg.width(), CV_32F, (void *)routImg.getRawImage());
-
-				//add unwarped maps straight to the normal aggregator
-				(*msagL) = (*msagL) + weights[i]*(*Iiml);
-				(*msagR) = (*msagR) + weights[i]*(*Iimr);
-
-				//flip images to keep them consistent with output map convention
-				flip(*Iiml, *Iiml, -1);
-				flip(*Iimr, *Iimr, -1);
-
-				//apply maps
-				remap(*Iiml, *Oiml, *Mxl, *Myl, INTER_LINEAR);
-				remap(*Iimr, *Oimr, *Mxr, *Myr, INTER_LINEAR);
-
-				//update mosaic
-				for (int j = 0; j < erows; j++) {
-					for (int k = 0; k < ecols; k++) {
-						if (updMskL->at<float>(j,k) > 0)
-							mosaicl[i]->at<float>(j,k) = Oiml->at<float>(j,k);
-						if (updMskR->at<float>(j,k) > 0)
-							mosaicr[i]->at<float>(j,k) = Oimr->at<float>(j,k);
-					}
-				}
-				flip(*Oiml, *Oiml, 1);
-				flip(*Oimr, *Oimr, 1);
+			ImageOf<PixelFloat> &loutImg = portImgLO[i]->prepare();
+			ImageOf<PixelFloat> &routImg = portImgRO[i]->prepare();
+			loutImg.resize(ecols,erows); routImg.resize(ecols,erows);
+			outL[i] = wrap(loutImg);
+			outR[i] = wrap(routImg);
+			mskL[i] = *updMskL;
+			mskR[i] = *updMskR;
+			mskShared = true;
 
-				//write to port and cleanup
-				portImgLO[i]->write();
-				portImgRO[i]->write();
-				status &= true;
-				delete Iiml, Iimr, Oiml, Oimr;
+			//add unwarped maps straight to the normal aggregator
+			Mat Iiml = wrap(*pImgL);
+			Mat Iimr = wrap(*pImgR);
+			scaleAdd(Iiml, weights[i], msagL, msagL);
+			scaleAdd(Iimr, weights[i], msagR, msagR);
 
-			}
-			else {
+			//apply maps (these already account for the flipped input convention)
+			remap(Iiml, outL[i], *Mxl, *Myl, INTER_LINEAR);
+			remap(Iimr, outR[i], *Mxr, *Myr, INTER_LINEAR);
+
+		}
 
-				status &= false;
+		//decay every mosaic, paste the fresh maps in where the update masks are
+		//set, and sum into the aggregates in a single pass over all maps. the
+		//aggregates are flipped lr on the way out (not sure why?)
+		#pragma omp parallel for
+		for (int r = 0; r < erows; r++) {
 
+			float * aggL = maggL.ptr<float>(r);
+			float * aggR = maggR.ptr<float>(r);
+			for (int j = 0; j < ecols; j++) {
+				aggL[j] = 0.0f; aggR[j] = 0.0f;
 			}
 
-			(*maggL) = (*maggL) + weights[i]*(*mosaicl[i]);
-			(*maggR) = (*maggR) + weights[i]*(*mosaicr[i]);
+			for (int i = 0; i < nmaps; i++) {
+				float * ml = mosaicl[i]->ptr<float>(r);
+				float * mr = mosaicr[i]->ptr<float>(r);
+				const float d = decays[i], w = weights[i];
+				if (fresh[i]) {
+					const float * ol = outL[i].ptr<float>(r);
+					const float * orr = outR[i].ptr<float>(r);
+					const float * kl = mskL[i].ptr<float>(r);
+					const float * kr = mskR[i].ptr<float>(r);
+					for (int j = 0; j < ecols; j++) {
+						ml[j] = kl[j] > 0 ? ol[j] : d*ml[j];
+						mr[j] = kr[j] > 0 ? orr[j] : d*mr[j];
+						aggL[ecols-1-j] += w*ml[j];
+						aggR[ecols-1-j] += w*mr[j];
+					}
+				} else {
+					for (int j = 0; j < ecols; j++) {
+						ml[j] = d*ml[j];
+						mr[j] = d*mr[j];
+						aggL[ecols-1-j] += w*ml[j];
+						aggR[ecols-1-j] += w*mr[j];
+					}
+				}
+			}
 
-		}
+			//saturate saliences at 0
+			for (int j = 0; j < ecols; j++) {
+				aggL[j] = aggL[j] > 0 ? aggL[j] : 0.0f;
+				aggR[j] = aggR[j] > 0 ? aggR[j] : 0.0f;
+			}
 
-		//flip final image lr again (not sure why?)
-		flip(*maggL, *maggL, 1);
-		flip(*maggR, *maggR, 1);
+		}
+		threshold(msagL, msagL, 0, 0, CV_THRESH_TOZERO);
+		threshold(msagR, msagR, 0, 0, CV_THRESH_TOZERO);
 
-		//saturate saliences at 0
-		threshold(*maggL, *maggL, 0, 0, CV_THRESH_TOZERO);
-		threshold(*maggR, *maggR, 0, 0, CV_THRESH_TOZERO);
-		threshold(*msagL, *msagL, 0, 0, CV_THRESH_TOZERO);
-		threshold(*msagR, *msagR, 0, 0, CV_THRESH_TOZERO);
+		//flip the remapped maps to the output convention and send them
+		for (int i = 0; i < nmaps; i++) {
+			if (fresh[i]) {
+				flip(outL[i], outL[i], 1);
+				flip(outR[i], outR[i], 1);
+				portImgLO[i]->write();
+				portImgRO[i]->write();
+			}
+		}
 
-		//write aggregated maps, clean
+		//write aggregated maps
 		if (status) {
 			portSalLO->write();
 			portSalRO->write();
@@ -520,7 +605,6 @@ public:
 		}
 		portAggL->write();
 		portAggR->write();
-		delete maggL, maggR, msagL, msagR;
 
 	}
 
@@ -529,18 +613,15 @@ public:
 
 		for (int i = 0; i < nmaps; i++) {
 
-			portImgL[i]->interrupt();
-			portImgR[i]->interrupt();
+			input[i]->interrupt();
 			portImgLO[i]->interrupt();
 			portImgRO[i]->interrupt();
 
-			portImgL[i]->close();
-			portImgR[i]->close();
+			input[i]->close();
 			portImgLO[i]->close();
 			portImgRO[i]->close();
 
-			delete portImgL[i];
-			delete portImgR[i];
+			delete input[i];
 			delete portImgLO[i];
 			delete portImgRO[i];
 
@@ -549,8 +630,8 @@ public:
 
 		}
 
-		portHAngIn->interrupt();
-		portHAngIn->close();
+		headIn.interrupt();
+		headIn.close();
 		portAggL->interrupt();
 		portAggL->close();
 		portAggR->interrupt();
@@ -560,15 +641,31 @@ public:
 		portSalRO->interrupt();
 		portSalRO->close();
 
-		delete portHAngIn;
-		delete portImgL, portImgR;
-		delete portImgLO, portImgRO;
-		delete portAggL, portAggR;
-		delete portSalLO, portSalRO;
-
-		delete Mxl, Myl, Mxr, Myr;
-		delete updMskL, updMskR, whtBlk, mosaicl, mosaicr;
-
+		delete [] input;
+		delete [] portImgLO;
+		delete [] portImgRO;
+		delete portAggL;
+		delete portAggR;
+		delete portSalLO;
+		delete portSalRO;
+
+		delete Mxl;
+		delete Myl;
+		delete Mxr;
+		delete Myr;
+		delete [] rayX;
+		delete [] rayY;
+		delete [] rayZ;
+		delete [] outL;
+		delete [] outR;
+		delete [] mskL;
+		delete [] mskR;
+		delete [] fresh;
+		delete updMskL;
+		delete updMskR;
+		delete whtBlk;
+		delete [] mosaicl;
+		delete [] mosaicr;
 
 	}
 
@@ -0,0 +1,348 @@
+/*
+ *  stereoSync.h
+ *
+ * 	synchronized stereo input for the stereo vision modules. the left and right
+ * 	image ports (and optionally a head state port) are drained into short
+ * 	buffers, each sample tagged with its envelope timestamp. left/right pairs are
+ * 	only handed out when their timestamps agree within a tolerance, together
+ * 	with the head state closest to the pair time. anything older than a returned
+ * 	pair, or older than maxAge, is dropped.
+ *
+ * 	senders that don't set an envelope get stamped with the local arrival time,
+ * 	which gives roughly the old "read whatever is newest" behavior. latency is
+ * 	measured against the local clock, so it is only meaningful if the senders'
+ * 	clocks are reasonably in sync with ours.
+ *
+ *  usage:
+ *
+ *  	StereoSync<ImageOf<PixelRgb> > sync;
+ *  	sync.open("/mod/img:l", "/mod/img:r", "/mod/head:i");
+ *  	...
+ *  	ImageOf<PixelRgb> *l, *r; yarp::sig::Vector *h;
+ *  	if (sync.getPair(l, r, h)) { ... }	//valid until the next getPair
+ *
+ */
+
+#ifndef STEREOSYNC_H_
+#define STEREOSYNC_H_
+
+#include <yarp/os/BufferedPort.h>
+#include <yarp/os/Stamp.h>
+#include <yarp/os/Time.h>
+#include <yarp/sig/Vector.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+
+/* StampedPortBuffer
+ * Desc: a port plus the last few samples read from it and their timestamps,
+ * oldest first. sample storage is recycled.
+ */
+template <class T>
+class StampedPortBuffer {
+
+public:
+
+	yarp::os::BufferedPort<T> port;
+
+	StampedPortBuffer(int _depth = 8) : depth(_depth), dropped(0), newest(-1.0) { }
+
+	~StampedPortBuffer() {
+		clear();
+		for (unsigned int i = 0; i < spare.size(); i++) {
+			delete spare[i];
+		}
+	}
+
+	bool open(const std::string &pname) { return port.open(pname.c_str()); }
+	void interrupt() { port.interrupt(); }
+	void close() { port.close(); clear(); }
+
+	/* update
+	 * Desc: move everything pending on the port into the buffer. if wait is set,
+	 * block until at least one sample came in. returns the number of new samples
+	 */
+	int update(bool wait = false) {
+
+		int n = 0;
+		T * p;
+		while ((p = port.read(wait && n == 0)) != NULL) {
+
+			yarp::os::Stamp st;
+			double t;
+			if (port.getEnvelope(st) && st.isValid()) {
+				t = st.getTime();
+			} else {
+				t = yarp::os::Time::now();
+			}
+
+			Sample s;
+			s.t = t;
+			if (spare.size() > 0) {
+				s.d = spare.back();
+				spare.pop_back();
+			} else {
+				s.d = new T;
+			}
+			*(s.d) = *p;
+			samples.push_back(s);
+			if (t > newest) newest = t;
+			n++;
+
+			if ((int)samples.size() > depth) {
+				dropFront(1);
+			}
+
+		}
+
+		return n;
+
+	}
+
+	int size() const { return (int)samples.size(); }
+	double stamp(int i) const { return samples[i].t; }
+	T & data(int i) { return *(samples[i].d); }
+	double newestStamp() const { return newest; }
+	int getDropped() const { return dropped; }
+
+	/* nearest
+	 * Desc: index of the sample closest in time to t, or -1 if none is within tol
+	 */
+	int nearest(double t, double tol) const {
+
+		int best = -1;
+		double bd = tol;
+		for (int i = 0; i < (int)samples.size(); i++) {
+			double d = fabs(samples[i].t - t);
+			if (d <= bd) {
+				bd = d;
+				best = i;
+			}
+		}
+
+		return best;
+
+	}
+
+	/* dropFront
+	 * Desc: drop the n oldest samples
+	 */
+	void dropFront(int n) {
+		for (int i = 0; i < n && samples.size() > 0; i++) {
+			spare.push_back(samples.front().d);
+			samples.pop_front();
+			dropped++;
+		}
+	}
+
+	/* consumeFront
+	 * Desc: release the oldest sample after it has been used (not counted as dropped)
+	 */
+	void consumeFront() {
+		if (samples.size() > 0) {
+			spare.push_back(samples.front().d);
+			samples.pop_front();
+		}
+	}
+
+	/* dropOlder
+	 * Desc: drop all samples stamped before t
+	 */
+	void dropOlder(double t) {
+		while (samples.size() > 0 && samples.front().t < t) {
+			dropFront(1);
+		}
+	}
+
+private:
+
+	struct Sample {
+		double t;
+		T * d;
+	};
+
+	std::deque<Sample> samples;
+	std::vector<T *> spare;
+	int depth;
+	int dropped;
+	double newest;
+
+	void clear() {
+		while (samples.size() > 0) {
+			spare.push_back(samples.front().d);
+			samples.pop_front();
+		}
+	}
+
+};
+
+
+/* StereoSync
+ * Desc: pairs up left/right images (and head state) by timestamp
+ */
+template <class T>
+class StereoSync {
+
+public:
+
+	StampedPortBuffer<T> left;
+	StampedPortBuffer<T> right;
+
+	StereoSync() : head(NULL), ownHead(false), imgTol(0.01), headTol(0.02), maxAge(0.5),
+		pending(false), pairs(0), latency(0.0), skew(0.0) { }
+
+	~StereoSync() {
+		if (ownHead) delete head;
+	}
+
+	/* open
+	 * Desc: open the image ports, and the head state port if a name is given
+	 */
+	bool open(const std::string &lName, const std::string &rName, const std::string &hName = "") {
+
+		bool ok = left.open(lName) && right.open(rName);
+		if (hName != "") {
+			head = new StampedPortBuffer<yarp::sig::Vector>(32);
+			ownHead = true;
+			ok = ok && head->open(hName);
+		}
+
+		return ok;
+
+	}
+
+	/* attachHead
+	 * Desc: use a head state buffer owned by someone else (e.g. shared between
+	 * several stereo inputs). the owner is responsible for updating it.
+	 */
+	void attachHead(StampedPortBuffer<yarp::sig::Vector> *h) {
+		if (ownHead) delete head;
+		head = h;
+		ownHead = false;
+	}
+
+	/* setTolerance
+	 * Desc: max. timestamp difference (s) between left and right images, and between
+	 * the image pair and the head state. maxAge is how long an unmatched sample is kept
+	 */
+	void setTolerance(double _imgTol, double _headTol, double _maxAge) {
+		imgTol = _imgTol;
+		headTol = _headTol;
+		maxAge = _maxAge;
+	}
+
+	void setStrict(bool strict) {
+		left.port.setStrict(strict);
+		right.port.setStrict(strict);
+	}
+
+	void interrupt() {
+		left.interrupt();
+		right.interrupt();
+		if (ownHead) head->interrupt();
+	}
+
+	void close() {
+		left.close();
+		right.close();
+		if (ownHead) head->close();
+	}
+
+	/* getPair
+	 * Desc: get the newest left/right pair with matching timestamps. if a head port is
+	 * connected, the pair is held back until a head sample within tolerance is
+	 * available (h is NULL if there is no head input). returned data stays valid until
+	 * the next call. returns false if there is no new pair
+	 */
+	bool getPair(T *&l, T *&r, yarp::sig::Vector *&h) {
+
+		//the previous pair has been used up
+		if (pending) {
+			left.consumeFront();
+			right.consumeFront();
+			pending = false;
+		}
+
+		left.update();
+		right.update();
+		bool useHead = head != NULL && head->port.getInputCount() > 0;
+		if (ownHead) head->update();
+
+		//newest left image that has a right (and head) partner
+		for (int i = left.size()-1; i >= 0; i--) {
+
+			int j = right.nearest(left.stamp(i), imgTol);
+			if (j < 0) {
+				continue;
+			}
+
+			double t = 0.5*(left.stamp(i) + right.stamp(j));
+			int k = -1;
+			if (useHead) {
+				k = head->nearest(t, headTol);
+				if (k < 0) {
+					continue;
+				}
+			}
+
+			//anything older than the pair is stale now
+			left.dropFront(i);
+			right.dropFront(j);
+			pending = true;
+
+			//pairing stats (running averages)
+			double lat = yarp::os::Time::now() - t;
+			double skw = fabs(left.stamp(0) - right.stamp(0));
+			if (pairs == 0) {
+				latency = lat;
+				skew = skw;
+			} else {
+				latency = 0.9*latency + 0.1*lat;
+				skew = 0.9*skew + 0.1*skw;
+			}
+			pairs++;
+
+			l = &left.data(0);
+			r = &right.data(0);
+			h = useHead ? &head->data(k) : NULL;
+
+			if (ownHead && k >= 0) {
+				head->dropOlder(std::min(head->stamp(k), head->newestStamp() - maxAge));
+			}
+
+			return true;
+
+		}
+
+		//nothing matched, get rid of what can't be matched anymore
+		left.dropOlder(right.newestStamp() - maxAge);
+		right.dropOlder(left.newestStamp() - maxAge);
+		if (ownHead && head->size() > 0) head->dropOlder(head->newestStamp() - maxAge);
+
+		return false;
+
+	}
+
+	//pairing metrics
+	int getPairs() const { return pairs; }
+	int getDropped() const { return left.getDropped() + right.getDropped(); }
+	double getLatency() const { return latency; }
+	double getSkew() const { return skew; }
+
+private:
+
+	StampedPortBuffer<yarp::sig::Vector> *head;
+	bool ownHead;
+	double imgTol, headTol, maxAge;
+	bool pending;
+	int pairs;
+	double latency;
+	double skew;
+
+};
+
+#endif
@@ -65,6 +65,13 @@
  *			If not set, or if mapMin == mapMax, the map will remain in its original scaling (real XYZ coordinates)
  *			It is suggested that these parameters be set to be as close as possible for the application,
  *			as this will reduce rounding error for the reconstruction
+ *		syncTol, syncHeadTol - max. timestamp difference (s) between the left and right images (D 0.01),
+ *			and between the image pair and the head angles (D 0.02). frames without a partner are
+ *			dropped after syncAge seconds (D 0.5). see stereoSync.h
+ *		rectCache - number of recent eye poses to keep rectification maps for (D 8). maps are only
+ *			rebuilt when the eyes move outside a cached pose bin.
+ *		rectQuantR, rectQuantT - pose bin size, in degrees (D 0.05) and meters (D 0.0001), for the
+ *			rotation and translation between the eyes
  *
  *  outputs:
  *  	/stereoVision/img:o -- 8bit 3-channel disparity image. to get proper floating point disparity
@@ -79,6 +86,8 @@
  *  		"disp u v" -- Get the disparity value (32F) at the pixel (u,v)
  *  		"set <param> <val>" -- set the named parameter to the target value. allowable parameters
  *  						are those for the stereo block matching, as listed above
+ *  		"sync" -- input pairing metrics: mean latency (s), mean left/right skew (s),
+ *  						pairs processed, frames dropped
  *
  *  TODO:
  *
@@ -108,6 +117,7 @@
 #include <cv.h>
 
 #include <string>
+#include <list>
 #include <time.h>
 #include <stdio.h>
 #include <math.h>
@@ -116,6 +126,8 @@
 #include <iCub/iKin/iKinFwd.h>
 #include <iCub/ctrl/math.h>
 
+#include "../stereoSync/stereoSync.h"
+
 //namespaces
 using namespace std;
 using namespace cv;
@@ -139,9 +151,7 @@ protected:
 	ResourceFinder &rf;
 	string name;
 
-	BufferedPort<yarp::sig::Vector > *portHead;
-	BufferedPort<ImageOf<PixelRgb> > *portImgL;
-	BufferedPort<ImageOf<PixelRgb> > *portImgR;
+	StereoSync<ImageOf<PixelRgb> > input;	//left/right images and head angles, matched by timestamp
 	BufferedPort<ImageOf<PixelBgr> > *portImgO;
 	BufferedPort<ImageOf<PixelBgr> > *portImgLO;
 	BufferedPort<ImageOf<PixelBgr> > *portImgRO;
@@ -163,13 +173,29 @@ protected:
 	double fxl, fyl, cxl, cyl;
 	double fxr, fyr, cxr, cyr;
 	int wl, hl, wr, hr;
-	Mat mpxL, mpyL, mpxR, mpyR;
-	Mat impxL, impyL, impxR, impyR;
 
 	//aux. data for stereo processing
 	Mat R1, R2, P1, P2;
 	Mat R, Rl, Rr;
 
+	//rectification cache. everything here only depends on the relative pose
+	//of the two eyes, so it is kept for the last few (quantized) poses
+	struct RectMaps {
+		int key[6];				//quantized rotation vector and translation
+		Mat R1, R2, P1, P2, Q;
+		Mat mapL1, mapL2;		//fixed point rectification maps
+		Mat mapR1, mapR2;
+		Mat imapL1, imapL2;		//fixed point map to unrectify (left image)
+	};
+	list<RectMaps> rectCache;	//most recently used first
+	int rectCacheSize;
+	double quantR, quantT;
+
+	//block matchers, set up again only when a parameter changes
+	StereoSGBM sgbm;
+	StereoBM sbm;
+	bool matcherDirty;
+
 	//parameters for stereo block matching algorithm
 	int ctype;
 	bool useSG;
@@ -218,6 +244,21 @@ public:
 
 	}
 
+	/* getSyncStats
+	 * Desc: input pairing metrics: mean latency and l/r skew (s), pairs made, frames dropped
+	 */
+	virtual Bottle getSyncStats() {
+
+		Bottle st;
+		st.addDouble(input.getLatency());
+		st.addDouble(input.getSkew());
+		st.addInt(input.getPairs());
+		st.addInt(input.getDropped());
+
+		return st;
+
+	}
+
 	//get the current root to eye H matrix
 	virtual Bottle getH(int eye = 0) {
 
@@ -380,6 +421,80 @@ public:
 
 
 
+	/* getRectMaps
+	 * Desc: Get the rectification (and unrectification) maps for the relative eye
+	 * pose R, T (left to right). Poses are quantized; if a pose in the same bin was
+	 * seen recently its maps are reused, otherwise they are built and cached.
+	 */
+	RectMaps & getRectMaps(const Mat &R, const vector<double> &T) {
+
+		int key[6];
+		Mat rvec;
+		Rodrigues(R, rvec);
+		for (int i = 0; i < 3; i++) {
+			key[i] = cvRound(rvec.at<double>(i,0)/quantR);
+			key[i+3] = cvRound(T[i]/quantT);
+		}
+
+		//look for it, and move it to the front if found
+		for (list<RectMaps>::iterator it = rectCache.begin(); it != rectCache.end(); it++) {
+			if (equal(key, key+6, it->key)) {
+				rectCache.splice(rectCache.begin(), rectCache, it);
+				return rectCache.front();
+			}
+		}
+
+		//not there, build a new set of maps
+		if ((int)rectCache.size() >= rectCacheSize && rectCache.size() > 0) {
+			rectCache.pop_back();
+		}
+		rectCache.push_front(RectMaps());
+		RectMaps &rm = rectCache.front();
+		copy(key, key+6, rm.key);
+
+		stereoRectify(Pl, Mat::zeros(4,1,CV_64F), Pr, Mat::zeros(4,1,CV_64F), Size(wl, hl), R, Mat(T), rm.R1, rm.R2, rm.P1, rm.P2, rm.Q, CALIB_ZERO_DISPARITY, -1);
+		initUndistortRectifyMap(Pl, Mat(), rm.R1, rm.P1, Size(wl, hl), CV_16SC2, rm.mapL1, rm.mapL2);
+		initUndistortRectifyMap(Pr, Mat(), rm.R2, rm.P2, Size(wr, hr), CV_16SC2, rm.mapR1, rm.mapR2);
+
+		//create an inverse mapping to unrectify the disparity map
+		Mat P1n = rm.P1.rowRange(0,3).colRange(0,3);
+		initUndistortRectifyMap(P1n, Mat(), rm.R1.t(), Pl, Size(wl, hl), CV_16SC2, rm.imapL1, rm.imapL2);
+
+		return rm;
+
+	}
+
+	/* setupMatchers
+	 * Desc: (re)apply the block matching parameters to the matchers
+	 */
+	void setupMatchers() {
+
+		int cn = 1;
+		sgbm.preFilterCap = preFiltCap;
+		sgbm.SADWindowSize = blockSize;
+		sgbm.P1 = ps1*cn*sgbm.SADWindowSize*sgbm.SADWindowSize;
+		sgbm.P2 = ps2*cn*sgbm.SADWindowSize*sgbm.SADWindowSize;
+		sgbm.minDisparity = minDisp;
+		sgbm.numberOfDisparities = nDisp;
+		sgbm.uniquenessRatio = uniquenessRatio;
+		sgbm.speckleWindowSize = speckWS;
+		sgbm.speckleRange = speckRng;
+		sgbm.disp12MaxDiff = dispMaxDiff;
+		sgbm.fullDP = dp;
+
+		sbm.init(CV_STEREO_BM_BASIC, nDisp, blockSize);
+		sbm.state->preFilterCap = preFiltCap;
+		sbm.state->minDisparity = minDisp;
+		sbm.state->numberOfDisparities = nDisp;
+		sbm.state->uniquenessRatio = uniquenessRatio;
+		sbm.state->speckleWindowSize = speckWS;
+		sbm.state->speckleRange = speckRng;
+		sbm.state->disp12MaxDiff = dispMaxDiff;
+
+		matcherDirty = false;
+
+	}
+
 	virtual bool threadInit()
 	{
 
@@ -476,21 +591,19 @@ public:
 
 		strict = rf.check("strict");
 
+		rectCacheSize = rf.check("rectCache",Value(8)).asInt();
+		quantR = PI*rf.check("rectQuantR",Value(0.05)).asDouble()/180.0;
+		quantT = rf.check("rectQuantT",Value(0.0001)).asDouble();
+		matcherDirty = true;
+
 		mapMin = rf.check("mapMin",Value(0)).asDouble();
 		mapMax = rf.check("mapMax",Value(0)).asDouble();
 
 		//open up ports
-		portHead=new BufferedPort<yarp::sig::Vector >;
-		string portHeadName="/"+name+"/head:i";
-		portHead->open(portHeadName.c_str());
-
-		portImgL=new BufferedPort<ImageOf<PixelRgb> >;
-		string portImgLName="/"+name+"/img:l";
-		portImgL->open(portImgLName.c_str());
-
-		portImgR=new BufferedPort<ImageOf<PixelRgb> >;
-		string portImgRName="/"+name+"/img:r";
-		portImgR->open(portImgRName.c_str());
+		input.open("/"+name+"/img:l", "/"+name+"/img:r", "/"+name+"/head:i");
+		input.setTolerance(rf.check("syncTol",Value(0.01)).asDouble(),
+				rf.check("syncHeadTol",Value(0.02)).asDouble(),
+				rf.check("syncAge",Value(0.5)).asDouble());
 
 		portImgO=new BufferedPort<ImageOf<PixelBgr> >;
 		string portImgOName="/"+name+"/img:o";
@@ -551,8 +664,7 @@ public:
 
 		//set reader ports to do strict reads
 		if (strict) {
-			portImgL->setStrict(true);
-			portImgR->setStrict(true);
+			input.setStrict(true);
 		}
 
 		Hl0 = eyeL->getH(QL);
@@ -566,13 +678,11 @@ public:
 	virtual void run()
 	{
 
-		//make sure there are two images available before grabbing one
-
-		if (portImgL->getPendingReads() > 0 && portImgR->getPendingReads() >0) {
+		//only go ahead with a left/right pair (and head angles) taken at the same time
+		ImageOf<PixelRgb> *pImgL, *pImgR;
+		yarp::sig::Vector *headAng;
 
-			//get the normal salience maps after pre-focusing
-			ImageOf<PixelRgb> *pImgL = portImgL->read(false);
-			ImageOf<PixelRgb> *pImgR = portImgR->read(false);
+		if (input.getPair(pImgL, pImgR, headAng)) {
 
 
 			Mat Sl, Sr;
@@ -593,7 +703,6 @@ public:
 
 
 			//look for joint information from gazectrl
-			yarp::sig::Vector *headAng = portHead->read(false);
 			if (clientGazeCtrl.isValid()) {
 
 				igaze->getLeftEyePose(eo, ep);
@@ -637,6 +746,16 @@ public:
 			//if we have a proper head/eye pose reading, do rectification and disparity map
 			if (havePose) {
 
+				//pick up parameter changes from the rpc port; this frame uses
+				//its own copy of the ones read below
+				mutex->wait();
+				if (matcherDirty) {
+					setupMatchers();
+				}
+				int ct = ctype, nd = nDisp;
+				bool sg = useSG;
+				mutex->post();
+
 				//get the transform matrix from the left image to the right image
 				H = SE3inv(Hrt)*Hr0*H0*SE3inv(SE3inv(Hlt)*Hl0);
 				for (int i = 0; i < 3; i++) {
@@ -646,26 +765,12 @@ public:
 					T.at(i) = H(i,3);
 				}
 
-				//rectify the images
-				stereoRectify(Pl, Mat::zeros(4,1,CV_64F), Pr, Mat::zeros(4,1,CV_64F), Size(wl, hl), R, Mat(T), R1, R2, P1, P2, Qtmp, CALIB_ZERO_DISPARITY, -1);
-				initUndistortRectifyMap(Pl, Mat(), R1, P1, Size(wl, hl), CV_32FC1, mpxL, mpyL);
-				initUndistortRectifyMap(Pr, Mat(), R2, P2, Size(wr, hr), CV_32FC1, mpxR, mpyR);
-				remap(Sl, Scl, mpxL, mpyL, INTER_LINEAR);
-				remap(Sr, Scr, mpxR, mpyR, INTER_LINEAR);
-
-
-				//create an inverse mapping to unrectify the disparity map
-				Mat P1n, P2n, Pln, Prn;
-				P1n = P1.rowRange(0,3).colRange(0,3);
-				P2n = P2.rowRange(0,3).colRange(0,3);
-				Pln = Pl.t(); Pln.resize(4,0); Pln = Pln.t();
-				Prn = Pr.t(); Prn.resize(4,0); Prn = Prn.t();
-				Prn.at<double>(0,3) = -P2.at<double>(0,3);
-
-
-				//initUndistortRectifyMap(P1n, Mat(), R1.t(), Pln, Size(wl, hl), CV_32FC1, impxL, impyL);
-				initUndistortRectifyMap(P1n, Mat(), R1.t(), Pl, Size(wl, hl), CV_32FC1, impxL, impyL);
-				initUndistortRectifyMap(P2n, Mat(), R2.t(), Prn, Size(wr, hr), CV_32FC1, impxR, impyR);
+				//rectify the images (maps come from the cache unless the eyes moved)
+				RectMaps &rm = getRectMaps(R, T);
+				R1 = rm.R1; R2 = rm.R2; P1 = rm.P1; P2 = rm.P2;
+				rm.Q.copyTo(Qtmp);
+				remap(Sl, Scl, rm.mapL1, rm.mapL2, INTER_LINEAR);
+				remap(Sr, Scr, rm.mapR1, rm.mapR2, INTER_LINEAR);
 
 
 				//convert to HSV color space and get the S channel (for colored objects basically)
@@ -674,7 +779,7 @@ public:
 				Mat ctmp(Scl.rows, Scl.cols, CV_8UC3);
 
 
-				if (ctype == 1) {
+				if (ct == 1) {
 
 					//take an HSV conversion and grab the sat channel
 					int * frto = new int[4];
@@ -720,22 +825,7 @@ public:
 
 
 				//perform stereo block matching algorithm
-				if (useSG) {
-
-					StereoSGBM sgbm;
-
-					int cn = 1;
-					sgbm.preFilterCap = preFiltCap;
-					sgbm.SADWindowSize = blockSize;
-					sgbm.P1 = ps1*cn*sgbm.SADWindowSize*sgbm.SADWindowSize;
-					sgbm.P2 = ps2*cn*sgbm.SADWindowSize*sgbm.SADWindowSize;
-					sgbm.minDisparity = minDisp;
-					sgbm.numberOfDisparities = nDisp;
-					sgbm.uniquenessRatio = uniquenessRatio;
-					sgbm.speckleWindowSize = speckWS;
-					sgbm.speckleRange = speckRng;
-					sgbm.disp12MaxDiff = dispMaxDiff;
-					sgbm.fullDP = dp;
+				if (sg) {
 
 					//sgbm(Scl, Scr, dispo);
 					sgbm(scl1, scr1, dispo);
@@ -753,16 +843,6 @@ public:
 				}
 				else {
 
-					StereoBM sbm(CV_STEREO_BM_BASIC, nDisp, blockSize);
-
-					sbm.state->preFilterCap = preFiltCap;
-					sbm.state->minDisparity = minDisp;
-					sbm.state->numberOfDisparities = nDisp;
-					sbm.state->uniquenessRatio = uniquenessRatio;
-					sbm.state->speckleWindowSize = speckWS;
-					sbm.state->speckleRange = speckRng;
-					sbm.state->disp12MaxDiff = dispMaxDiff;
-
 					mutex->wait();
 					sbm(scl1,scr1,*disp,CV_32F);
 #if CV_MINOR_VERSION < 4
@@ -777,11 +857,11 @@ public:
 
 				//disp->convertTo(dispt, CV_8U, 255/(nDisp*16.));
 				disp->convertTo(dispt, CV_8U, 1);
-				dispt = (255.0/(double)nDisp)*dispt;
+				dispt = (255.0/(double)nd)*dispt;
 
 				//undo the rectification before sending out the disparity image
 				dispo = Mat(dispt.rows,dispt.cols,CV_8U);
-				remap(dispt, dispo, impxL, impyL, INTER_LINEAR);
+				remap(dispt, dispo, rm.imapL1, rm.imapL2, INTER_LINEAR);
 
 				ImageOf<PixelBgr> &oImg = portImgO->prepare();
 				oImg.resize(*pImgL);
@@ -832,7 +912,7 @@ public:
 					perspectiveTransform(map,tmap,Hm);
 
 					//remap to the original (unrectified) image plane
-					remap(tmap, map, impxL, impyL, INTER_LINEAR);
+					remap(tmap, map, rm.imapL1, rm.imapL2, INTER_LINEAR);
 
 					//may need to be ranged from [mapMin, mapMax] -> [0,255] for saving
 					//if mapMin == mapMax, do not scale
@@ -887,23 +967,22 @@ public:
 		if (clientGazeCtrl.isValid())
 			clientGazeCtrl.close();
 
-		portImgL->interrupt();
-		portImgR->interrupt();
+		input.interrupt();
 		portImgO->interrupt();
 		portImgLO->interrupt();
 		portImgRO->interrupt();
-		portHead->interrupt();
 		portMapO->interrupt();
 
-		portImgL->close();
-		portImgR->close();
+		input.close();
 		portImgO->close();
 		portImgLO->close();
 		portImgRO->close();
-		portHead->close();
 		portMapO->close();
 
-		delete portImgL, portImgR, portImgO, portImgLO, portImgRO, portHead, portMapO;
+		delete portImgO;
+		delete portImgLO;
+		delete portImgRO;
+		delete portMapO;
 
 		delete mutex;
 		delete disp;
@@ -916,6 +995,9 @@ public:
 
 		bool success = true;
 
+		//run() rebuilds the matchers from these under the same lock
+		mutex->wait();
+
 		if (pname == "useSG") {
 			useSG = (bool)pval;
 		}
@@ -959,6 +1041,10 @@ public:
 			success = false;
 		}
 
+		matcherDirty = true;
+
+		mutex->post();
+
 		return success;
 
 	}
@@ -1032,6 +1118,9 @@ public:
 				reply.add(thr->setParam(param,pval));
 			}
 		}
+		else if (msg == "sync") {
+			reply = thr->getSyncStats();
+		}
 		else if (msg == "geth") {
 			if (command.size() < 3) {
 				reply = thr->getH();